@@ -46,12 +46,20 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // hull_t structure
 // !!! if this is changed, it must be changed in model.h too !!!
 #define	hu_clipnodes		0
-#define	hu_planes			4
-#define	hu_firstclipnode	8
-#define	hu_lastclipnode		12
-#define	hu_clip_mins		16
-#define	hu_clip_maxs		28
-#define hu_size  			40
+#define	hu_firstclipnode	4
+#define	hu_lastclipnode		8
+#define	hu_clip_mins		12
+#define	hu_clip_maxs		24
+#define hu_size  			36
+
+// mclipnode_t structure
+// !!! if this is changed, it must be changed in model.h too !!!
+#define	cn_normal			0
+#define	cn_dist				12
+#define	cn_children			16
+#define	cn_type				24
+#define	cn_planenum			28
+#define	cn_size				32
 
 // dnode_t structure
 // !!! if this is changed, it must be changed in bspfile.h too !!!
@@ -381,6 +381,15 @@ void CL_SendMove (usercmd_t *cmd)
 	MSG_WriteByte (&buf, cmd->lightlevel);
 #endif
 
+//
+// let the server delta from the last entity frame we got
+//
+	if (cl.protocol == PROTOCOL_DELTA)
+	{
+		MSG_WriteByte (&buf, clc_ackframe);
+		MSG_WriteLong (&buf, cl.ackframe);
+	}
+
 //
 // deliver the message
 //
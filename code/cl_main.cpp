@@ -45,7 +45,8 @@ client_static_t	cls;
 client_state_t	cl;
 // FIXME: put these on hunk?
 efrag_t			cl_efrags[MAX_EFRAGS];
-entity_t		cl_entities[MAX_EDICTS];
+entity_t		*cl_entities;
+int				cl_max_edicts;
 entity_t		cl_static_entities[MAX_STATIC_ENTITIES];
 lightstyle_t	cl_lightstyle[MAX_LIGHTSTYLES];
 dlight_t		cl_dlights[MAX_DLIGHTS];
@@ -73,7 +74,7 @@ void CL_ClearState (void)
 
 // clear other arrays	
 	memset (cl_efrags, 0, sizeof(cl_efrags));
-	memset (cl_entities, 0, sizeof(cl_entities));
+	memset (cl_entities, 0, cl_max_edicts*sizeof(entity_t));
 	memset (cl_dlights, 0, sizeof(cl_dlights));
 	memset (cl_lightstyle, 0, sizeof(cl_lightstyle));
 	memset (cl_temp_entities, 0, sizeof(cl_temp_entities));
@@ -716,8 +717,22 @@ CL_Init
 */
 void CL_Init (void)
 {	
+	int		i;
+
 	SZ_Alloc (&cls.message, 1024);
 
+	cl_max_edicts = MIN_EDICTS;
+	i = COM_CheckParm ("-maxedicts");
+	if (i && i < com_argc-1)
+	{
+		cl_max_edicts = Q_atoi (com_argv[i+1]);
+		if (cl_max_edicts < MIN_EDICTS)
+			cl_max_edicts = MIN_EDICTS;
+		if (cl_max_edicts > MAX_EDICTS)
+			cl_max_edicts = MAX_EDICTS;
+	}
+	cl_entities = (entity_t *)Hunk_AllocName (cl_max_edicts*sizeof(entity_t), "cl_ents");
+
 	CL_InitInput ();
 	CL_InitTEnts ();
 	
@@ -64,9 +64,12 @@ char *svc_strings[] =
 	"svc_finale",			// [string] music [string] text
 	"svc_cdtrack",			// [byte] track [byte] looptrack
 	"svc_sellscreen",
-	"svc_cutscene"
+	"svc_cutscene",
+	"svc_packetentities"
 };
 
+packetframe_t	cl_frames[UPDATE_BACKUP];	// PROTOCOL_DELTA entity frames
+
 //=============================================================================
 
 /*
@@ -80,7 +83,7 @@ entity_t	*CL_EntityNum (int num)
 {
 	if (num >= cl.num_entities)
 	{
-		if (num >= MAX_EDICTS)
+		if (num >= cl_max_edicts)
 			Host_Error ("CL_EntityNum: %i is an invalid number",num);
 		while (cl.num_entities<=num)
 		{
@@ -120,13 +123,20 @@ void CL_ParseStartSoundPacket(void)
 	else
 		attenuation = DEFAULT_SOUND_PACKET_ATTENUATION;
 	
-	channel = MSG_ReadShort ();
+	if (field_mask & SND_LARGEENTITY)
+	{
+		ent = (unsigned short)MSG_ReadShort ();
+		channel = MSG_ReadByte ();
+	}
+	else
+	{
+		channel = MSG_ReadShort ();
+		ent = channel >> 3;
+		channel &= 7;
+	}
 	sound_num = MSG_ReadByte ();
 
-	ent = channel >> 3;
-	channel &= 7;
-
-	if (ent > MAX_EDICTS)
+	if (ent >= cl_max_edicts)
 		Host_Error ("CL_ParseStartSoundPacket: ent = %i", ent);
 	
 	for (i=0 ; i<3 ; i++)
@@ -217,11 +227,17 @@ void CL_ParseServerInfo (void)
 
 // parse protocol version number
 	i = MSG_ReadLong ();
-	if (i != PROTOCOL_VERSION)
+	if (i != PROTOCOL_VERSION && i != PROTOCOL_DELTA)
 	{
 		Con_Printf ("Server returned version %i, not %i", i, PROTOCOL_VERSION);
 		return;
 	}
+	cl.protocol = i;
+
+// nothing to delta entities from yet
+	cl.ackframe = -1;
+	for (i=0 ; i<UPDATE_BACKUP ; i++)
+		cl_frames[i].sequence = -1;
 
 // parse maxclients
 	cl.maxclients = MSG_ReadByte ();
@@ -287,7 +303,10 @@ void CL_ParseServerInfo (void)
 
 	for (i=1 ; i<nummodels ; i++)
 	{
-		cl.model_precache[i] = Mod_ForName (model_precache[i], false);
+		if (model_precache[i][0] == '*')
+			cl.model_precache[i] = Mod_InlineModel (cl.model_precache[1], Q_atoi(model_precache[i]+1));
+		else
+			cl.model_precache[i] = Mod_ForName (model_precache[i], false);
 		if (cl.model_precache[i] == NULL)
 		{
 			Con_Printf("Model %s not found\n", model_precache[i]);
@@ -318,48 +337,63 @@ void CL_ParseServerInfo (void)
 
 /*
 ==================
-CL_ParseUpdate
+CL_ReadEntityDelta
 
-Parse an entity update message from the server
+Reads the fields of an entity update, the ones that aren't sent are
+copied from the state the update is relative to
+==================
+*/
+void CL_ReadEntityDelta (int bits, entity_state_t *from, entity_state_t *to)
+{
+	*to = *from;
+
+	if (bits & U_MODEL)
+	{
+		to->modelindex = MSG_ReadByte ();
+		if (to->modelindex >= MAX_MODELS)
+			Host_Error ("CL_ParseModel: bad modnum");
+	}
+	if (bits & U_FRAME)
+		to->frame = MSG_ReadByte ();
+	if (bits & U_COLORMAP)
+		to->colormap = MSG_ReadByte();
+	if (bits & U_SKIN)
+		to->skin = MSG_ReadByte();
+	if (bits & U_EFFECTS)
+		to->effects = MSG_ReadByte();
+
+	if (bits & U_ORIGIN1)
+		to->origin[0] = MSG_ReadCoord ();
+	if (bits & U_ANGLE1)
+		to->angles[0] = MSG_ReadAngle();
+	if (bits & U_ORIGIN2)
+		to->origin[1] = MSG_ReadCoord ();
+	if (bits & U_ANGLE2)
+		to->angles[1] = MSG_ReadAngle();
+	if (bits & U_ORIGIN3)
+		to->origin[2] = MSG_ReadCoord ();
+	if (bits & U_ANGLE3)
+		to->angles[2] = MSG_ReadAngle();
+}
+
+/*
+==================
+CL_SetEntityState
+
+Makes an entity part of the current message.
 If an entities model or origin changes from frame to frame, it must be
 relinked.  Other attributes can change without relinking.
 ==================
 */
-int	bitcounts[16];
-
-void CL_ParseUpdate (int bits)
+void CL_SetEntityState (int num, entity_state_t *state, qboolean nolerp)
 {
 	int			i;
 	model_t		*model;
-	int			modnum;
 	qboolean	forcelink;
 	entity_t	*ent;
-	int			num;
-	int			skin;
-
-	if (cls.signon == SIGNONS - 1)
-	{	// first update is the final signon stage
-		cls.signon = SIGNONS;
-		CL_SignonReply ();
-	}
-
-	if (bits & U_MOREBITS)
-	{
-		i = MSG_ReadByte ();
-		bits |= (i<<8);
-	}
-
-	if (bits & U_LONGENTITY)	
-		num = MSG_ReadShort ();
-	else
-		num = MSG_ReadByte ();
 
 	ent = CL_EntityNum (num);
 
-for (i=0 ; i<16 ; i++)
-if (bits&(1<<i))
-	bitcounts[i]++;
-
 	if (ent->msgtime != cl.mtime[1])
 		forcelink = true;	// no previous frame to lerp from
 	else
@@ -367,16 +401,7 @@ if (bits&(1<<i))
 
 	ent->msgtime = cl.mtime[0];
 	
-	if (bits & U_MODEL)
-	{
-		modnum = MSG_ReadByte ();
-		if (modnum >= MAX_MODELS)
-			Host_Error ("CL_ParseModel: bad modnum");
-	}
-	else
-		modnum = ent->baseline.modelindex;
-		
-	model = cl.model_precache[modnum];
+	model = cl.model_precache[state->modelindex];
 	if (model != ent->model)
 	{
 		ent->model = model;
@@ -397,15 +422,9 @@ if (bits&(1<<i))
 #endif
 	}
 	
-	if (bits & U_FRAME)
-		ent->frame = MSG_ReadByte ();
-	else
-		ent->frame = ent->baseline.frame;
+	ent->frame = state->frame;
 
-	if (bits & U_COLORMAP)
-		i = MSG_ReadByte();
-	else
-		i = ent->baseline.colormap;
+	i = state->colormap;
 	if (!i)
 		ent->colormap = vid.colormap;
 	else
@@ -416,61 +435,27 @@ if (bits&(1<<i))
 	}
 
 #ifdef GLQUAKE
-	if (bits & U_SKIN)
-		skin = MSG_ReadByte();
-	else
-		skin = ent->baseline.skin;
-	if (skin != ent->skinnum) {
-		ent->skinnum = skin;
+	if (state->skin != ent->skinnum) {
+		ent->skinnum = state->skin;
 		if (num > 0 && num <= cl.maxclients)
 			R_TranslatePlayerSkin (num - 1);
 	}
 
 #else
 
-	if (bits & U_SKIN)
-		ent->skinnum = MSG_ReadByte();
-	else
-		ent->skinnum = ent->baseline.skin;
+	ent->skinnum = state->skin;
 #endif
 
-	if (bits & U_EFFECTS)
-		ent->effects = MSG_ReadByte();
-	else
-		ent->effects = ent->baseline.effects;
+	ent->effects = state->effects;
 
 // shift the known values for interpolation
 	VectorCopy (ent->msg_origins[0], ent->msg_origins[1]);
 	VectorCopy (ent->msg_angles[0], ent->msg_angles[1]);
 
-	if (bits & U_ORIGIN1)
-		ent->msg_origins[0][0] = MSG_ReadCoord ();
-	else
-		ent->msg_origins[0][0] = ent->baseline.origin[0];
-	if (bits & U_ANGLE1)
-		ent->msg_angles[0][0] = MSG_ReadAngle();
-	else
-		ent->msg_angles[0][0] = ent->baseline.angles[0];
-
-	if (bits & U_ORIGIN2)
-		ent->msg_origins[0][1] = MSG_ReadCoord ();
-	else
-		ent->msg_origins[0][1] = ent->baseline.origin[1];
-	if (bits & U_ANGLE2)
-		ent->msg_angles[0][1] = MSG_ReadAngle();
-	else
-		ent->msg_angles[0][1] = ent->baseline.angles[1];
-
-	if (bits & U_ORIGIN3)
-		ent->msg_origins[0][2] = MSG_ReadCoord ();
-	else
-		ent->msg_origins[0][2] = ent->baseline.origin[2];
-	if (bits & U_ANGLE3)
-		ent->msg_angles[0][2] = MSG_ReadAngle();
-	else
-		ent->msg_angles[0][2] = ent->baseline.angles[2];
+	VectorCopy (state->origin, ent->msg_origins[0]);
+	VectorCopy (state->angles, ent->msg_angles[0]);
 
-	if ( bits & U_NOLERP )
+	if ( nolerp )
 		ent->forcelink = true;
 
 	if ( forcelink )
@@ -483,6 +468,159 @@ if (bits&(1<<i))
 	}
 }
 
+/*
+==================
+CL_ParseUpdate
+
+Parse an entity update message from the server
+==================
+*/
+int	bitcounts[16];
+
+void CL_ParseUpdate (int bits)
+{
+	int			i;
+	entity_t	*ent;
+	int			num;
+	entity_state_t	state;
+
+	if (cls.signon == SIGNONS - 1)
+	{	// first update is the final signon stage
+		cls.signon = SIGNONS;
+		CL_SignonReply ();
+	}
+
+	if (bits & U_MOREBITS)
+	{
+		i = MSG_ReadByte ();
+		bits |= (i<<8);
+	}
+
+	if (bits & U_LONGENTITY)	
+		num = (unsigned short)MSG_ReadShort ();
+	else
+		num = MSG_ReadByte ();
+
+	ent = CL_EntityNum (num);
+
+for (i=0 ; i<16 ; i++)
+if (bits&(1<<i))
+	bitcounts[i]++;
+
+	CL_ReadEntityDelta (bits, &ent->baseline, &state);
+	CL_SetEntityState (num, &state, bits & U_NOLERP);
+}
+
+/*
+==================
+CL_ParsePacketEntities
+
+PROTOCOL_DELTA: the entities of a frame are the ones of the frame it is
+delta'd from with the updates in the message applied.  Entities of the
+old frame the message doesn't mention are unchanged.
+==================
+*/
+void CL_ParsePacketEntities (void)
+{
+	int				i, bits, num;
+	int				sequence, delta;
+	int				oldindex, oldmax;
+	qboolean		valid;
+	byte			nolerp[MAX_PACKET_ENTITIES];
+	packetframe_t	*from, *to;
+	packetentity_t	*old;
+	entity_t		*ent;
+
+	if (cls.signon == SIGNONS - 1)
+	{	// first update is the final signon stage
+		cls.signon = SIGNONS;
+		CL_SignonReply ();
+	}
+
+	sequence = MSG_ReadLong ();
+	delta = MSG_ReadLong ();
+
+// the frame it's from can be gone if this is a demo that started
+// late, the message still has to be read through
+	from = NULL;
+	valid = true;
+	if (delta != -1)
+	{
+		from = &cl_frames[delta & UPDATE_MASK];
+		if (from->sequence != delta || sequence - delta <= 0 || sequence - delta >= UPDATE_BACKUP)
+		{
+			from = NULL;
+			valid = false;
+		}
+	}
+	to = &cl_frames[sequence & UPDATE_MASK];
+	to->num_entities = 0;
+
+	oldindex = 0;
+	oldmax = from ? from->num_entities : 0;
+
+	while (1)
+	{
+		bits = MSG_ReadByte ();
+		if (msg_badread)
+			Host_Error ("CL_ParsePacketEntities: Bad server message");
+		if (!bits)
+			break;
+		bits &= 127;
+		if (bits & U_MOREBITS)
+			bits |= MSG_ReadByte () << 8;
+
+		if (bits & U_LONGENTITY)	
+			num = (unsigned short)MSG_ReadShort ();
+		else
+			num = MSG_ReadByte ();
+
+	// old entities before this one are unchanged
+		while (oldindex < oldmax && from->entities[oldindex].number < num)
+		{
+			if (to->num_entities == MAX_PACKET_ENTITIES)
+				Host_Error ("CL_ParsePacketEntities: too many entities");
+			nolerp[to->num_entities] = false;
+			to->entities[to->num_entities++] = from->entities[oldindex++];
+		}
+
+		old = NULL;
+		if (oldindex < oldmax && from->entities[oldindex].number == num)
+			old = &from->entities[oldindex++];
+
+		if (bits & U_REMOVE)
+			continue;
+
+		if (to->num_entities == MAX_PACKET_ENTITIES)
+			Host_Error ("CL_ParsePacketEntities: too many entities");
+		ent = CL_EntityNum (num);
+		nolerp[to->num_entities] = (bits & U_NOLERP) != 0;
+		to->entities[to->num_entities].number = num;
+		CL_ReadEntityDelta (bits, old ? &old->state : &ent->baseline, &to->entities[to->num_entities].state);
+		to->num_entities++;
+	}
+
+	while (oldindex < oldmax)
+	{
+		if (to->num_entities == MAX_PACKET_ENTITIES)
+			Host_Error ("CL_ParsePacketEntities: too many entities");
+		nolerp[to->num_entities] = false;
+		to->entities[to->num_entities++] = from->entities[oldindex++];
+	}
+
+	if (!valid)
+	{
+		to->sequence = -1;
+		return;
+	}
+	to->sequence = sequence;
+
+	for (i=0 ; i<to->num_entities ; i++)
+		CL_SetEntityState (to->entities[i].number, &to->entities[i].state, nolerp[i]);
+
+	cl.ackframe = sequence;
+}
+
 /*
 ==================
 CL_ParseBaseline
@@ -782,7 +920,7 @@ void CL_ParseServerMessage (void)
 		
 		case svc_version:
 			i = MSG_ReadLong ();
-			if (i != PROTOCOL_VERSION)
+			if (i != PROTOCOL_VERSION && i != PROTOCOL_DELTA)
 				Host_Error ("CL_ParseServerMessage: Server is protocol %i instead of %i\n", i, PROTOCOL_VERSION);
 			break;
 			
@@ -816,7 +954,7 @@ void CL_ParseServerMessage (void)
 			break;
 			
 		case svc_setview:
-			cl.viewentity = MSG_ReadShort ();
+			cl.viewentity = (unsigned short)MSG_ReadShort ();
 			break;
 					
 		case svc_lightstyle:
@@ -866,7 +1004,7 @@ void CL_ParseServerMessage (void)
 			break;
 
 		case svc_spawnbaseline:
-			i = MSG_ReadShort ();
+			i = (unsigned short)MSG_ReadShort ();
 			// must use CL_EntityNum() to force cl.num_entities up
 			CL_ParseBaseline (CL_EntityNum(i));
 			break;
@@ -947,6 +1085,10 @@ void CL_ParseServerMessage (void)
 			SCR_CenterPrint (MSG_ReadString ());			
 			break;
 
+		case svc_packetentities:
+			CL_ParsePacketEntities ();
+			break;
+
 		case svc_cutscene:
 			cl.intermission = 3;
 			cl.completed_time = cl.time;
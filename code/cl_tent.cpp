@@ -69,7 +69,7 @@ void CL_ParseBeam (model_t *m)
 	beam_t	*b;
 	int		i;
 	
-	ent = MSG_ReadShort ();
+	ent = (unsigned short)MSG_ReadShort ();
 	
 	start[0] = MSG_ReadCoord ();
 	start[1] = MSG_ReadCoord ();
@@ -213,6 +213,8 @@ typedef struct
 	int			viewentity;		// cl_entitites[cl.viewentity] = player
 	int			maxclients;
 	int			gametype;
+	int			protocol;		// PROTOCOL_VERSION or PROTOCOL_DELTA
+	int			ackframe;		// last good svc_packetentities, -1 if none
 
 // refresh related state
 	struct model_s	*worldmodel;	// cl_entitites[0].model
@@ -276,7 +278,8 @@ extern	client_state_t	cl;
 
 // FIXME, allocate dynamically
 extern	efrag_t			cl_efrags[MAX_EFRAGS];
-extern	entity_t		cl_entities[MAX_EDICTS];
+extern	entity_t		*cl_entities;		// [cl_max_edicts]
+extern	int				cl_max_edicts;
 extern	entity_t		cl_static_entities[MAX_STATIC_ENTITIES];
 extern	lightstyle_t	cl_lightstyle[MAX_LIGHTSTYLES];
 extern	dlight_t		cl_dlights[MAX_DLIGHTS];
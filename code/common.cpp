@@ -151,7 +151,7 @@ void Q_memset (void *dest, int fill, int count)
 			((byte *)dest)[i] = fill;
 }
 
-void Q_memcpy (void *dest, void *src, int count)
+void Q_memcpy (void *dest, const void *src, int count)
 {
 	int             i;
 	
@@ -774,7 +774,7 @@ void *SZ_GetSpace (sizebuf_t *buf, int length)
 	return data;
 }
 
-void SZ_Write (sizebuf_t *buf, void *data, int length)
+void SZ_Write (sizebuf_t *buf, const void *data, int length)
 {
 	Q_memcpy (SZ_GetSpace(buf,length),data,length);         
 }
@@ -862,15 +862,14 @@ void COM_FileBase (char *in, char *out)
 	while (s != in && *s != '.')
 		s--;
 	
-	for (s2 = s ; *s2 && *s2 != '/' ; s2--)
+	for (s2 = s ; s2 != in && s2[-1] != '/' ; s2--)
 	;
 	
-	if (s-s2 < 2)
+	if (s-s2 < 1)
 		strcpy (out,"?model?");
 	else
 	{
-		s--;
-		strncpy (out,s2+1, s-s2);
+		strncpy (out,s2, s-s2);
 		out[s-s2] = 0;
 	}
 }
@@ -1199,6 +1198,7 @@ QUAKE FILESYSTEM
 */
 
 int     com_filesize;
+int		com_filetime;
 
 
 //
@@ -1359,7 +1359,7 @@ void COM_CopyFile (char *netpath, char *cachepath)
 COM_FindFile
 
 Finds the file in the search path.
-Sets com_filesize and one of handle or file
+Sets com_filesize, com_filetime and one of handle or file
 ===========
 */
 int COM_FindFile (char *filename, int *handle, FILE **file)
@@ -1409,6 +1409,7 @@ int COM_FindFile (char *filename, int *handle, FILE **file)
 							fseek (*file, pak->files[i].filepos, SEEK_SET);
 					}
 					com_filesize = pak->files[i].filelen;
+					com_filetime = 0;		// paks don't change under us
 					return com_filesize;
 				}
 		}
@@ -1450,6 +1451,7 @@ int COM_FindFile (char *filename, int *handle, FILE **file)
 
 			Sys_Printf ("FindFile: %s\n",netpath);
 			com_filesize = Sys_FileOpenRead (netpath, &i);
+			com_filetime = findtime;
 			if (handle)
 				*handle = i;
 			else
@@ -1469,6 +1471,7 @@ int COM_FindFile (char *filename, int *handle, FILE **file)
 	else
 		*file = NULL;
 	com_filesize = -1;
+	com_filetime = 0;
 	return -1;
 }
 
@@ -29,8 +29,10 @@ char	loadname[32];	// for hunk tags
 
 void Mod_LoadSpriteModel (model_t *mod, void *buffer);
 void Mod_LoadBrushModel (model_t *mod, void *buffer);
+void Mod_TimePVS_f (void);
 void Mod_LoadAliasModel (model_t *mod, void *buffer);
 model_t *Mod_LoadModel (model_t *mod, qboolean crash);
+model_t *Mod_FindName (char *name);
 
 byte	mod_novis[MAX_MAP_LEAFS/8];
 
@@ -38,7 +40,25 @@ byte	mod_novis[MAX_MAP_LEAFS/8];
 model_t	mod_known[MAX_MOD_KNOWN];
 int		mod_numknown;
 
+/*
+Brush models and sprites stay on the hunk from one level to the next, in
+the order they were loaded, so the ones on top that no level holds any
+more can be dropped when the hunk is getting full.  Server levels go on
+top of the hunk or in blocks of their own (see SV_InstanceMemory), so
+nothing else gets caught between them.
+*/
+typedef struct
+{
+	model_t	*model;			// NULL when its file changed and it was reloaded
+	int		mark;			// Hunk_LowMark before it was loaded
+	int		end;			// ... and after
+} storedmodel_t;
+
+static	storedmodel_t	mod_store[MAX_MOD_KNOWN];
+static	int				mod_numstored;
+
 cvar_t gl_subdivide_size = {"gl_subdivide_size", "128", true};
+cvar_t mod_pvstable = {"mod_pvstable", "1024"};	// kilobytes a map's decompressed PVS may take
 
 void GL_SubdivideSurface(msurface_t* fa);
 void GL_MakeAliasModelDisplayLists(model_t* m, aliashdr_t* hdr);
@@ -51,6 +71,8 @@ Mod_Init
 void Mod_Init (void)
 {
 	Cvar_RegisterVariable (&gl_subdivide_size);
+	Cvar_RegisterVariable (&mod_pvstable);
+	Cmd_AddCommand ("timepvs", Mod_TimePVS_f);
 	memset (mod_novis, 0xff, sizeof(mod_novis));
 }
 
@@ -134,72 +156,260 @@ mleaf_t* Mod_PointInLeaf(float *p, model_t* model)
 /*
 ===================
 Mod_DecompressVis
+
+Decompresses a PVS row into out, which has to hold (numleafs+7)>>3 bytes.
+The zero runs are stored eight bytes at a time, and clamped to the row so
+bad vis data can't run past it.
 ===================
 */
-byte *Mod_DecompressVis (byte *in, model_t *model)
+void Mod_DecompressVis (byte *in, model_t *model, byte *out)
 {
-	static byte	decompressed[MAX_MAP_LEAFS/8];
+	static const byte	zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
 	int		c;
-	byte	*out;
-	int		row;
+	byte	*end;
 
-	row = (model->numleafs+7)>>3;	
-	out = decompressed;
+	end = out + ((model->numleafs+7)>>3);
 
-#if 0
-	memcpy (out, in, row);
-#else
 	if (!in)
 	{	// no vis info, so make all visible
-		while (row)
-		{
-			*out++ = 0xff;
-			row--;
-		}
-		return decompressed;		
+		memset (out, 0xff, end - out);
+		return;
 	}
 
-	do
+	while (out < end)
 	{
 		if (*in)
 		{
 			*out++ = *in++;
 			continue;
 		}
-	
+
 		c = in[1];
 		in += 2;
-		while (c)
-		{
+		if (c > end - out)
+			c = end - out;
+		for ( ; c >= 8 ; c -= 8, out += 8)
+			memcpy (out, zeros, 8);
+		for ( ; c ; c--)
 			*out++ = 0;
-			c--;
-		}
-	} while (out - decompressed < row);
-#endif
-	
-	return decompressed;
+	}
 }
 
-byte *Mod_LeafPVS (mleaf_t *leaf, model_t *model)
+/*
+===================
+Mod_LeafPVS
+
+The PVS row of a leaf.  Comes straight from the model's PVS table when it
+has one, otherwise it is decompressed into buffer, which has to hold
+MAX_MAP_LEAFS/8 bytes.  Either way the row must not be written to.
+===================
+*/
+byte *Mod_LeafPVS (mleaf_t *leaf, model_t *model, byte *buffer)
 {
+	int		i;
+
 	if (leaf == model->leafs)
 		return mod_novis;
-	return Mod_DecompressVis (leaf->compressed_vis, model);
+	i = leaf - model->leafs - 1;
+	if (model->pvstable && i < model->numleafs)
+		return model->pvstable + i*model->pvsrowbytes;
+	Mod_DecompressVis (leaf->compressed_vis, model, buffer);
+	return buffer;
+}
+
+/*
+===================
+Mod_MakePVSTable
+
+Decompresses the PVS of every visible leaf of the world into one table on
+the model's hunk, if it fits in mod_pvstable kilobytes.  The rows are
+padded to whole 8 byte words with zeros.
+===================
+*/
+static void Mod_MakePVSTable (model_t *mod)
+{
+	int		i, size;
+
+	mod->pvsrowbytes = ((mod->numleafs+63)>>6)*8;
+	size = mod->numleafs*mod->pvsrowbytes;
+	if (!size || size > mod_pvstable.value*1024)
+		return;
+
+	mod->pvstable = (byte *)Hunk_AllocName (size, loadname);
+	for (i=0 ; i<mod->numleafs ; i++)
+		Mod_DecompressVis (mod->leafs[i+1].compressed_vis, mod, mod->pvstable + i*mod->pvsrowbytes);
+}
+
+/*
+===================
+Mod_TimePVS_f
+
+Fetches the PVS row of every leaf of the current world, decompressing it
+and from the table, and adds each row up the way the server's fat PVS
+does.  A table is made for the test when the map has none.
+===================
+*/
+#define	TIME_PVS_RUNS	20
+
+static unsigned Mod_TimePVSRows (model_t *mod, qboolean table)
+{
+	int			i, j, words;
+	unsigned	sum;
+	unsigned	*row;
+	unsigned	buffer[MAX_MAP_LEAFS/32];
+
+	words = (mod->numleafs+31)>>5;
+	sum = 0;
+	for (i=0 ; i<mod->numleafs ; i++)
+	{
+		if (table)
+			row = (unsigned *)(mod->pvstable + i*mod->pvsrowbytes);
+		else
+		{
+			buffer[words-1] = 0;	// the padding of the last word
+			Mod_DecompressVis (mod->leafs[i+1].compressed_vis, mod, (byte *)buffer);
+			row = buffer;
+		}
+		for (j=0 ; j<words ; j++)
+			sum = sum*31 + row[j];
+	}
+	return sum;
+}
+
+void Mod_TimePVS_f (void)
+{
+	int			i, run, table;
+	model_t		*mod;
+	qboolean	temp;
+	unsigned	sum;
+	double		start, t, best;
+
+	mod = cl.worldmodel;
+	if (!mod && sv.active)
+		mod = sv.worldmodel;
+	if (!mod || !mod->numleafs)
+	{
+		Con_Printf ("no map loaded\n");
+		return;
+	}
+
+	temp = !mod->pvstable;
+	if (temp)
+	{
+		mod->pvstable = (byte *)malloc (mod->numleafs*mod->pvsrowbytes);
+		if (!mod->pvstable)
+		{
+			Con_Printf ("no memory for the table\n");
+			return;
+		}
+		memset (mod->pvstable, 0, mod->numleafs*mod->pvsrowbytes);
+		for (i=0 ; i<mod->numleafs ; i++)
+			Mod_DecompressVis (mod->leafs[i+1].compressed_vis, mod, mod->pvstable + i*mod->pvsrowbytes);
+	}
+
+	Con_Printf ("%s: %i leafs, %i byte rows, %ik table%s\n", mod->name, mod->numleafs,
+		(mod->numleafs+7)>>3, (mod->numleafs*mod->pvsrowbytes+1023)/1024, temp ? " (made for the test)" : "");
+	Con_Printf ("from        ns/row  checksum\n");
+	for (table=0 ; table<2 ; table++)
+	{
+		sum = Mod_TimePVSRows (mod, table);
+		best = 0;
+		for (run=0 ; run<TIME_PVS_RUNS ; run++)
+		{
+			start = Sys_FloatTime ();
+			if (Mod_TimePVSRows (mod, table) != sum)
+				Con_Printf ("checksum changed\n");
+			t = Sys_FloatTime () - start;
+			if (!run || t < best)
+				best = t;
+		}
+		Con_Printf ("%-10s  %6.1f  %08x\n", table ? "table" : "decompress", best*1000000000/mod->numleafs, sum);
+	}
+
+	if (temp)
+	{
+		free (mod->pvstable);
+		mod->pvstable = NULL;
+	}
 }
 
 /*
 ===================
-Mod_ClearAll
+Mod_Unload
+
+Forgets a model whose memory is gone or about to be
 ===================
 */
-void Mod_ClearAll (void)
+static void Mod_Unload (model_t *mod)
 {
 	int		i;
-	model_t	*mod;
-	
-	for (i=0 , mod=mod_known ; i<mod_numknown ; i++, mod++)
-		if (mod->type != mod_alias)
-			mod->needload = true;
+	model_t	*sub;
+
+	if (mod->type == mod_brush)
+	{	// the inline models point into it
+		for (i=1 ; i<mod->numsubmodels ; i++)
+		{
+			sub = Mod_FindName (va("*%i %s", i, mod->name));
+			sub->name[0] = 0;
+			sub->needload = true;
+		}
+	}
+	mod->needload = true;
+}
+
+/*
+===================
+Mod_ClearUnused
+
+Called between levels.  Drops the models on top of the hunk that no level
+holds while the models fill more than half of it, and returns the low mark
+just above the ones that stay, 0 if none do
+===================
+*/
+int Mod_ClearUnused (void)
+{
+	storedmodel_t	*s;
+	hunkarena_t		*arena;
+	extern	int		hunk_size;
+
+	arena = Hunk_SetArena (NULL);
+	while (mod_numstored)
+	{
+		s = &mod_store[mod_numstored-1];
+		if (s->model)
+		{
+			if (s->model->refcount || s->end <= hunk_size/2)
+				break;
+			Con_DPrintf ("Dropping %s\n", s->model->name);
+			Mod_Unload (s->model);
+		}
+		Hunk_FreeToLowMark (s->mark);
+		mod_numstored--;
+	}
+	Hunk_SetArena (arena);
+
+	if (!mod_numstored)
+		return 0;
+	return mod_store[mod_numstored-1].end;
+}
+
+/*
+===================
+Mod_Reference
+
+A level holds on to the model until it calls Mod_Release
+===================
+*/
+void Mod_Reference (model_t *mod)
+{
+	mod->refcount++;
+}
+
+void Mod_Release (model_t *mod)
+{
+	if (mod->refcount <= 0)
+		Sys_Error ("Mod_Release: %s isn't held", mod->name);
+	mod->refcount--;
 }
 
 /*
@@ -224,12 +434,18 @@ model_t *Mod_FindName (char *name)
 			break;
 			
 	if (i == mod_numknown)
-	{
-		if (mod_numknown == MAX_MOD_KNOWN)
-			Sys_Error ("mod_numknown == MAX_MOD_KNOWN");
+	{	// reuse the slot of a dropped inline model if there is one
+		for (i=0 , mod=mod_known ; i<mod_numknown ; i++, mod++)
+			if (!mod->name[0])
+				break;
+		if (i == mod_numknown)
+		{
+			if (mod_numknown == MAX_MOD_KNOWN)
+				Sys_Error ("mod_numknown == MAX_MOD_KNOWN");
+			mod_numknown++;
+		}
 		strcpy (mod->name, name);
 		mod->needload = true;
-		mod_numknown++;
 	}
 
 	return mod;
@@ -266,6 +482,8 @@ model_t *Mod_LoadModel (model_t *mod, qboolean crash)
 	void	*d;
 	unsigned *buf;
 	byte	stackbuf[1024];		// avoid dirtying the cache heap
+	hunkarena_t	*arena;
+	int		mark;
 
 	if (!mod->needload)
 	{
@@ -311,6 +529,13 @@ model_t *Mod_LoadModel (model_t *mod, qboolean crash)
 
 // call the apropriate loader
 	mod->needload = false;
+	mod->crc = CRC_Block ((byte *)buf, com_filesize);
+	mod->filesize = com_filesize;
+	mod->filetime = com_filetime;
+
+// always on the hunk itself, where every server instance can share it
+	arena = Hunk_SetArena (NULL);
+	mark = Hunk_LowMark ();
 	
 	switch (LittleLong(*(unsigned *)buf))
 	{
@@ -327,9 +552,57 @@ model_t *Mod_LoadModel (model_t *mod, qboolean crash)
 		break;
 	}
 
+	if (mod->type != mod_alias)
+	{	// alias models are kept in the cache instead
+		if (mod_numstored == MAX_MOD_KNOWN)
+			Sys_Error ("Mod_LoadModel: too many models on the hunk");
+		mod_store[mod_numstored].model = mod;
+		mod_store[mod_numstored].mark = mark;
+		mod_store[mod_numstored].end = Hunk_LowMark ();
+		mod_numstored++;
+	}
+
+	Hunk_SetArena (arena);
+
 	return mod;
 }
 
+/*
+==================
+Mod_CheckStored
+
+Has a model still on the hunk reloaded if its file has changed since.
+Only a file that has been touched is read again to compare the crc.
+==================
+*/
+static void Mod_CheckStored (model_t *mod)
+{
+	int		i, h;
+	byte	*buf;
+	byte	stackbuf[1024];
+
+	COM_OpenFile (mod->name, &h);
+	if (h != -1)
+	{
+		COM_CloseFile (h);
+		if (com_filesize == mod->filesize && com_filetime == mod->filetime)
+			return;
+
+		buf = COM_LoadStackFile (mod->name, stackbuf, sizeof(stackbuf));
+		if (buf && com_filesize == mod->filesize && CRC_Block (buf, com_filesize) == mod->crc)
+		{
+			mod->filetime = com_filetime;
+			return;
+		}
+	}
+
+	Con_DPrintf ("%s has changed, reloading\n", mod->name);
+	for (i=0 ; i<mod_numstored ; i++)
+		if (mod_store[i].model == mod)
+			mod_store[i].model = NULL;	// the memory goes when the ones above it do
+	Mod_Unload (mod);
+}
+
 /*
 ==================
 Mod_ForName
@@ -342,10 +615,25 @@ model_t *Mod_ForName (char *name, qboolean crash)
 	model_t	*mod;
 	
 	mod = Mod_FindName (name);
+
+	if (!mod->needload && !mod->refcount && mod->type != mod_alias && name[0] != '*')
+		Mod_CheckStored (mod);		// left over from an earlier level
 	
 	return Mod_LoadModel (mod, crash);
 }
 
+/*
+==================
+Mod_InlineModel
+
+The inline model "*num" of a world, each world keeps its own
+==================
+*/
+model_t *Mod_InlineModel (model_t *world, int num)
+{
+	return Mod_ForName (va("*%i %s", num, world->name), false);
+}
+
 
 /*
 ===============================================================================
@@ -414,9 +702,11 @@ void Mod_LoadTextures (lump_t *l)
 			R_InitSky (tx);
 		else
 		{
+#ifndef SERVERONLY
 			texture_mode = GL_LINEAR_MIPMAP_NEAREST; //_LINEAR;
 			tx->gl_texturenum = GL_LoadTexture (mt->name, tx->width, tx->height, (byte *)(tx+1), true, false);
 			texture_mode = GL_NEAREST;
+#endif
 		}
 	}
 
@@ -680,8 +970,11 @@ void Mod_LoadTexinfo (lump_t *l)
 
 	for ( i=0 ; i<count ; i++, in++, out++)
 	{
-		for (j=0 ; j<8 ; j++)
+		for (j=0 ; j<4 ; j++)
+		{
 			out->vecs[0][j] = LittleFloat (in->vecs[0][j]);
+			out->vecs[1][j] = LittleFloat (in->vecs[1][j]);
+		}
 		len1 = Length (out->vecs[0]);
 		len2 = Length (out->vecs[1]);
 		len1 = (len1 + len2)/2;
@@ -966,22 +1259,49 @@ void Mod_LoadLeafs (lump_t *l)
 	}	
 }
 
+/*
+=================
+Mod_SetClipnodePlane
+
+=================
+*/
+void Mod_SetClipnodePlane (mclipnode_t *out, int planenum)
+{
+	mplane_t	*plane;
+
+	if ((unsigned)planenum >= (unsigned)loadmodel->numplanes)
+		Sys_Error ("Mod_SetClipnodePlane: bad planenum in %s", loadmodel->name);
+	plane = loadmodel->planes + planenum;
+	out->normal[0] = plane->normal[0];
+	out->normal[1] = plane->normal[1];
+	out->normal[2] = plane->normal[2];
+	out->dist = plane->dist;
+	out->type = plane->type;
+	out->planenum = planenum;
+}
+
 /*
 =================
 Mod_LoadClipnodes
+
+The children are read as unsigned so maps can have up to 65520 clipnodes,
+anything past the last node is a contents value
 =================
 */
 void Mod_LoadClipnodes (lump_t *l)
 {
-	dclipnode_t *in, *out;
-	int			i, count;
+	dclipnode_t *in;
+	mclipnode_t *out;
+	int			i, j, count, child;
 	hull_t		*hull;
 
 	in = (dclipnode_t*)(mod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
 	count = l->filelen / sizeof(*in);
-	out = (dclipnode_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
+	if (count > 65520)		// above that the child numbers are contents
+		Sys_Error ("%s has too many clipnodes", loadmodel->name);
+	out = (mclipnode_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
 
 	loadmodel->clipnodes = out;
 	loadmodel->numclipnodes = count;
@@ -990,7 +1310,6 @@ void Mod_LoadClipnodes (lump_t *l)
 	hull->clipnodes = out;
 	hull->firstclipnode = 0;
 	hull->lastclipnode = count-1;
-	hull->planes = loadmodel->planes;
 	hull->clip_mins[0] = -16;
 	hull->clip_mins[1] = -16;
 	hull->clip_mins[2] = -24;
@@ -1002,7 +1321,6 @@ void Mod_LoadClipnodes (lump_t *l)
 	hull->clipnodes = out;
 	hull->firstclipnode = 0;
 	hull->lastclipnode = count-1;
-	hull->planes = loadmodel->planes;
 	hull->clip_mins[0] = -32;
 	hull->clip_mins[1] = -32;
 	hull->clip_mins[2] = -24;
@@ -1012,9 +1330,14 @@ void Mod_LoadClipnodes (lump_t *l)
 
 	for (i=0 ; i<count ; i++, out++, in++)
 	{
-		out->planenum = LittleLong(in->planenum);
-		out->children[0] = LittleShort(in->children[0]);
-		out->children[1] = LittleShort(in->children[1]);
+		Mod_SetClipnodePlane (out, LittleLong(in->planenum));
+		for (j=0 ; j<2 ; j++)
+		{
+			child = (unsigned short)LittleShort(in->children[j]);
+			if (child >= count)
+				child -= 65536;
+			out->children[j] = child;
+		}
 	}
 }
 
@@ -1028,7 +1351,7 @@ Deplicate the drawing hull structure as a clipping hull
 void Mod_MakeHull0 (void)
 {
 	mnode_t		*in, *child;
-	dclipnode_t *out;
+	mclipnode_t *out;
 	int			i, j, count;
 	hull_t		*hull;
 	
@@ -1036,16 +1359,15 @@ void Mod_MakeHull0 (void)
 	
 	in = (mnode_t*)loadmodel->nodes;
 	count = loadmodel->numnodes;
-	out = (dclipnode_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
+	out = (mclipnode_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
 
 	hull->clipnodes = out;
 	hull->firstclipnode = 0;
 	hull->lastclipnode = count-1;
-	hull->planes = loadmodel->planes;
 
 	for (i=0 ; i<count ; i++, out++, in++)
 	{
-		out->planenum = in->plane - loadmodel->planes;
+		Mod_SetClipnodePlane (out, in->plane - loadmodel->planes);
 		for (j=0 ; j<2 ; j++)
 		{
 			child = in->children[j];
@@ -1176,8 +1498,11 @@ void Mod_LoadBrushModel (model_t *mod, void *buffer)
 	int			i, j;
 	dheader_t	*header;
 	dmodel_t 	*bm;
+	model_t		*world;
 	
 	loadmodel->type = mod_brush;
+	loadmodel->pvstable = NULL;		// the inline models copy it
+	world = mod;
 	
 	header = (dheader_t *)buffer;
 
@@ -1239,15 +1564,18 @@ void Mod_LoadBrushModel (model_t *mod, void *buffer)
 
 		if (i < mod->numsubmodels-1)
 		{	// duplicate the basic information
-			char	name[10];
+			char	name[MAX_QPATH];
 
-			sprintf (name, "*%i", i+1);
+			snprintf (name, sizeof(name), "*%i %s", i+1, world->name);	// each world its own
 			loadmodel = Mod_FindName (name);
 			*loadmodel = *mod;
 			strcpy (loadmodel->name, name);
+			loadmodel->refcount = 0;
 			mod = loadmodel;
 		}
 	}
+
+	Mod_MakePVSTable (world);
 }
 
 /*
@@ -148,7 +148,8 @@ typedef struct msurface_s
 	int			lightmaptexturenum;
 	byte		styles[MAXLIGHTMAPS];
 	int			cached_light[MAXLIGHTMAPS];	// values currently used in lightmap
-	qboolean	cached_dlight;				// true if dynamic light in cache
+	int			cached_dlightbits;			// dynamic lights in cache
+	int			cached_dlightpush;			// r_dlightpushes when they were cached
 	byte		*samples;		// [numstyles*surfsize]
 } msurface_t;
 
@@ -192,11 +193,22 @@ typedef struct mleaf_s
 	byte		ambient_sound_level[NUM_AMBIENTS];
 } mleaf_t;
 
+// a clipnode with its plane copied in, so walking a hull only touches the
+// nodes.  32 bytes, two to a cache line
 // !!! if this is changed, it must be changed in asm_i386.h too !!!
 typedef struct
 {
-	dclipnode_t	*clipnodes;
-	mplane_t	*planes;
+	float		normal[3];
+	float		dist;
+	int			children[2];	// negative numbers are contents
+	int			type;			// of the plane, PLANE_X/Y/Z are axial
+	int			planenum;
+} mclipnode_t;
+
+// !!! if this is changed, it must be changed in asm_i386.h too !!!
+typedef struct
+{
+	mclipnode_t	*clipnodes;
 	int			firstclipnode;
 	int			lastclipnode;
 	vec3_t		clip_mins;
@@ -343,6 +355,9 @@ typedef struct model_s
 {
 	char		name[MAX_QPATH];
 	qboolean	needload;		// bmodels and sprites don't cache normally
+	int			refcount;		// levels holding it, see Mod_ClearUnused
+	unsigned short	crc;		// of the file it was loaded from
+	int			filesize, filetime;	// com_filesize and com_filetime of it
 
 	modtype_t	type;
 	int			numframes;
@@ -395,7 +410,7 @@ typedef struct model_s
 	int			*surfedges;
 
 	int			numclipnodes;
-	dclipnode_t	*clipnodes;
+	mclipnode_t	*clipnodes;
 
 	int			nummarksurfaces;
 	msurface_t	**marksurfaces;
@@ -406,6 +421,8 @@ typedef struct model_s
 	texture_t	**textures;
 
 	byte		*visdata;
+	byte		*pvstable;		// decompressed rows of leafs 1 to numleafs, or NULL
+	int			pvsrowbytes;	// row size in pvstable, padded to 8 bytes
 	byte		*lightdata;
 	char		*entities;
 
@@ -419,12 +436,15 @@ typedef struct model_s
 //============================================================================
 
 void	Mod_Init (void);
-void	Mod_ClearAll (void);
+int		Mod_ClearUnused (void);
 model_t *Mod_ForName (char *name, qboolean crash);
+model_t *Mod_InlineModel (model_t *world, int num);
+void	Mod_Reference (model_t *mod);
+void	Mod_Release (model_t *mod);
 void	*Mod_Extradata (model_t *mod);	// handles caching
 void	Mod_TouchModel (char *name);
 
 mleaf_t *Mod_PointInLeaf (float *p, model_t *model);
-byte	*Mod_LeafPVS (mleaf_t *leaf, model_t *model);
+byte	*Mod_LeafPVS (mleaf_t *leaf, model_t *model, byte *buffer);
 
 #endif	// __MODEL__
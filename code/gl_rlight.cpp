@@ -23,6 +23,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 int	r_dlightframecount;
 
+int			r_dlightpushes;					// R_PushDlights calls
+int			r_dlightchanged[MAX_DLIGHTS];	// r_dlightpushes when each light last changed
+static dlight_t	r_pusheddlights[MAX_DLIGHTS];
+
 
 /*
 ==================
@@ -204,19 +208,37 @@ R_PushDlights
 void R_PushDlights (void)
 {
 	int		i;
-	dlight_t	*l;
+	dlight_t	*l, *p;
 
 	if (gl_flashblend.value)
 		return;
 
 	r_dlightframecount = r_framecount + 1;	// because the count hasn't
 											//  advanced yet for this frame
+	r_dlightpushes++;
 	l = cl_dlights;
+	p = r_pusheddlights;
 
-	for (i=0 ; i<MAX_DLIGHTS ; i++, l++)
+	for (i=0 ; i<MAX_DLIGHTS ; i++, l++, p++)
 	{
 		if (l->die < cl.time || !l->radius)
+		{
+			if (p->radius)
+			{
+				p->radius = 0;
+				r_dlightchanged[i] = r_dlightpushes;
+			}
 			continue;
+		}
+	// lightmaps lit by a light that didn't move, grow or fade can be kept
+		if (!VectorCompare (l->origin, p->origin) || l->radius != p->radius
+			|| l->minlight != p->minlight)
+		{
+			VectorCopy (l->origin, p->origin);
+			p->radius = l->radius;
+			p->minlight = l->minlight;
+			r_dlightchanged[i] = r_dlightpushes;
+		}
 		R_MarkLights ( l, 1<<i, cl.worldmodel->nodes );
 	}
 }
@@ -837,6 +837,8 @@ void R_SetupFrame (void)
 
 	c_brush_polys = 0;
 	c_alias_polys = 0;
+	c_lightmap_texels = 0;
+	c_lightmap_bytes = 0;
 
 }
 
@@ -1119,6 +1121,8 @@ void R_RenderView (void)
 		time1 = Sys_FloatTime ();
 		c_brush_polys = 0;
 		c_alias_polys = 0;
+		c_lightmap_texels = 0;
+		c_lightmap_bytes = 0;
 	}
 
 	mirror = false;
@@ -1155,6 +1159,7 @@ void R_RenderView (void)
 	{
 //		glFinish ();
 		time2 = Sys_FloatTime ();
-		Con_Printf ("%3i ms  %4i wpoly %4i epoly\n", (int)((time2-time1)*1000), c_brush_polys, c_alias_polys); 
+		Con_Printf ("%3i ms  %4i wpoly %4i epoly %5i lmtexels %6i lmbytes\n", (int)((time2-time1)*1000),
+			c_brush_polys, c_alias_polys, c_lightmap_texels, c_lightmap_bytes);
 	}
 }
@@ -392,6 +392,7 @@ void R_NewMap (void)
 		cl.worldmodel->leafs[i].efrags = NULL;
 		 	
 	r_viewleaf = NULL;
+	r_visleaf = NULL;
 	R_ClearParticles ();
 
 	GL_BuildLightmaps ();
@@ -32,8 +32,6 @@ int		lightmap_bytes;		// 1, 2, or 4
 
 int		lightmap_textures;
 
-float		blocklights[18*18];
-
 #define	BLOCK_WIDTH		128
 #define	BLOCK_HEIGHT	128
 
@@ -44,9 +42,23 @@ typedef struct glRect_s {
 	unsigned char l,t,w,h;
 } glRect_t;
 
+// changed parts of each lightmap waiting for upload, touching or
+// overlapping surfaces are merged into one rect
+#define	MAX_LIGHTMAP_RECTS	4
+
 glpoly_t	*lightmap_polys[MAX_LIGHTMAPS];
-qboolean	lightmap_modified[MAX_LIGHTMAPS];
-glRect_t	lightmap_rectchange[MAX_LIGHTMAPS];
+int			lightmap_numrects[MAX_LIGHTMAPS];
+glRect_t	lightmap_rects[MAX_LIGHTMAPS][MAX_LIGHTMAP_RECTS];
+
+int			c_lightmap_texels, c_lightmap_bytes;	// rebuilt and uploaded this frame
+
+// surfaces whose lightmaps need building, built together on the worker
+// threads before any of them are drawn
+#define	MAX_LIGHTMAP_QUEUE	4096
+#define	LIGHTMAP_CHUNK		16			// surfaces a work item builds
+
+msurface_t	*lightmap_queue[MAX_LIGHTMAP_QUEUE];
+int			lightmap_numqueued;
 
 int			allocated[MAX_LIGHTMAPS][BLOCK_WIDTH];
 
@@ -57,15 +69,17 @@ byte		lightmaps[4*MAX_LIGHTMAPS*BLOCK_WIDTH*BLOCK_HEIGHT];
 // For gl_texsort 0
 msurface_t  *skychain = NULL;
 msurface_t  *waterchain = NULL;
+msurface_t	*sequentialchain, **sequentialtail;
 
 void R_RenderDynamicLightmaps (msurface_t *fa);
+void R_UploadLightmap (int lightmap);
 
 /*
 ===============
 R_AddDynamicLights
 ===============
 */
-void R_AddDynamicLights (msurface_t *surf)
+void R_AddDynamicLights (msurface_t *surf, int *blocklights)
 {
 	int			lnum;
 	int			sd, td;
@@ -121,7 +135,13 @@ void R_AddDynamicLights (msurface_t *surf)
 				else
 					dist = td + (sd>>1);
 				if (dist < minlight)
-					blocklights[t*smax + s] += (rad - dist);
+				{
+				// past full light is all the same, so it can't overflow
+					if (rad - dist >= 1)
+						blocklights[t*smax + s] += LIGHT_ONE;
+					else
+						blocklights[t*smax + s] += (rad - dist) * LIGHT_ONE;
+				}
 			}
 		}
 	}
@@ -132,98 +152,39 @@ void R_AddDynamicLights (msurface_t *surf)
 ===============
 R_BuildLightMap
 
-Combine and scale multiple lightmaps into the 8.8 format in blocklights
+Combine and scale multiple lightmaps into the fixed point blocklights,
+then write them to dest.  Called on the worker threads.
 ===============
 */
 void R_BuildLightMap (msurface_t *surf, byte *dest, int stride)
 {
 	int			smax, tmax;
-	float		t;
-	int			i, j, size;
-	byte		*lightmap;
-	float		scale;
-	int			maps;
-	int			lightadj[4];
-	float		*bl;
+	int			i, size;
+	int			blocklights[18*18];
 
-	surf->cached_dlight = (surf->dlightframe == r_framecount);
+	surf->cached_dlightbits = (surf->dlightframe == r_framecount) ? surf->dlightbits : 0;
+	surf->cached_dlightpush = r_dlightpushes;
 
 	smax = (surf->extents[0]>>4)+1;
 	tmax = (surf->extents[1]>>4)+1;
 	size = smax*tmax;
-	lightmap = surf->samples;
 
 // set to full bright if no light data
 	if (r_fullbright.value || !cl.worldmodel->lightdata)
 	{
 		for (i=0 ; i<size ; i++)
-			blocklights[i] = 1.0f;
-		goto store;
+			blocklights[i] = LIGHT_ONE;
 	}
-
-// clear to no light
-	for (i=0 ; i<size ; i++)
-		blocklights[i] = 0;
-
-// add all the lightmaps
-	if (lightmap)
-		for (maps = 0; maps < MAXLIGHTMAPS && surf->styles[maps] != 255;
-			maps++)
-		{
-			scale = d_lightstylevalue[surf->styles[maps]] / 255.0f;
-			surf->cached_light[maps] = scale;	// 8.8 fraction
-			for (i = 0; i < size; i++) {
-				float normalizedLight = lightmap[i] / 255.0f; // Normalize to [0, 1]
-				float correctedLight = pow(normalizedLight, 0.75f); // Apply gamma correction with gamma = 0.5
-
-				blocklights[i] += correctedLight * scale; // Apply corrected and scaled light
-			}
-			lightmap += size;	// skip to next lightmap
-		}
-
-// add all the dynamic lights
-	if (surf->dlightframe == r_framecount)
-		R_AddDynamicLights (surf);
-
-// bound, invert, and shift
-store:
-	switch (gl_lightmap_format)
+	else
 	{
-	case GL_RGBA:
-		stride -= (smax<<2);
-		bl = blocklights;
-		for (i=0 ; i<tmax ; i++, dest += stride)
-		{
-			for (j=0 ; j<smax ; j++)
-			{
-				t = *bl++;
-				t = t * 255.0f;
-				if (t > 255)
-					t = 255;
-				dest[3] = 255-t;
-				dest += 4;
-			}
-		}
-		break;
-	case GL_ALPHA:
-	case GL_LUMINANCE:
-	case GL_INTENSITY:
-		bl = blocklights;
-		for (i=0 ; i<tmax ; i++, dest += stride)
-		{
-			for (j=0 ; j<smax ; j++)
-			{
-				t = *bl++;
-				t = t * 256.0f;
-				if (t > 255)
-					t = 255;
-				dest[j] = 255-t;
-			}
-		}
-		break;
-	default:
-		Sys_Error ("Bad lightmap format");
+		R_AccumulateLightmap (surf, blocklights);
+
+	// add all the dynamic lights
+		if (surf->dlightframe == r_framecount)
+			R_AddDynamicLights (surf, blocklights);
 	}
+
+	R_StoreLightmap (blocklights, smax, tmax, dest, stride, lightmap_bytes);
 }
 
 
@@ -420,7 +381,6 @@ void R_DrawSequentialPoly (msurface_t *s)
 	vec3_t		nv, dir;
 	float		ss, ss2, length;
 	float		s1, t1;
-	glRect_t	*theRect;
 
 	//
 	// normal lightmaped poly
@@ -440,19 +400,8 @@ void R_DrawSequentialPoly (msurface_t *s)
 			// Binds lightmap to texenv 1
 			GL_EnableMultitexture(); // Same as SelectTexture (TEXTURE1)
 			GL_Bind (lightmap_textures + s->lightmaptexturenum);
-			i = s->lightmaptexturenum;
-			if (lightmap_modified[i])
-			{
-				lightmap_modified[i] = false;
-				theRect = &lightmap_rectchange[i];
-				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, theRect->t, 
-					BLOCK_WIDTH, theRect->h, gl_lightmap_format, GL_UNSIGNED_BYTE,
-					lightmaps+(i* BLOCK_HEIGHT + theRect->t) *BLOCK_WIDTH*lightmap_bytes);
-				theRect->l = BLOCK_WIDTH;
-				theRect->t = BLOCK_HEIGHT;
-				theRect->h = 0;
-				theRect->w = 0;
-			}
+			if (lightmap_numrects[s->lightmaptexturenum])
+				R_UploadLightmap (s->lightmaptexturenum);
 			glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_BLEND);
 			glBegin(GL_POLYGON);
 			v = p->verts[0];
@@ -542,19 +491,8 @@ void R_DrawSequentialPoly (msurface_t *s)
 		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 		GL_EnableMultitexture();
 		GL_Bind (lightmap_textures + s->lightmaptexturenum);
-		i = s->lightmaptexturenum;
-		if (lightmap_modified[i])
-		{
-			lightmap_modified[i] = false;
-			theRect = &lightmap_rectchange[i];
-			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, theRect->t, 
-				BLOCK_WIDTH, theRect->h, gl_lightmap_format, GL_UNSIGNED_BYTE,
-				lightmaps+(i* BLOCK_HEIGHT + theRect->t) *BLOCK_WIDTH*lightmap_bytes);
-			theRect->l = BLOCK_WIDTH;
-			theRect->t = BLOCK_HEIGHT;
-			theRect->h = 0;
-			theRect->w = 0;
-		}
+		if (lightmap_numrects[s->lightmaptexturenum])
+			R_UploadLightmap (s->lightmaptexturenum);
 		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_BLEND);
 		glBegin (GL_TRIANGLE_FAN);
 		v = p->verts[0];
@@ -663,6 +601,183 @@ void DrawGLPoly (glpoly_t *p)
 }
 
 
+/*
+================
+R_AddLightmapRect
+
+Merges the rect into one already waiting that it touches or overlaps,
+or when all are taken into the one that grows the least
+================
+*/
+static void R_AddLightmapRect (int lightmap, int l, int t, int w, int h)
+{
+	int			i, best, growth, bestgrowth;
+	int			ml, mt, mr, mb;
+	glRect_t	*r;
+
+	best = -1;
+	bestgrowth = 0;
+	for (i=0, r=lightmap_rects[lightmap] ; i<lightmap_numrects[lightmap] ; i++, r++)
+	{
+		ml = l < r->l ? l : r->l;
+		mt = t < r->t ? t : r->t;
+		mr = l+w > r->l+r->w ? l+w : r->l+r->w;
+		mb = t+h > r->t+r->h ? t+h : r->t+r->h;
+		growth = (mr-ml)*(mb-mt) - r->w*r->h - w*h;
+		if (best == -1 || growth < bestgrowth)
+		{
+			best = i;
+			bestgrowth = growth;
+		}
+	}
+
+	if (best == -1 || (bestgrowth > 0 && lightmap_numrects[lightmap] < MAX_LIGHTMAP_RECTS))
+	{
+		r = &lightmap_rects[lightmap][lightmap_numrects[lightmap]++];
+		r->l = l;
+		r->t = t;
+		r->w = w;
+		r->h = h;
+		return;
+	}
+
+	r = &lightmap_rects[lightmap][best];
+	ml = l < r->l ? l : r->l;
+	mt = t < r->t ? t : r->t;
+	mr = l+w > r->l+r->w ? l+w : r->l+r->w;
+	mb = t+h > r->t+r->h ? t+h : r->t+r->h;
+	r->l = ml;
+	r->t = mt;
+	r->w = mr - ml;
+	r->h = mb - mt;
+}
+
+/*
+================
+R_BuildLightmapWork
+================
+*/
+static void R_BuildLightmapWork (int work)
+{
+	int			i, end;
+	msurface_t	*surf;
+	byte		*base;
+
+	end = (work+1)*LIGHTMAP_CHUNK;
+	if (end > lightmap_numqueued)
+		end = lightmap_numqueued;
+	for (i=work*LIGHTMAP_CHUNK ; i<end ; i++)
+	{
+		surf = lightmap_queue[i];
+		base = lightmaps + surf->lightmaptexturenum*lightmap_bytes*BLOCK_WIDTH*BLOCK_HEIGHT;
+		base += (surf->light_t * BLOCK_WIDTH + surf->light_s) * lightmap_bytes;
+		R_BuildLightMap (surf, base, BLOCK_WIDTH*lightmap_bytes);
+	}
+}
+
+/*
+================
+R_BuildLightmapQueue
+
+Builds all the queued lightmaps.  Every surface has its own part of a
+lightmap block, so they can be built in any order on any thread.
+================
+*/
+void R_BuildLightmapQueue (void)
+{
+	int		i, workcnt;
+
+	if (!lightmap_numqueued)
+		return;
+
+	R_UpdateLightStyleTables ();
+
+	workcnt = (lightmap_numqueued + LIGHTMAP_CHUNK-1) / LIGHTMAP_CHUNK;
+	if (workcnt > 1 && Sys_NumThreads () > 1)
+		Sys_RunThreadsOn (workcnt, R_BuildLightmapWork);
+	else
+		for (i=0 ; i<workcnt ; i++)
+			R_BuildLightmapWork (i);
+
+	lightmap_numqueued = 0;
+}
+
+/*
+================
+R_QueueLightmap
+================
+*/
+static void R_QueueLightmap (msurface_t *surf)
+{
+	if (lightmap_numqueued == MAX_LIGHTMAP_QUEUE)
+		R_BuildLightmapQueue ();
+	lightmap_queue[lightmap_numqueued++] = surf;
+}
+
+/*
+================
+R_UpdateLightmap
+
+Queues the lightmap of the surface for rebuilding if a light style or
+dynamic light on it changed since it was built
+================
+*/
+static void R_UpdateLightmap (msurface_t *fa)
+{
+	int			i, maps;
+	int			smax, tmax;
+	unsigned	dlightbits, bits;
+
+	if (fa->flags & (SURF_DRAWSKY|SURF_DRAWTURB))
+		return;
+	if (!r_dynamic.value)
+		return;
+
+	dlightbits = (fa->dlightframe == r_framecount) ? fa->dlightbits : 0;
+	if (dlightbits != (unsigned)fa->cached_dlightbits)
+		goto dynamic;
+	for (i=0, bits=dlightbits ; bits ; i++, bits>>=1)
+		if ((bits & 1) && r_dlightchanged[i] > fa->cached_dlightpush)
+			goto dynamic;
+	for (maps = 0 ; maps < MAXLIGHTMAPS && fa->styles[maps] != 255 ;
+		 maps++)
+		if (d_lightstylevalue[fa->styles[maps]] != fa->cached_light[maps])
+			goto dynamic;
+	return;
+
+dynamic:
+	smax = (fa->extents[0]>>4)+1;
+	tmax = (fa->extents[1]>>4)+1;
+	R_AddLightmapRect (fa->lightmaptexturenum, fa->light_s, fa->light_t, smax, tmax);
+	R_QueueLightmap (fa);
+	c_lightmap_texels += smax*tmax;
+}
+
+/*
+================
+R_UploadLightmap
+
+Sends the changed rects of the bound lightmap texture, straight out of
+lightmaps
+================
+*/
+void R_UploadLightmap (int lightmap)
+{
+	int			i;
+	glRect_t	*r;
+
+	glPixelStorei (GL_UNPACK_ROW_LENGTH, BLOCK_WIDTH);
+	for (i=0, r=lightmap_rects[lightmap] ; i<lightmap_numrects[lightmap] ; i++, r++)
+	{
+		glTexSubImage2D (GL_TEXTURE_2D, 0, r->l, r->t, r->w, r->h,
+			gl_lightmap_format, GL_UNSIGNED_BYTE,
+			lightmaps + ((lightmap*BLOCK_HEIGHT + r->t)*BLOCK_WIDTH + r->l)*lightmap_bytes);
+		c_lightmap_bytes += r->w*r->h*lightmap_bytes;
+	}
+	glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+	lightmap_numrects[lightmap] = 0;
+}
+
 /*
 ================
 R_BlendLightmaps
@@ -673,7 +788,6 @@ void R_BlendLightmaps (void)
 	int			i, j;
 	glpoly_t	*p;
 	float		*v;
-	glRect_t	*theRect;
 
 	if (r_fullbright.value)
 		return;
@@ -702,24 +816,8 @@ void R_BlendLightmaps (void)
 		if (!p)
 			continue;
 		GL_Bind(lightmap_textures+i);
-		if (lightmap_modified[i])
-		{
-			lightmap_modified[i] = false;
-			theRect = &lightmap_rectchange[i];
-//			glTexImage2D (GL_TEXTURE_2D, 0, lightmap_bytes
-//			, BLOCK_WIDTH, BLOCK_HEIGHT, 0, 
-//			gl_lightmap_format, GL_UNSIGNED_BYTE, lightmaps+i*BLOCK_WIDTH*BLOCK_HEIGHT*lightmap_bytes);
-//			glTexImage2D (GL_TEXTURE_2D, 0, lightmap_bytes
-//				, BLOCK_WIDTH, theRect->h, 0, 
-//				gl_lightmap_format, GL_UNSIGNED_BYTE, lightmaps+(i*BLOCK_HEIGHT+theRect->t)*BLOCK_WIDTH*lightmap_bytes);
-			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, theRect->t, 
-				BLOCK_WIDTH, theRect->h, gl_lightmap_format, GL_UNSIGNED_BYTE,
-				lightmaps+(i* BLOCK_HEIGHT + theRect->t) *BLOCK_WIDTH*lightmap_bytes);
-			theRect->l = BLOCK_WIDTH;
-			theRect->t = BLOCK_HEIGHT;
-			theRect->h = 0;
-			theRect->w = 0;
-		}
+		if (lightmap_numrects[i])
+			R_UploadLightmap (i);
 		for ( ; p ; p=p->chain)
 		{
 			if (p->flags & SURF_UNDERWATER)
@@ -758,10 +856,6 @@ R_RenderBrushPoly
 void R_RenderBrushPoly (msurface_t *fa)
 {
 	texture_t	*t;
-	byte		*base;
-	int			maps;
-	glRect_t    *theRect;
-	int smax, tmax;
 
 	c_brush_polys++;
 
@@ -789,42 +883,6 @@ void R_RenderBrushPoly (msurface_t *fa)
 
 	fa->polys->chain = lightmap_polys[fa->lightmaptexturenum];
 	lightmap_polys[fa->lightmaptexturenum] = fa->polys;
-
-	// check for lightmap modification
-	for (maps = 0 ; maps < MAXLIGHTMAPS && fa->styles[maps] != 255 ;
-		 maps++)
-		if (d_lightstylevalue[fa->styles[maps]] != fa->cached_light[maps])
-			goto dynamic;
-
-	if (fa->dlightframe == r_framecount	// dynamic this frame
-		|| fa->cached_dlight)			// dynamic previously
-	{
-dynamic:
-		if (r_dynamic.value)
-		{
-			lightmap_modified[fa->lightmaptexturenum] = true;
-			theRect = &lightmap_rectchange[fa->lightmaptexturenum];
-			if (fa->light_t < theRect->t) {
-				if (theRect->h)
-					theRect->h += theRect->t - fa->light_t;
-				theRect->t = fa->light_t;
-			}
-			if (fa->light_s < theRect->l) {
-				if (theRect->w)
-					theRect->w += theRect->l - fa->light_s;
-				theRect->l = fa->light_s;
-			}
-			smax = (fa->extents[0]>>4)+1;
-			tmax = (fa->extents[1]>>4)+1;
-			if ((theRect->w + theRect->l) < (fa->light_s + smax))
-				theRect->w = (fa->light_s-theRect->l)+smax;
-			if ((theRect->h + theRect->t) < (fa->light_t + tmax))
-				theRect->h = (fa->light_t-theRect->t)+tmax;
-			base = lightmaps + fa->lightmaptexturenum*lightmap_bytes*BLOCK_WIDTH*BLOCK_HEIGHT;
-			base += fa->light_t * BLOCK_WIDTH * lightmap_bytes + fa->light_s * lightmap_bytes;
-			R_BuildLightMap (fa, base, BLOCK_WIDTH*lightmap_bytes);
-		}
-	}
 }
 
 /*
@@ -835,12 +893,6 @@ Multitexture
 */
 void R_RenderDynamicLightmaps (msurface_t *fa)
 {
-	texture_t	*t;
-	byte		*base;
-	int			maps;
-	glRect_t    *theRect;
-	int smax, tmax;
-
 	c_brush_polys++;
 
 	if (fa->flags & ( SURF_DRAWSKY | SURF_DRAWTURB) )
@@ -848,42 +900,6 @@ void R_RenderDynamicLightmaps (msurface_t *fa)
 		
 	fa->polys->chain = lightmap_polys[fa->lightmaptexturenum];
 	lightmap_polys[fa->lightmaptexturenum] = fa->polys;
-
-	// check for lightmap modification
-	for (maps = 0 ; maps < MAXLIGHTMAPS && fa->styles[maps] != 255 ;
-		 maps++)
-		if (d_lightstylevalue[fa->styles[maps]] != fa->cached_light[maps])
-			goto dynamic;
-
-	if (fa->dlightframe == r_framecount	// dynamic this frame
-		|| fa->cached_dlight)			// dynamic previously
-	{
-dynamic:
-		if (r_dynamic.value)
-		{
-			lightmap_modified[fa->lightmaptexturenum] = true;
-			theRect = &lightmap_rectchange[fa->lightmaptexturenum];
-			if (fa->light_t < theRect->t) {
-				if (theRect->h)
-					theRect->h += theRect->t - fa->light_t;
-				theRect->t = fa->light_t;
-			}
-			if (fa->light_s < theRect->l) {
-				if (theRect->w)
-					theRect->w += theRect->l - fa->light_s;
-				theRect->l = fa->light_s;
-			}
-			smax = (fa->extents[0]>>4)+1;
-			tmax = (fa->extents[1]>>4)+1;
-			if ((theRect->w + theRect->l) < (fa->light_s + smax))
-				theRect->w = (fa->light_s-theRect->l)+smax;
-			if ((theRect->h + theRect->t) < (fa->light_t + tmax))
-				theRect->h = (fa->light_t-theRect->t)+tmax;
-			base = lightmaps + fa->lightmaptexturenum*lightmap_bytes*BLOCK_WIDTH*BLOCK_HEIGHT;
-			base += fa->light_t * BLOCK_WIDTH * lightmap_bytes + fa->light_s * lightmap_bytes;
-			R_BuildLightMap (fa, base, BLOCK_WIDTH*lightmap_bytes);
-		}
-	}
 }
 
 /*
@@ -1071,6 +1087,27 @@ void DrawTextureChains (void)
 	}
 }
 
+/*
+=================
+R_BrushSurfaceFacing
+
+True if the front of the brush model surface faces modelorg
+=================
+*/
+static qboolean R_BrushSurfaceFacing (msurface_t *psurf)
+{
+	float		dot;
+	mplane_t	*pplane;
+
+// find which side of the node we are on
+	pplane = psurf->plane;
+
+	dot = DotProduct (modelorg, pplane->normal) - pplane->dist;
+
+	return ((psurf->flags & SURF_PLANEBACK) && (dot < -BACKFACE_EPSILON)) ||
+		(!(psurf->flags & SURF_PLANEBACK) && (dot > BACKFACE_EPSILON));
+}
+
 /*
 =================
 R_DrawBrushModel
@@ -1082,8 +1119,6 @@ void R_DrawBrushModel (entity_t *e)
 	vec3_t		mins, maxs;
 	int			i, numsurfaces;
 	msurface_t	*psurf;
-	float		dot;
-	mplane_t	*pplane;
 	model_t		*clmodel;
 	qboolean	rotated;
 
@@ -1150,18 +1185,17 @@ e->angles[0] = -e->angles[0];	// stupid quake bug
 e->angles[0] = -e->angles[0];	// stupid quake bug
 
 	//
-	// draw texture
+	// build the lightmaps that changed, then draw texture
 	//
 	for (i=0 ; i<clmodel->nummodelsurfaces ; i++, psurf++)
-	{
-	// find which side of the node we are on
-		pplane = psurf->plane;
-
-		dot = DotProduct (modelorg, pplane->normal) - pplane->dist;
+		if (R_BrushSurfaceFacing (psurf))
+			R_UpdateLightmap (psurf);
+	R_BuildLightmapQueue ();
 
-	// draw the polygon
-		if (((psurf->flags & SURF_PLANEBACK) && (dot < -BACKFACE_EPSILON)) ||
-			(!(psurf->flags & SURF_PLANEBACK) && (dot > BACKFACE_EPSILON)))
+	psurf = &clmodel->surfaces[clmodel->firstmodelsurface];
+	for (i=0 ; i<clmodel->nummodelsurfaces ; i++, psurf++)
+	{
+		if (R_BrushSurfaceFacing (psurf))
 		{
 			if (gl_texsort.value)
 				R_RenderBrushPoly (psurf);
@@ -1183,33 +1217,72 @@ e->angles[0] = -e->angles[0];	// stupid quake bug
 =============================================================
 */
 
+/*
+The world nodes and leafs in the PVS of r_visleaf, listed by R_MarkLeaves
+in the order the tree was walked from where the view entered the leaf,
+front side first.  A node is listed once before its children, with skip
+past its whole subtree, and once more between its children to have its
+surfaces drawn.  While the view stays in the leaf, the world is drawn by
+going down the list, skipping the subtrees outside the frustum, without
+walking the tree.
+*/
+typedef struct
+{
+	mnode_t		*node;
+	int			skip;		// index past the subtree, 0 to draw the node's surfaces
+} visnode_t;
+
+#define	MAX_VISNODES	(MAX_MAP_NODES*2+MAX_MAP_LEAFS)
+
+visnode_t	r_visnodes[MAX_VISNODES];
+int			r_numvisnodes;
+mleaf_t		*r_visleaf;			// r_visnodes is for this leaf, NULL when it needs to be listed
+qboolean	r_visnovis;			// and listed with r_novis
+
+mnode_t		*r_drawnodes[MAX_MAP_NODES];	// the listed nodes with surfaces in the frustum
+int			r_numdrawnodes;
+
 /*
 ================
-R_RecursiveWorldNode
+R_CullVisibleNodes
+
+Marks the surfaces of the listed leafs in the frustum and stores their
+entity fragments, and collects the nodes whose surfaces can be seen.
+Their surfaces are only chained once every leaf is marked, so a water
+surface shows when either of the leafs on its sides is in view.
 ================
 */
-void R_RecursiveWorldNode (mnode_t *node)
+void R_CullVisibleNodes (void)
 {
-	int			i, c, side, *pindex;
-	vec3_t		acceptpt, rejectpt;
-	mplane_t	*plane;
-	msurface_t	*surf, **mark;
+	int			i, c;
+	visnode_t	*v;
+	mnode_t		*node;
 	mleaf_t		*pleaf;
-	double		d, dot;
-	vec3_t		mins, maxs;
+	msurface_t	**mark;
 
-	if (node->contents == CONTENTS_SOLID)
-		return;		// solid
-
-	if (node->visframe != r_visframecount)
-		return;
-	if (R_CullBox (vec3_t(node->minmaxs[0], node->minmaxs[1], node->minmaxs[2]), 
-				   vec3_t(node->minmaxs[3], node->minmaxs[4], node->minmaxs[5])))
-		return;
-	
-// if a leaf node, draw stuff
-	if (node->contents < 0)
+	r_numdrawnodes = 0;
+	for (i=0 ; i<r_numvisnodes ; )
 	{
+		v = &r_visnodes[i];
+		node = v->node;
+		if (!v->skip)
+		{
+			r_drawnodes[r_numdrawnodes++] = node;
+			i++;
+			continue;
+		}
+		if (R_CullBox (vec3_t(node->minmaxs[0], node->minmaxs[1], node->minmaxs[2]), 
+					   vec3_t(node->minmaxs[3], node->minmaxs[4], node->minmaxs[5])))
+		{
+			i = v->skip;
+			continue;
+		}
+		i++;
+
+		if (node->contents >= 0)
+			continue;
+
+	// a leaf, mark its surfaces
 		pleaf = (mleaf_t *)node;
 
 		mark = pleaf->firstmarksurface;
@@ -1227,11 +1300,22 @@ void R_RecursiveWorldNode (mnode_t *node)
 	// deal with model fragments in this leaf
 		if (pleaf->efrags)
 			R_StoreEfrags (&pleaf->efrags);
-
-		return;
 	}
+}
+
+/*
+================
+R_ChainNodeSurfaces
 
-// node is just a decision point, so go down the apropriate sides
+Puts the marked surfaces of the node that face the view on their chains
+================
+*/
+void R_ChainNodeSurfaces (mnode_t *node)
+{
+	int			c;
+	mplane_t	*plane;
+	msurface_t	*surf;
+	double		dot;
 
 // find which side of the node we are on
 	plane = node->plane;
@@ -1252,60 +1336,42 @@ void R_RecursiveWorldNode (mnode_t *node)
 		break;
 	}
 
-	if (dot >= 0)
-		side = 0;
-	else
-		side = 1;
-
-// recurse down the children, front side first
-	R_RecursiveWorldNode (node->children[side]);
-
-// draw stuff
 	c = node->numsurfaces;
+	surf = cl.worldmodel->surfaces + node->firstsurface;
 
-	if (c)
+	for ( ; c ; c--, surf++)
 	{
-		surf = cl.worldmodel->surfaces + node->firstsurface;
+		if (surf->visframe != r_framecount)
+			continue;
 
-		if (dot < 0 -BACKFACE_EPSILON)
-			side = SURF_PLANEBACK;
-		else if (dot > BACKFACE_EPSILON)
-			side = 0;
+		// don't backface underwater surfaces, because they warp
+		if ( !(surf->flags & SURF_UNDERWATER) && ( (dot < 0) ^ !!(surf->flags & SURF_PLANEBACK)) )
+			continue;		// wrong side
+
+		// if sorting by texture, just store it out
+		if (gl_texsort.value)
 		{
-			for ( ; c ; c--, surf++)
+			if (!mirror
+			|| surf->texinfo->texture != cl.worldmodel->textures[mirrortexturenum])
 			{
-				if (surf->visframe != r_framecount)
-					continue;
-
-				// don't backface underwater surfaces, because they warp
-				if ( !(surf->flags & SURF_UNDERWATER) && ( (dot < 0) ^ !!(surf->flags & SURF_PLANEBACK)) )
-					continue;		// wrong side
-
-				// if sorting by texture, just store it out
-				if (gl_texsort.value)
-				{
-					if (!mirror
-					|| surf->texinfo->texture != cl.worldmodel->textures[mirrortexturenum])
-					{
-						surf->texturechain = surf->texinfo->texture->texturechain;
-						surf->texinfo->texture->texturechain = surf;
-					}
-				} else if (surf->flags & SURF_DRAWSKY) {
-					surf->texturechain = skychain;
-					skychain = surf;
-				} else if (surf->flags & SURF_DRAWTURB) {
-					surf->texturechain = waterchain;
-					waterchain = surf;
-				} else
-					R_DrawSequentialPoly (surf);
-
+				surf->texturechain = surf->texinfo->texture->texturechain;
+				surf->texinfo->texture->texturechain = surf;
+				R_UpdateLightmap (surf);
 			}
+		} else if (surf->flags & SURF_DRAWSKY) {
+			surf->texturechain = skychain;
+			skychain = surf;
+		} else if (surf->flags & SURF_DRAWTURB) {
+			surf->texturechain = waterchain;
+			waterchain = surf;
+		} else {
+		// drawn in order once the lightmaps are built
+			surf->texturechain = NULL;
+			*sequentialtail = surf;
+			sequentialtail = &surf->texturechain;
+			R_UpdateLightmap (surf);
 		}
-
 	}
-
-// recurse down the back side
-	R_RecursiveWorldNode (node->children[!side]);
 }
 
 
@@ -1319,6 +1385,7 @@ void R_DrawWorld (void)
 {
 	entity_t	ent;
 	int			i;
+	msurface_t	*s;
 
 	memset (&ent, 0, sizeof(ent));
 	ent.model = cl.worldmodel;
@@ -1334,7 +1401,17 @@ void R_DrawWorld (void)
 	R_ClearSkyBox ();
 #endif
 
-	R_RecursiveWorldNode (cl.worldmodel->nodes);
+	sequentialchain = NULL;
+	sequentialtail = &sequentialchain;
+
+	R_CullVisibleNodes ();
+	for (i=0 ; i<r_numdrawnodes ; i++)
+		R_ChainNodeSurfaces (r_drawnodes[i]);
+
+	R_BuildLightmapQueue ();
+
+	for (s=sequentialchain ; s ; s=s->texturechain)
+		R_DrawSequentialPoly (s);
 
 	DrawTextureChains ();
 
@@ -1346,9 +1423,46 @@ void R_DrawWorld (void)
 }
 
 
+/*
+===============
+R_ListVisibleNodes
+===============
+*/
+void R_ListVisibleNodes (mnode_t *node)
+{
+	int			side;
+	visnode_t	*v;
+
+	if (node->contents == CONTENTS_SOLID)
+		return;		// solid
+	if (node->visframe != r_visframecount)
+		return;
+
+	v = &r_visnodes[r_numvisnodes++];
+	v->node = node;
+
+	if (node->contents >= 0)
+	{
+		side = DotProduct (r_origin, node->plane->normal) - node->plane->dist < 0;
+		R_ListVisibleNodes (node->children[side]);
+		if (node->numsurfaces)
+		{
+			r_visnodes[r_numvisnodes].node = node;
+			r_visnodes[r_numvisnodes].skip = 0;
+			r_numvisnodes++;
+		}
+		R_ListVisibleNodes (node->children[!side]);
+	}
+
+	v->skip = r_numvisnodes;
+}
+
 /*
 ===============
 R_MarkLeaves
+
+Marks the nodes in the PVS of the view leaf and lists them when the view
+gets to a new leaf
 ===============
 */
 void R_MarkLeaves (void)
@@ -1358,14 +1472,15 @@ void R_MarkLeaves (void)
 	int		i;
 	byte	solid[4096];
 
-	if (r_oldviewleaf == r_viewleaf && !r_novis.value)
+	if (r_visleaf == r_viewleaf && r_visnovis == !!r_novis.value)
 		return;
 	
 	if (mirror)
 		return;
 
 	r_visframecount++;
-	r_oldviewleaf = r_viewleaf;
+	r_visleaf = r_viewleaf;
+	r_visnovis = !!r_novis.value;
 
 	if (r_novis.value)
 	{
@@ -1373,7 +1488,7 @@ void R_MarkLeaves (void)
 		memset (solid, 0xff, (cl.worldmodel->numleafs+7)>>3);
 	}
 	else
-		vis = Mod_LeafPVS (r_viewleaf, cl.worldmodel);
+		vis = Mod_LeafPVS (r_viewleaf, cl.worldmodel, solid);
 		
 	for (i=0 ; i<cl.worldmodel->numleafs ; i++)
 	{
@@ -1389,6 +1504,9 @@ void R_MarkLeaves (void)
 			} while (node);
 		}
 	}
+
+	r_numvisnodes = 0;
+	R_ListVisibleNodes (cl.worldmodel->nodes);
 }
 
 
@@ -1576,8 +1694,7 @@ GL_CreateSurfaceLightmap
 */
 void GL_CreateSurfaceLightmap (msurface_t *surf)
 {
-	int		smax, tmax, s, t, l, i;
-	byte	*base;
+	int		smax, tmax;
 
 	if (surf->flags & (SURF_DRAWSKY|SURF_DRAWTURB))
 		return;
@@ -1586,9 +1703,7 @@ void GL_CreateSurfaceLightmap (msurface_t *surf)
 	tmax = (surf->extents[1]>>4)+1;
 
 	surf->lightmaptexturenum = AllocBlock (smax, tmax, &surf->light_s, &surf->light_t);
-	base = lightmaps + surf->lightmaptexturenum*lightmap_bytes*BLOCK_WIDTH*BLOCK_HEIGHT;
-	base += (surf->light_t * BLOCK_WIDTH + surf->light_s) * lightmap_bytes;
-	R_BuildLightMap (surf, base, BLOCK_WIDTH*lightmap_bytes);
+	R_QueueLightmap (surf);
 }
 
 
@@ -1646,6 +1761,8 @@ void GL_BuildLightmaps (void)
 		lightmap_bytes = 1;
 		break;
 	}
+	if (lightmap_bytes != 1 && lightmap_bytes != 4)
+		Sys_Error ("Bad lightmap format");	// the threads building them can't
 
 	for (j=1 ; j<MAX_MODELS ; j++)
 	{
@@ -1668,6 +1785,7 @@ void GL_BuildLightmaps (void)
 			BuildSurfaceDisplayList (m->surfaces + i);
 		}
 	}
+	R_BuildLightmapQueue ();
 
  	if (!gl_texsort.value)
  		GL_SelectTexture(TEXTURE1_SGIS);
@@ -1679,11 +1797,7 @@ void GL_BuildLightmaps (void)
 	{
 		if (!allocated[i][0])
 			break;		// no more used
-		lightmap_modified[i] = false;
-		lightmap_rectchange[i].l = BLOCK_WIDTH;
-		lightmap_rectchange[i].t = BLOCK_HEIGHT;
-		lightmap_rectchange[i].w = 0;
-		lightmap_rectchange[i].h = 0;
+		lightmap_numrects[i] = 0;
 		GL_Bind(lightmap_textures + i);
 		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
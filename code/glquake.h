@@ -27,8 +27,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <windows.h>
 #endif
 
+#ifndef SERVERONLY
 #include <GL/gl.h>
 #include <GL/glu.h>
+#endif
 
 void GL_BeginRendering (int *x, int *y, int *width, int *height);
 void GL_EndRendering (void);
@@ -176,8 +178,12 @@ extern	vec3_t	r_origin;
 //
 extern	refdef_t	r_refdef;
 extern	mleaf_t		*r_viewleaf, *r_oldviewleaf;
+extern	mleaf_t		*r_visleaf;
 extern	texture_t	*r_notexture_mip;
 extern	int		d_lightstylevalue[256];	// 8.8 fraction of base light value
+extern	int		r_dlightpushes;
+extern	int		r_dlightchanged[MAX_DLIGHTS];
+extern	int		c_lightmap_texels, c_lightmap_bytes;
 
 extern	qboolean	envmap;
 extern	int	currenttexture;
@@ -243,10 +249,12 @@ void GL_Bind (int texnum);
 #define APIENTRY /* */
 #endif
 
+#ifndef SERVERONLY
 typedef void (APIENTRY *lpMTexFUNC) (GLenum, GLfloat, GLfloat);
 typedef void (APIENTRY *lpSelTexFUNC) (GLenum);
 extern lpMTexFUNC qglMTexCoord2fSGIS;
 extern lpSelTexFUNC qglSelectTextureSGIS;
+#endif
 
 extern qboolean gl_mtexable;
 
@@ -265,6 +273,13 @@ void R_RenderBrushPoly(msurface_t* fa);
 void R_InitParticles(void);
 void R_ClearParticles(void);
 void GL_BuildLightmaps(void);
+
+#define	LIGHT_ONE	0x10000		// full light in a lightmap accumulation
+
+void R_InitLightmaps (void);
+void R_UpdateLightStyleTables (void);
+void R_AccumulateLightmap (msurface_t *surf, int *bl);
+void R_StoreLightmap (int *bl, int smax, int tmax, byte *dest, int stride, int texelbytes);
 void EmitWaterPolys(msurface_t* fa);
 void EmitSkyPolys(msurface_t* fa);
 void EmitBothSkyLayers(msurface_t* fa);
@@ -138,7 +138,7 @@ void Host_Error (char *error, ...)
 	if (sv.active)
 		Host_ShutdownServer (false);
 
-	if (cls.state == ca_dedicated)
+	if (cls.state == ca_dedicated && !SV_RunningInstances ())
 		Sys_Error ("Host_Error: %s\n",string);	// dedicated servers exit
 
 	CL_Disconnect ();
@@ -161,10 +161,10 @@ void	Host_FindMaxClients (void)
 	svs.maxclients = 1;
 		
 	i = COM_CheckParm ("-dedicated");
-	if (i)
+	if (i || isDedicated)	// the sys layer may only support dedicated
 	{
 		cls.state = ca_dedicated;
-		if (i != (com_argc - 1))
+		if (i && i != (com_argc - 1))
 		{
 			svs.maxclients = Q_atoi (com_argv[i+1]);
 		}
@@ -198,6 +198,8 @@ void	Host_FindMaxClients (void)
 		Cvar_SetValue ("deathmatch", 1.0);
 	else
 		Cvar_SetValue ("deathmatch", 0.0);
+
+	SV_InitInstances ();
 }
 
 
@@ -361,7 +363,7 @@ void SV_DropClient (qboolean crash)
 		// this will set the body to a dead frame, among other things
 			saveSelf = pr_global_struct->self;
 			pr_global_struct->self = EDICT_TO_PROG(host_client->edict);
-			PR_ExecuteProgram (pr_global_struct->ClientDisconnect);
+			PR_ExecuteProgram (sv.qcvm, pr_global_struct->ClientDisconnect);
 			pr_global_struct->self = saveSelf;
 		}
 
@@ -376,7 +378,7 @@ void SV_DropClient (qboolean crash)
 	host_client->active = false;
 	host_client->name[0] = 0;
 	host_client->old_frags = -999999;
-	net_activeconnections--;
+	svs.activeconnections--;
 
 // send notification to all clients
 	for (i=0, client = svs.clients ; i<svs.maxclients ; i++, client++)
@@ -461,6 +463,7 @@ void Host_ShutdownServer(qboolean crash)
 //
 // clear structures
 //
+	SV_ReleaseModels ();
 	memset (&sv, 0, sizeof(sv));
 	memset (svs.clients, 0, svs.maxclientslimit*sizeof(client_t));
 }
@@ -476,11 +479,19 @@ not reinitialize anything.
 */
 void Host_ClearMemory (void)
 {
+	int		mark;
+	hunkarena_t	*arena;
+
 	Con_DPrintf ("Clearing memory\n");
 	D_FlushCaches ();
-	Mod_ClearAll ();
-	if (host_hunklevel)
-		Hunk_FreeToLowMark (host_hunklevel);
+	SV_ReleaseModels ();
+	arena = Hunk_SetArena (NULL);
+	mark = Mod_ClearUnused ();		// keep models the next level may want
+	if (!mark)
+		mark = host_hunklevel;
+	if (mark)
+		Hunk_FreeToLowMark (mark);
+	Hunk_SetArena (arena);
 
 	cls.signon = 0;
 	memset (&sv, 0, sizeof(sv));
@@ -545,8 +556,9 @@ void Host_GetConsoleCommands (void)
 
 /*
 ==================
-Host_ServerFrame
+Host_InstanceFrame
 
+Runs a frame of the current instance
 ==================
 */
 #ifdef FPS_20
@@ -565,7 +577,7 @@ void _Host_ServerFrame (void)
 		SV_Physics ();
 }
 
-void Host_ServerFrame (void)
+void Host_InstanceFrame (qboolean listen)
 {
 	float	save_host_frametime;
 	float	temp_host_frametime;
@@ -577,7 +589,8 @@ void Host_ServerFrame (void)
 	SV_ClearDatagram ();
 	
 // check for _new clients
-	SV_CheckForNewClients ();
+	if (listen)
+		SV_CheckForNewClients ();
 
 	temp_host_frametime = save_host_frametime = host_frametime;
 	while(temp_host_frametime > (1.0/72.0))
@@ -597,7 +610,7 @@ void Host_ServerFrame (void)
 
 #else
 
-void Host_ServerFrame (void)
+void Host_InstanceFrame (qboolean listen)
 {
 // run the world state	
 	pr_global_struct->frametime = host_frametime;
@@ -606,7 +619,8 @@ void Host_ServerFrame (void)
 	SV_ClearDatagram ();
 	
 // check for _new clients
-	SV_CheckForNewClients ();
+	if (listen)
+		SV_CheckForNewClients ();
 
 // read client messages
 	SV_RunClients ();
@@ -622,6 +636,29 @@ void Host_ServerFrame (void)
 
 #endif
 
+/*
+==================
+Host_ServerFrame
+
+Runs every running instance in turn, only the one new clients go to
+checking for them
+==================
+*/
+void Host_ServerFrame (void)
+{
+	int		i;
+	svinstance_t	*listener;
+
+	listener = SV_NewClientInstance ();
+	for (i=0 ; i<sv_numinstances ; i++)
+	{
+		SV_SetInstance (&sv_instances[i]);
+		if (sv.active)
+			Host_InstanceFrame (sv_instance == listener);
+	}
+	SV_SetInstance (sv_cmdinstance);
+}
+
 
 /*
 ==================
@@ -638,7 +675,11 @@ void _Host_Frame (float time)
 	int			pass1, pass2, pass3;
 
 	if (setjmp (host_abortserver) )
+	{
+		Hunk_SetArena (NULL);		// in case it was spawning a level
+		SV_SetInstance (sv_cmdinstance);
 		return;			// something bad happened, or the server disconnected
+	}
 
 // keep the random time dependent
 	rand ();
@@ -671,7 +712,7 @@ void _Host_Frame (float time)
 // check for commands typed to the host
 	Host_GetConsoleCommands ();
 	
-	if (sv.active)
+	if (SV_RunningInstances ())
 		Host_ServerFrame ();
 
 //-------------------
@@ -872,6 +913,7 @@ void Host_Init (quakeparms_t *parms)
 	Con_Printf ("%4.1f megabyte heap\n",parms->memsize/ (1024*1024.0));
 	
 	R_InitTextures ();		// needed even for dedicated servers
+	R_InitLightmaps ();
  
 	if (cls.state != ca_dedicated)
 	{
@@ -36,13 +36,19 @@ extern void M_Menu_Quit_f (void);
 
 void Host_Quit_f (void)
 {
+	int		i;
+
 	if (key_dest != key_console && cls.state != ca_dedicated)
 	{
 		M_Menu_Quit_f ();
 		return;
 	}
 	CL_Disconnect ();
-	Host_ShutdownServer(false);		
+	for (i=0 ; i<sv_numinstances ; i++)
+	{
+		SV_SetInstance (&sv_instances[i]);
+		Host_ShutdownServer(false);		
+	}
 
 	Sys_Quit ();
 }
@@ -81,7 +87,9 @@ void Host_Status_f (void)
 	if (ipxAvailable)
 		print ("ipx:     %s\n", my_ipx_address);
 	print ("map:     %s\n", sv.name);
-	print ("players: %i active (%i max)\n\n", net_activeconnections, svs.maxclients);
+	if (sv.droppedentities)
+		print ("entities: %i visible ones dropped from full frames\n", sv.droppedentities);
+	print ("players: %i active (%i max)\n\n", svs.activeconnections, svs.maxclients);
 	for (j=0, client = svs.clients ; j<svs.maxclients ; j++, client++)
 	{
 		if (!client->active)
@@ -570,6 +578,7 @@ void Host_Loadgame_f (void)
 	int		entnum;
 	int		version;
 	float			spawn_parms[NUM_SPAWN_PARMS];
+	hunkarena_t	*arena;
 
 	if (cmd_source != src_command)
 		return;
@@ -637,6 +646,7 @@ void Host_Loadgame_f (void)
 	sv.loadgame = true;
 
 // load the light styles
+	arena = Hunk_SetArena (sv_instance->hunk);
 
 	for (i=0 ; i<MAX_LIGHTSTYLES ; i++)
 	{
@@ -693,6 +703,9 @@ void Host_Loadgame_f (void)
 	
 	sv.num_edicts = entnum;
 	sv.time = time;
+	ED_RebuildFreeList ();
+	SV_WakeAllEdicts ();
+	Hunk_SetArena (arena);
 
 	fclose (f);
 
@@ -770,6 +783,7 @@ int LoadGamestate(char *level, char *startspot)
 	int		entnum;
 	int		version;
 //	float	spawn_parms[NUM_SPAWN_PARMS];
+	hunkarena_t	*arena;
 
 	sprintf (name, "%s/%s.gip", com_gamedir, level);
 	
@@ -806,6 +820,7 @@ int LoadGamestate(char *level, char *startspot)
 	}
 
 // load the light styles
+	arena = Hunk_SetArena (sv_instance->hunk);
 	for (i=0 ; i<MAX_LIGHTSTYLES ; i++)
 	{
 		fscanf (f, "%s\n", str);
@@ -853,6 +868,9 @@ int LoadGamestate(char *level, char *startspot)
 	
 //	sv.num_edicts = entnum;
 	sv.time = time;
+	ED_RebuildFreeList ();
+	SV_WakeAllEdicts ();
+	Hunk_SetArena (arena);
 	fclose (f);
 
 //	for (i=0 ; i<NUM_SPAWN_PARMS ; i++)
@@ -1205,7 +1223,7 @@ void Host_Kill_f (void)
 	
 	pr_global_struct->time = sv.time;
 	pr_global_struct->self = EDICT_TO_PROG(sv_player);
-	PR_ExecuteProgram (pr_global_struct->ClientKill);
+	PR_ExecuteProgram (sv.qcvm, pr_global_struct->ClientKill);
 }
 
 
@@ -1265,10 +1283,8 @@ void Host_PreSpawn_f (void)
 		return;
 	}
 	
-	SZ_Write (&host_client->message, sv.signon.data, sv.signon.cursize);
-	MSG_WriteByte (&host_client->message, svc_signonnum);
-	MSG_WriteByte (&host_client->message, 2);
-	host_client->sendsignon = true;
+	host_client->signonbuf = 0;
+	SV_WriteSignon (host_client);
 }
 
 /*
@@ -1305,6 +1321,7 @@ void Host_Spawn_f (void)
 		// set up the edict
 		ent = host_client->edict;
 
+		ED_Reindex (ent);
 		memset (&ent->v, 0, progs->entityfields * 4);
 		ent->v.colormap = NUM_FOR_EDICT(ent);
 		ent->v.team = (host_client->colors & 15) + 1;
@@ -1319,12 +1336,12 @@ void Host_Spawn_f (void)
 
 		pr_global_struct->time = sv.time;
 		pr_global_struct->self = EDICT_TO_PROG(sv_player);
-		PR_ExecuteProgram (pr_global_struct->ClientConnect);
+		PR_ExecuteProgram (sv.qcvm, pr_global_struct->ClientConnect);
 
 		if ((Sys_FloatTime() - host_client->netconnection->connecttime) <= sv.time)
 			Sys_Printf ("%s entered the game\n", host_client->name);
 
-		PR_ExecuteProgram (pr_global_struct->PutClientInServer);	
+		PR_ExecuteProgram (sv.qcvm, pr_global_struct->PutClientInServer);	
 	}
 
 
@@ -1388,6 +1405,7 @@ void Host_Spawn_f (void)
 		MSG_WriteAngle (&host_client->message, ent->v.angles[i] );
 	MSG_WriteAngle (&host_client->message, 0 );
 
+	SV_SetIdealPitch ();
 	SV_WriteClientdataToMessage (sv_player, &host_client->message);
 
 	MSG_WriteByte (&host_client->message, svc_signonnum);
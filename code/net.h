@@ -265,7 +265,6 @@ qboolean IsID(struct qsockaddr *addr);
 
 extern	double		net_time;
 extern	sizebuf_t	net_message;
-extern	int			net_activeconnections;
 
 void		NET_Init (void);
 void		NET_Shutdown (void);
@@ -55,7 +55,7 @@ void Loop_SearchForHosts (qboolean xmit)
 	else
 		Q_strcpy(hostcache[0].name, hostname.string);
 	Q_strcpy(hostcache[0].map, sv.name);
-	hostcache[0].users = net_activeconnections;
+	hostcache[0].users = svs.activeconnections;
 	hostcache[0].maxusers = svs.maxclients;
 	hostcache[0].driver = net_driverlevel;
 	Q_strcpy(hostcache[0].cname, "local");
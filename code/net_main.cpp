@@ -56,7 +56,6 @@ PollProcedure	slistPollProcedure = {NULL, 0.0, Slist_Poll};
 
 
 sizebuf_t		net_message;
-int				net_activeconnections = 0;
 
 int messagesSent = 0;
 int messagesReceived = 0;
@@ -114,7 +113,7 @@ qsocket_t *NET_NewQSocket (void)
 	if (net_freeSockets == NULL)
 		return NULL;
 
-	if (net_activeconnections >= svs.maxclients)
+	if (svs.activeconnections >= svs.maxclients)
 		return NULL;
 
 	// get one from free list
@@ -833,7 +832,7 @@ void NET_Init (void)
 
 	if (COM_CheckParm("-listen") || cls.state == ca_dedicated)
 		listening = true;
-	net_numsockets = svs.maxclientslimit;
+	net_numsockets = svs.maxclientslimit * sv_numinstances;
 	if (cls.state != ca_dedicated)
 		net_numsockets++;
 
@@ -529,6 +529,7 @@ void PF_ambientsound (void)
 
 // add an svc_spawnambient command to the level signon packet
 
+	SV_ReserveSignonSpace (10);
 	MSG_WriteByte (&sv.signon,svc_spawnstaticsound);
 	for (i=0 ; i<3 ; i++)
 		MSG_WriteCoord(&sv.signon, pos[i]);
@@ -681,8 +682,6 @@ void PF_checkpos (void)
 
 //============================================================================
 
-byte	checkpvs[MAX_MAP_LEAFS/8];
-
 int PF_newcheckclient (int check)
 {
 	int		i;
@@ -727,8 +726,8 @@ int PF_newcheckclient (int check)
 // get the PVS for the entity
 	VectorAdd (ent->v.origin, ent->v.view_ofs, org);
 	leaf = Mod_PointInLeaf (org, sv.worldmodel);
-	pvs = Mod_LeafPVS (leaf, sv.worldmodel);
-	memcpy (checkpvs, pvs, (sv.worldmodel->numleafs+7)>>3 );
+	pvs = (byte *)SV_LeafPVS (leaf);
+	memcpy (sv.checkpvs, pvs, (sv.worldmodel->numleafs+7)>>3 );
 
 	return i;
 }
@@ -777,7 +776,7 @@ void PF_checkclient (void)
 	VectorAdd (self->v.origin, self->v.view_ofs, view);
 	leaf = Mod_PointInLeaf (view, sv.worldmodel);
 	l = (leaf - sv.worldmodel->leafs) - 1;
-	if ( (l<0) || !(checkpvs[l>>3] & (1<<(l&7)) ) )
+	if ( (l<0) || !(sv.checkpvs[l>>3] & (1<<(l&7)) ) )
 	{
 c_notvis++;
 		RETURN_EDICT(sv.edicts);
@@ -832,7 +831,7 @@ void PF_localcmd (void)
 	char	*str;
 	
 	str = G_STRING(OFS_PARM0);	
-	Cbuf_AddText (str);
+	SV_InstanceCommand (str);
 }
 
 /*
@@ -868,27 +867,57 @@ void PF_cvar_set (void)
 	Cvar_Set (var, val);
 }
 
+/*
+=================
+PF_AreaCandidates
+
+Collects the linked edicts whose boxes touch mins / maxs into sv.arealist,
+optionally with the ones moved since they were linked, sorted by number
+=================
+*/
+static int PF_EdictCompare (const void *a, const void *b)
+{
+	edict_t	*e1 = *(edict_t **)a, *e2 = *(edict_t **)b;
+
+	return e1 < e2 ? -1 : e1 > e2;
+}
+
+static int PF_AreaCandidates (const vec3_t & mins, const vec3_t & maxs, qboolean moved)
+{
+	int		i, j, count;
+
+	count = SV_AreaEdicts (mins, maxs, sv.arealist, sv.max_edicts, AREA_SOLID|AREA_TRIGGERS);
+	if (moved)
+		count += SV_MovedEdicts (sv.arealist + count, sv.max_edicts);
+	qsort (sv.arealist, count, sizeof(edict_t *), PF_EdictCompare);
+
+	for (i=j=0 ; i<count ; i++)		// moved edicts can be linked as well
+		if (!j || sv.arealist[i] != sv.arealist[j-1])
+			sv.arealist[j++] = sv.arealist[i];
+	return j;
+}
+
 /*
 =================
 PF_findradius
 
 Returns a chain of entities that have origins within a spherical area
 
+The chain is in descending entity number order, the same as when every
+edict was checked in turn.  The candidates come from the area tree plus the
+edicts whose origin, size or solid changed since they were linked, so the
+result is exactly the same as the full scan.
+
 findradius (origin, radius)
 =================
 */
-void PF_findradius (void)
+static edict_t *PF_FindRadiusScan (float *org, float rad)
 {
 	edict_t	*ent, *chain;
-	float	rad;
-	float	*org;
 	vec3_t	eorg;
 	int		i, j;
 
 	chain = (edict_t *)sv.edicts;
-	
-	org = G_VECTOR(OFS_PARM0);
-	rad = G_FLOAT(OFS_PARM1);
 
 	ent = NEXT_EDICT(sv.edicts);
 	for (i=1 ; i<sv.num_edicts ; i++, ent = NEXT_EDICT(ent))
@@ -906,9 +935,185 @@ void PF_findradius (void)
 		chain = ent;
 	}
 
+	return chain;
+}
+
+static edict_t *PF_FindRadiusArea (float *org, float rad)
+{
+	edict_t	*ent, *chain;
+	vec3_t	eorg, mins, maxs;
+	int		i, j, count;
+
+	for (j=0 ; j<3 ; j++)
+	{
+		mins[j] = org[j] - rad - 1;
+		maxs[j] = org[j] + rad + 1;
+	}
+	count = PF_AreaCandidates (mins, maxs, true);
+
+	chain = (edict_t *)sv.edicts;
+	for (i=0 ; i<count ; i++)
+	{
+		ent = sv.arealist[i];
+		if (ent == sv.edicts || ent->free)
+			continue;
+		if (ent->v.solid == SOLID_NOT)
+			continue;
+		for (j=0 ; j<3 ; j++)
+			eorg[j] = org[j] - (ent->v.origin[j] + (ent->v.mins[j] + ent->v.maxs[j])*0.5);
+		if (Length(eorg) > rad)
+			continue;
+
+		ent->v.chain = EDICT_TO_PROG(chain);
+		chain = ent;
+	}
+
+	return chain;
+}
+
+void PF_findradius (void)
+{
+	float	*org;
+	float	rad;
+
+	org = G_VECTOR(OFS_PARM0);
+	rad = G_FLOAT(OFS_PARM1);
+
+	if (rad >= 0)
+		RETURN_EDICT(PF_FindRadiusArea (org, rad));
+	else	// a NaN radius finds everything
+		RETURN_EDICT(PF_FindRadiusScan (org, rad));
+}
+
+/*
+=================
+PF_findbox
+
+Returns a chain of the solid and trigger entities whose absmin / absmax
+touch the box, in descending entity number order like findradius
+
+findbox (mins, maxs)
+=================
+*/
+void PF_findbox (void)
+{
+	edict_t	*ent, *chain;
+	int		i, count;
+
+	count = PF_AreaCandidates (vec3_t(G_VECTOR(OFS_PARM0)), vec3_t(G_VECTOR(OFS_PARM1)), false);
+
+	chain = (edict_t *)sv.edicts;
+	for (i=0 ; i<count ; i++)
+	{
+		ent = sv.arealist[i];
+		if (ent->free || ent->v.solid == SOLID_NOT)
+			continue;
+		ent->v.chain = EDICT_TO_PROG(chain);
+		chain = ent;
+	}
+
 	RETURN_EDICT(chain);
 }
 
+/*
+=================
+PR_TimeFindRadius_f
+
+timefindradius [radius]
+Times findradius against the old full scan, adding trigger edicts scattered
+over the map between runs until the edicts run out
+=================
+*/
+#define	TIME_CALLS	1000
+
+static unsigned	pr_timeseed;
+
+static float PR_TimeRandom (float lo, float hi)
+{
+	pr_timeseed = pr_timeseed * 1103515245 + 12345;
+	return lo + (hi - lo) * ((pr_timeseed >> 8) & 0xffff) / 65535.0;
+}
+
+void PR_TimeFindRadius_f (void)
+{
+	int		i, j, add, numadded, mismatches;
+	float	rad;
+	double	start, scantime, areatime;
+	vec3_t	*orgs;
+	edict_t	**added, *e, *c1, *c2;
+
+	if (!sv.active)
+	{
+		Con_Printf ("no server running\n");
+		return;
+	}
+	rad = Cmd_Argc() > 1 ? Q_atof(Cmd_Argv(1)) : 256;
+
+	orgs = (vec3_t *)Hunk_TempAlloc (TIME_CALLS*sizeof(vec3_t) + sv.max_edicts*sizeof(edict_t *));
+	added = (edict_t **)(orgs + TIME_CALLS);
+	numadded = 0;
+	pr_timeseed = 1;
+
+	Con_Printf ("edicts  scan usec  area usec\n");
+	while (1)
+	{
+		for (i=0 ; i<TIME_CALLS ; i++)
+			for (j=0 ; j<3 ; j++)
+				orgs[i][j] = PR_TimeRandom (sv.worldmodel->mins[j], sv.worldmodel->maxs[j]);
+
+		mismatches = 0;
+		for (i=0 ; i<TIME_CALLS ; i++)
+		{
+			c1 = PF_FindRadiusScan (orgs[i].Ptr(), rad);
+			for (c2 = PF_FindRadiusArea (orgs[i].Ptr(), rad) ; c1 == c2 && c1 != sv.edicts ; )
+			{
+				c1 = PROG_TO_EDICT(c1->v.chain);
+				c2 = PROG_TO_EDICT(c2->v.chain);
+			}
+			if (c1 != c2)
+				mismatches++;
+		}
+
+		start = Sys_FloatTime ();
+		for (i=0 ; i<TIME_CALLS ; i++)
+			PF_FindRadiusScan (orgs[i].Ptr(), rad);
+		scantime = Sys_FloatTime () - start;
+
+		start = Sys_FloatTime ();
+		for (i=0 ; i<TIME_CALLS ; i++)
+			PF_FindRadiusArea (orgs[i].Ptr(), rad);
+		areatime = Sys_FloatTime () - start;
+
+		Con_Printf ("%6i  %9.2f  %9.2f\n", sv.num_edicts,
+			scantime*1000000/TIME_CALLS, areatime*1000000/TIME_CALLS);
+		if (mismatches)
+			Con_Printf ("%i chains differ\n", mismatches);
+
+	// double the edict count for the next run, keeping some spare
+		add = sv.num_edicts;
+		if (add > sv.max_edicts - 64 - sv.num_edicts)
+			add = sv.max_edicts - 64 - sv.num_edicts;
+		if (add < 64)
+			break;
+		for (i=0 ; i<add ; i++)
+		{
+			e = ED_Alloc ();
+			e->v.solid = SOLID_TRIGGER;
+			for (j=0 ; j<3 ; j++)
+			{
+				e->v.origin[j] = PR_TimeRandom (sv.worldmodel->mins[j], sv.worldmodel->maxs[j]);
+				e->v.mins[j] = -16;
+				e->v.maxs[j] = 16;
+			}
+			SV_LinkEdict (e, false);
+			added[numadded++] = e;
+		}
+	}
+
+	for (i=0 ; i<numadded ; i++)
+		ED_Free (added[i]);
+}
+
 
 /*
 =========
@@ -920,8 +1125,6 @@ void PF_dprint (void)
 	Con_DPrintf ("%s",PF_VarString(0));
 }
 
-char	pr_string_temp[128];
-
 void PF_ftos (void)
 {
 	float	v;
@@ -1023,7 +1226,7 @@ void PF_Find (void)
 }
 #else
 {
-	int		e;	
+	int		e, i;
 	int		f;
 	char	*s, *t;
 	edict_t	*ed;
@@ -1033,7 +1236,14 @@ void PF_Find (void)
 	s = G_STRING(OFS_PARM2);
 	if (!s)
 		PR_RunError ("PF_Find: bad search string");
-		
+
+	i = ED_FindString (e, f, s);
+	if (i >= 0)
+	{	// classname, targetname or target
+		RETURN_EDICT(EDICT_NUM(i));
+		return;
+	}
+
 	for (e++ ; e < sv.num_edicts ; e++)
 	{
 		ed = EDICT_NUM(e);
@@ -1107,6 +1317,7 @@ void PF_precache_model (void)
 		{
 			sv.model_precache[i] = s;
 			sv.models[i] = Mod_ForName (s, true);
+			Mod_Reference (sv.models[i]);
 			return;
 		}
 		if (!strcmp(sv.model_precache[i], s))
@@ -1588,6 +1799,7 @@ void PF_makestatic (void)
 	
 	ent = G_EDICT(OFS_PARM0);
 
+	SV_ReserveSignonSpace (14);
 	MSG_WriteByte (&sv.signon,svc_spawnstatic);
 
 	MSG_WriteByte (&sv.signon, SV_ModelIndex(pr_strings + ent->v.model));
@@ -1648,9 +1860,9 @@ void PF_changelevel (void)
 	s2 = G_STRING(OFS_PARM1);
 
 	if ((int)pr_global_struct->serverflags & (SFL_NEW_UNIT | SFL_NEW_EPISODE))
-		Cbuf_AddText (va("changelevel %s %s\n",s1, s2));
+		SV_InstanceCommand (va("changelevel %s %s\n",s1, s2));
 	else
-		Cbuf_AddText (va("changelevel2 %s %s\n",s1, s2));
+		SV_InstanceCommand (va("changelevel2 %s %s\n",s1, s2));
 #else
 	char	*s;
 
@@ -1660,7 +1872,7 @@ void PF_changelevel (void)
 	svs.changelevel_issued = true;
 	
 	s = G_STRING(OFS_PARM0);
-	Cbuf_AddText (va("changelevel %s\n",s));
+	SV_InstanceCommand (va("changelevel %s\n",s));
 #endif
 }
 
@@ -1926,7 +2138,9 @@ PF_precache_model,
 PF_precache_sound,		// precache_sound2 is different only for qcc
 PF_precache_file,
 
-PF_setspawnparms
+PF_setspawnparms,
+
+PF_findbox		// entity(vector mins, vector maxs) findbox = #79;
 };
 
 builtin_t *pr_builtins = pr_builtin;
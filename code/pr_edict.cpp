@@ -21,17 +21,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 
-dprograms_t		*progs;
-dfunction_t		*pr_functions;
-char			*pr_strings;
-ddef_t			*pr_fielddefs;
-ddef_t			*pr_globaldefs;
-dstatement_t	*pr_statements;
-globalvars_t	*pr_global_struct;
-float			*pr_globals;			// same as pr_global_struct
-int				pr_edict_size;	// in bytes
-
-unsigned short		pr_crc;
+thread_local qcvm_t	*qcvm;
 
 int		type_size[8] = {1,sizeof(string_t)/4,1,3,1,1,sizeof(func_t)/4,sizeof(void *)/4};
 
@@ -50,17 +40,8 @@ cvar_t	saved2 = {"saved2", "0", true};
 cvar_t	saved3 = {"saved3", "0", true};
 cvar_t	saved4 = {"saved4", "0", true};
 
-#define	MAX_FIELD_LEN	64
-#define GEFV_CACHESIZE	2
 #define PROGHEADER_CRC 5927
 
-typedef struct {
-	ddef_t	*pcache;
-	char	field[MAX_FIELD_LEN];
-} gefv_cache;
-
-static gefv_cache	gefvCache[GEFV_CACHESIZE] = {{NULL, ""}, {NULL, ""}};
-
 /*
 =================
 ED_ClearEdict
@@ -70,6 +51,8 @@ Sets everything to NULL
 */
 void ED_ClearEdict (edict_t *e)
 {
+	SV_WakeEdict (e);
+	ED_Reindex (e);
 	memset (&e->v, 0, progs->entityfields * 4);
 	e->free = false;
 }
@@ -83,32 +66,38 @@ Try to avoid reusing an entity that was recently freed, because it
 can cause the client to think the entity morphed into something else
 instead of being removed and recreated, which can cause interpolated
 angles and bad trails.
+
+Freed edicts are kept in sv.free_edicts in the order they were freed,
+so only the oldest one needs to be checked.
 =================
 */
 edict_t *ED_Alloc (void)
 {
-	int			i;
 	edict_t		*e;
 
-	for ( i=svs.maxclients+1 ; i<sv.num_edicts ; i++)
+	if (sv.free_edicts.next != &sv.free_edicts)
 	{
-		e = EDICT_NUM(i);
-		e->entnum = i;
+		e = EDICT_FROM_FREE(sv.free_edicts.next);
 		// the first couple seconds of server time can involve a lot of
-		// freeing and allocating, so relax the replacement policy
-		if (e->free && ( e->freetime < 2 || sv.time - e->freetime > 0.5 ) )
+		// freeing and allocating, so relax the replacement policy.
+		// if there is no room left, a recently freed edict is still
+		// better than an error
+		if (e->freetime < 2 || sv.time - e->freetime > 0.5
+		|| sv.num_edicts == sv.max_edicts)
 		{
+			RemoveLink (&e->freelink);
+			e->freelink.prev = e->freelink.next = NULL;
 			ED_ClearEdict (e);
 			return e;
 		}
 	}
 	
-	if (i == MAX_EDICTS)
-		Sys_Error ("ED_Alloc: no free edicts");
+	if (sv.num_edicts == sv.max_edicts)
+		Sys_Error ("ED_Alloc: no free edicts (-maxedicts %i)", sv.max_edicts);
 		
+	e = EDICT_NUM(sv.num_edicts);
+	e->entnum = sv.num_edicts;
 	sv.num_edicts++;
-	e = EDICT_NUM(i);
-	e->entnum = i;
 	ED_ClearEdict (e);
 
 	return e;
@@ -125,6 +114,8 @@ FIXME: walk all entities and NULL out references to this entity
 void ED_Free (edict_t *ed)
 {
 	SV_UnlinkEdict (ed);		// unlink from world bsp
+	SV_WakeEdict (ed);
+	ED_Reindex (ed);
 
 	ed->free = true;
 	ed->v.model = 0;
@@ -139,6 +130,234 @@ void ED_Free (edict_t *ed)
 	ed->v.solid = 0;
 	
 	ed->freetime = sv.time;
+
+// client slots are never reused
+	if (ed <= EDICT_NUM(svs.maxclients))
+		return;
+	if (ed->freelink.next)
+		RemoveLink (&ed->freelink);		// freed twice, keep the list in time order
+	InsertLinkBefore (&ed->freelink, &sv.free_edicts);
+}
+
+/*
+=================
+ED_RebuildFreeList
+
+Called after edicts have been freed or reused behind ED_Alloc's back,
+like when a savegame is loaded
+=================
+*/
+void ED_RebuildFreeList (void)
+{
+	int			i;
+	edict_t		*e;
+
+	ClearLink (&sv.free_edicts);
+	for (i=0 ; i<sv.num_edicts ; i++)
+	{
+		e = EDICT_NUM(i);
+		e->freelink.prev = e->freelink.next = NULL;
+		if (i > svs.maxclients && e->free)
+			InsertLinkBefore (&e->freelink, &sv.free_edicts);
+	}
+}
+
+/*
+=================
+ED_WatchedField
+
+Called before QC writes a field with pr_fieldwatch bits
+=================
+*/
+void ED_WatchedField (edict_t *ed, int field)
+{
+	int		bits;
+
+	bits = pr_fieldwatch[field];
+	if (bits & FW_PHYS)
+		SV_WakeEdict (ed);
+	if (bits & FW_AREA)
+		SV_AreaMoved (ed);
+	if (bits & FW_FIND)
+		ED_Reindex (ed);
+	if (bits & FW_TRACE)
+		SV_TraceChanged (ed);
+}
+
+/*
+=============================================================================
+
+FIND INDEX
+
+find on classname, targetname and target hashes the string instead of
+checking every edict.  Each bucket keeps its edicts in number order, so the
+result is the same as the full scan.  Writes only mark the edict, and the
+next find brings the buckets up to date.  Free edicts and empty strings are
+not indexed.
+
+=============================================================================
+*/
+
+static unsigned PR_HashString (char *s);
+
+static int	ed_findfields[NUM_FIND_FIELDS] =
+{
+	(int)(offsetof(entvars_t, classname)/4),
+	(int)(offsetof(entvars_t, targetname)/4),
+	(int)(offsetof(entvars_t, target)/4)
+};
+
+/*
+=================
+ED_ClearFindIndex
+
+Called by SV_SpawnServer once the edicts are allocated
+=================
+*/
+void ED_ClearFindIndex (void)
+{
+	int			i;
+	findindex_t	*fi;
+
+	for (i=0, fi=sv.findindex ; i<NUM_FIND_FIELDS ; i++, fi++)
+	{
+		fi->field = ed_findfields[i];
+		fi->bucket = (int *)Hunk_AllocName (sv.max_edicts*sizeof(int), "findidx");
+		fi->next = (int *)Hunk_AllocName (sv.max_edicts*sizeof(int), "findidx");
+		fi->prev = (int *)Hunk_AllocName (sv.max_edicts*sizeof(int), "findidx");
+		memset (fi->bucket, FIND_NONE, sv.max_edicts*sizeof(int));
+		memset (fi->heads, FIND_NONE, sizeof(fi->heads));
+		memset (fi->tails, FIND_NONE, sizeof(fi->tails));
+	}
+	sv.findmarked = (byte *)Hunk_AllocName (sv.max_edicts, "findidx");
+	sv.finddirty = (int *)Hunk_AllocName (sv.max_edicts*sizeof(int), "findidx");
+	sv.numfinddirty = 0;
+}
+
+/*
+=================
+ED_Reindex
+
+The indexed strings of ed are about to change, or it is being freed
+=================
+*/
+void ED_Reindex (edict_t *ed)
+{
+	int		e;
+
+	e = NUM_FOR_EDICT(ed);
+	if (sv.findmarked[e])
+		return;
+	sv.findmarked[e] = true;
+	sv.finddirty[sv.numfinddirty++] = e;
+}
+
+static void ED_RemoveFind (findindex_t *fi, int e)
+{
+	int		b;
+
+	b = fi->bucket[e];
+	if (b == FIND_NONE)
+		return;
+	if (fi->prev[e] == FIND_NONE)
+		fi->heads[b] = fi->next[e];
+	else
+		fi->next[fi->prev[e]] = fi->next[e];
+	if (fi->next[e] == FIND_NONE)
+		fi->tails[b] = fi->prev[e];
+	else
+		fi->prev[fi->next[e]] = fi->prev[e];
+	fi->bucket[e] = FIND_NONE;
+}
+
+static void ED_InsertFind (findindex_t *fi, int e, int b)
+{
+	int		after;
+
+// edicts are mostly added in number order, so look from the end
+	for (after = fi->tails[b] ; after > e ; after = fi->prev[after])
+		;
+
+	fi->prev[e] = after;
+	if (after == FIND_NONE)
+	{
+		fi->next[e] = fi->heads[b];
+		fi->heads[b] = e;
+	}
+	else
+	{
+		fi->next[e] = fi->next[after];
+		fi->next[after] = e;
+	}
+	if (fi->next[e] == FIND_NONE)
+		fi->tails[b] = e;
+	else
+		fi->prev[fi->next[e]] = e;
+	fi->bucket[e] = b;
+}
+
+/*
+=================
+ED_UpdateFindIndex
+=================
+*/
+static void ED_UpdateFindIndex (void)
+{
+	int			i, j, e;
+	edict_t		*ed;
+	findindex_t	*fi;
+	char		*s;
+
+	for (i=0 ; i<sv.numfinddirty ; i++)
+	{
+		e = sv.finddirty[i];
+		sv.findmarked[e] = false;
+		ed = EDICT_NUM(e);
+		for (j=0, fi=sv.findindex ; j<NUM_FIND_FIELDS ; j++, fi++)
+		{
+			ED_RemoveFind (fi, e);
+			s = E_STRING(ed, fi->field);
+			if (!ed->free && *s)
+				ED_InsertFind (fi, e, PR_HashString (s) & (FIND_HASH-1));
+		}
+	}
+	sv.numfinddirty = 0;
+}
+
+/*
+=================
+ED_FindString
+=================
+*/
+int ED_FindString (int e, int field, char *s)
+{
+	int			i, b;
+	edict_t		*ed;
+	findindex_t	*fi;
+
+	for (i=0, fi=sv.findindex ; i<NUM_FIND_FIELDS ; i++, fi++)
+		if (fi->field == field)
+			break;
+	if (i == NUM_FIND_FIELDS || !*s)
+		return -1;
+
+	ED_UpdateFindIndex ();
+
+// find loops pass the last match back in, so carry on from it
+	b = PR_HashString (s) & (FIND_HASH-1);
+	if (fi->bucket[e] == b)
+		i = fi->next[e];
+	else
+		for (i = fi->heads[b] ; i != FIND_NONE && i <= e ; i = fi->next[i])
+			;
+
+	for ( ; i != FIND_NONE && i < sv.num_edicts ; i = fi->next[i])
+	{
+		ed = EDICT_NUM(i);
+		if (!strcmp (E_STRING(ed, field), s))
+			return i;
+	}
+	return 0;
 }
 
 //===========================================================================
@@ -181,6 +400,51 @@ ddef_t *ED_FieldAtOfs (int ofs)
 	return NULL;
 }
 
+/*
+============
+PR_HashString
+============
+*/
+static unsigned PR_HashString (char *s)
+{
+	unsigned	h;
+
+	h = 0;
+	while (*s)
+		h = h*31 + *(unsigned char *)s++;
+	return h;
+}
+
+/*
+============
+PR_BuildHash
+
+Chains keep the lowest index first, so lookups find the same def or
+function the old linear scans did when names are duplicated
+============
+*/
+static void PR_BuildHash (prhash_t *hash, int count, int *names, int stride, char *name)
+{
+	int		size;
+	int		i, h;
+
+	for (size=16 ; size < count*2 ; size<<=1)
+		;
+	hash->mask = size - 1;
+	hash->heads = (int *)Hunk_AllocName (size * sizeof(int), name);
+	hash->next = (int *)Hunk_AllocName ((count ? count : 1) * sizeof(int), name);
+
+	for (i=0 ; i<size ; i++)
+		hash->heads[i] = -1;
+
+	for (i=count-1 ; i>=0 ; i--)
+	{
+		h = PR_HashString (pr_strings + *(int *)((byte *)names + i*stride)) & hash->mask;
+		hash->next[i] = hash->heads[h];
+		hash->heads[h] = i;
+	}
+}
+
 /*
 ============
 ED_FindField
@@ -189,9 +453,11 @@ ED_FindField
 ddef_t *ED_FindField (char *name)
 {
 	ddef_t		*def;
+	prhash_t	*hash;
 	int			i;
 	
-	for (i=0 ; i<progs->numfielddefs ; i++)
+	hash = &qcvm->fieldhash;
+	for (i=hash->heads[PR_HashString(name) & hash->mask] ; i != -1 ; i=hash->next[i])
 	{
 		def = &pr_fielddefs[i];
 		if (!strcmp(pr_strings + def->s_name,name) )
@@ -209,9 +475,11 @@ ED_FindGlobal
 ddef_t *ED_FindGlobal (char *name)
 {
 	ddef_t		*def;
+	prhash_t	*hash;
 	int			i;
 	
-	for (i=0 ; i<progs->numglobaldefs ; i++)
+	hash = &qcvm->globalhash;
+	for (i=hash->heads[PR_HashString(name) & hash->mask] ; i != -1 ; i=hash->next[i])
 	{
 		def = &pr_globaldefs[i];
 		if (!strcmp(pr_strings + def->s_name,name) )
@@ -229,9 +497,11 @@ ED_FindFunction
 dfunction_t *ED_FindFunction (char *name)
 {
 	dfunction_t		*func;
-	int				i;
+	prhash_t	*hash;
+	int			i;
 	
-	for (i=0 ; i<progs->numfunctions ; i++)
+	hash = &qcvm->functionhash;
+	for (i=hash->heads[PR_HashString(name) & hash->mask] ; i != -1 ; i=hash->next[i])
 	{
 		func = &pr_functions[i];
 		if (!strcmp(pr_strings + func->s_name,name) )
@@ -243,29 +513,9 @@ dfunction_t *ED_FindFunction (char *name)
 
 eval_t *GetEdictFieldValue(edict_t *ed, char *field)
 {
-	ddef_t			*def = NULL;
-	int				i;
-	static int		rep = 0;
-
-	for (i=0 ; i<GEFV_CACHESIZE ; i++)
-	{
-		if (!strcmp(field, gefvCache[i].field))
-		{
-			def = gefvCache[i].pcache;
-			goto Done;
-		}
-	}
+	ddef_t			*def;
 
 	def = ED_FindField (field);
-
-	if (strlen(field) < MAX_FIELD_LEN)
-	{
-		gefvCache[rep].pcache = def;
-		strcpy (gefvCache[rep].field, field);
-		rep ^= 1;
-	}
-
-Done:
 	if (!def)
 		return NULL;
 
@@ -720,6 +970,26 @@ char *ED_NewString (char *string)
 }
 
 
+/*
+=============
+ED_EngineString
+
+Returns a string_t for engine owned text such as sv.name.  Static
+buffers can sit further than an int offset away from pr_strings on
+64 bit hosts, so the text is copied onto the hunk next to the progs.
+=============
+*/
+string_t ED_EngineString (char *string)
+{
+	char	*_new;
+
+	_new = (char *)Hunk_Alloc (strlen(string) + 1);
+	strcpy (_new, string);
+
+	return _new - pr_strings;
+}
+
+
 /*
 =============
 ED_ParseEval
@@ -812,6 +1082,10 @@ char *ED_ParseEdict (char *data, edict_t *ent)
 
 	init = false;
 
+	SV_WakeEdict (ent);
+	SV_AreaMoved (ent);
+	ED_Reindex (ent);
+
 // clear it
 	if (ent != sv.edicts)	// hack
 		memset (&ent->v, 0, progs->entityfields * 4);
@@ -973,7 +1247,7 @@ void ED_LoadFromFile (char *data)
 		}
 
 		pr_global_struct->self = EDICT_TO_PROG(ent);
-		PR_ExecuteProgram (func - pr_functions);
+		PR_ExecuteProgram (sv.qcvm, func - pr_functions);
 	}	
 
 	Con_DPrintf ("%i entities inhibited\n", inhibit);
@@ -985,13 +1259,11 @@ void ED_LoadFromFile (char *data)
 PR_LoadProgs
 ===============
 */
-void PR_LoadProgs (void)
+void PR_LoadProgs (qcvm_t *vm)
 {
 	int		i;
 
-// flush the non-C variable lookup cache
-	for (i=0 ; i<GEFV_CACHESIZE ; i++)
-		gefvCache[i].field[0] = 0;
+	qcvm = vm;
 
 	CRC_Init (&pr_crc);
 
@@ -1022,6 +1294,7 @@ void PR_LoadProgs (void)
 	pr_globals = (float *)pr_global_struct;
 	
 	pr_edict_size = progs->entityfields * 4 + sizeof (edict_t) - sizeof(entvars_t);
+	pr_edict_size = (pr_edict_size + CACHE_SIZE-1) & ~(CACHE_SIZE-1);
 	
 // byte swap the lumps
 	for (i=0 ; i<progs->numstatements ; i++)
@@ -1060,6 +1333,29 @@ void PR_LoadProgs (void)
 
 	for (i=0 ; i<progs->numglobals ; i++)
 		((int *)pr_globals)[i] = LittleLong (((int *)pr_globals)[i]);
+
+// ftos/vtos/etos results are handed back to QC as string_t offsets
+	pr_string_temp = (char *)Hunk_AllocName (PR_STRING_TEMP, "strtemp");
+
+	PR_BuildHash (&qcvm->fieldhash, progs->numfielddefs, &pr_fielddefs->s_name, sizeof(ddef_t), "fieldhash");
+	PR_BuildHash (&qcvm->globalhash, progs->numglobaldefs, &pr_globaldefs->s_name, sizeof(ddef_t), "globhash");
+	PR_BuildHash (&qcvm->functionhash, progs->numfunctions, &pr_functions->s_name, sizeof(dfunction_t), "funchash");
+
+	pr_fieldwatch = (byte *)Hunk_AllocName (progs->entityfields, "fieldwat");
+	for (i=0 ; i<progs->entityfields ; i++)
+	{
+		if (PHYS_FIELD(i))
+			pr_fieldwatch[i] |= FW_PHYS;
+		if (AREA_FIELD(i))
+			pr_fieldwatch[i] |= FW_AREA;
+		if (TRACE_FIELD(i))
+			pr_fieldwatch[i] |= FW_TRACE;
+	}
+	for (i=0 ; i<NUM_FIND_FIELDS ; i++)
+		pr_fieldwatch[ed_findfields[i]] |= FW_FIND;
+
+	PR_DecodeProgs ();
+	PR_LoadNative ();
 }
 
 
@@ -1074,6 +1370,11 @@ void PR_Init (void)
 	Cmd_AddCommand ("edicts", ED_PrintEdicts);
 	Cmd_AddCommand ("edictcount", ED_Count);
 	Cmd_AddCommand ("profile", PR_Profile_f);
+	Cmd_AddCommand ("pr_threadcheck", PR_ThreadCheck_f);
+	Cvar_RegisterVariable (&pr_profile);
+	Cmd_AddCommand ("pr_writenative", PR_WriteNative_f);
+	Cmd_AddCommand ("timefindradius", PR_TimeFindRadius_f);
+	Cvar_RegisterVariable (&pr_native);
 	Cvar_RegisterVariable (&nomonsters);
 	Cvar_RegisterVariable (&gamecfg);
 	Cvar_RegisterVariable (&scratch1);
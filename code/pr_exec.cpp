@@ -25,27 +25,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
-typedef struct
-{
-	int				s;
-	dfunction_t		*f;
-} prstack_t;
-
-#define	MAX_STACK_DEPTH		32
-prstack_t	pr_stack[MAX_STACK_DEPTH];
-int			pr_depth;
-
-#define	LOCALSTACK_SIZE		2048
-int			localstack[LOCALSTACK_SIZE];
-int			localstack_used;
-
-
-qboolean	pr_trace;
-dfunction_t	*pr_xfunction;
-int			pr_xstatement;
-
-
-int		pr_argc;
+cvar_t	pr_profile = {"pr_profile", "0"};	// count statements for the profile command
 
 char *pr_opnames[] =
 {
@@ -226,6 +206,9 @@ void PR_Profile_f (void)
 	int			num;
 	int			i;
 	
+	if (!pr_profile.value)
+		Con_Printf ("pr_profile is 0, statements are not being counted\n");
+
 	num = 0;	
 	do
 	{
@@ -293,22 +276,27 @@ Returns the _new program statement counter
 */
 int PR_EnterFunction (dfunction_t *f)
 {
+	qcvm_t	*vm;
+	int		*globals;
 	int		i, j, c, o;
 
-	pr_stack[pr_depth].s = pr_xstatement;
-	pr_stack[pr_depth].f = pr_xfunction;	
-	pr_depth++;
-	if (pr_depth >= MAX_STACK_DEPTH)
+	vm = qcvm;
+	globals = (int *)vm->globals;
+
+	vm->stack[vm->depth].s = vm->xstatement;
+	vm->stack[vm->depth].f = vm->xfunction;	
+	vm->depth++;
+	if (vm->depth >= MAX_STACK_DEPTH)
 		PR_RunError ("stack overflow");
 
 // save off any locals that the _new function steps on
 	c = f->locals;
-	if (localstack_used + c > LOCALSTACK_SIZE)
+	if (vm->localstack_used + c > LOCALSTACK_SIZE)
 		PR_RunError ("PR_ExecuteProgram: locals stack overflow\n");
 
 	for (i=0 ; i < c ; i++)
-		localstack[localstack_used+i] = ((int *)pr_globals)[f->parm_start + i];
-	localstack_used += c;
+		vm->localstack[vm->localstack_used+i] = globals[f->parm_start + i];
+	vm->localstack_used += c;
 
 // copy parameters
 	o = f->parm_start;
@@ -316,12 +304,12 @@ int PR_EnterFunction (dfunction_t *f)
 	{
 		for (j=0 ; j<f->parm_size[i] ; j++)
 		{
-			((int *)pr_globals)[o] = ((int *)pr_globals)[OFS_PARM0+i*3+j];
+			globals[o] = globals[OFS_PARM0+i*3+j];
 			o++;
 		}
 	}
 
-	pr_xfunction = f;
+	vm->xfunction = f;
 	return f->first_statement - 1;	// offset the s++
 }
 
@@ -332,61 +320,48 @@ PR_LeaveFunction
 */
 int PR_LeaveFunction (void)
 {
+	qcvm_t	*vm;
 	int		i, c;
 
-	if (pr_depth <= 0)
+	vm = qcvm;
+	if (vm->depth <= 0)
 		Sys_Error ("prog stack underflow");
 
 // restore locals from the stack
-	c = pr_xfunction->locals;
-	localstack_used -= c;
-	if (localstack_used < 0)
+	c = vm->xfunction->locals;
+	vm->localstack_used -= c;
+	if (vm->localstack_used < 0)
 		PR_RunError ("PR_ExecuteProgram: locals stack underflow\n");
 
 	for (i=0 ; i < c ; i++)
-		((int *)pr_globals)[pr_xfunction->parm_start + i] = localstack[localstack_used+i];
+		((int *)vm->globals)[vm->xfunction->parm_start + i] = vm->localstack[vm->localstack_used+i];
 
 // up stack
-	pr_depth--;
-	pr_xfunction = pr_stack[pr_depth].f;
-	return pr_stack[pr_depth].s;
+	vm->depth--;
+	vm->xfunction = vm->stack[vm->depth].f;
+	return vm->stack[vm->depth].s;
 }
 
 
 /*
 ====================
-PR_ExecuteProgram
+PR_ExecuteTraced
+
+The reference interpreter, run over the raw statements.  It is only used
+when pr_profile is set or a builtin has turned on tracing, because it pays
+for the profile count and trace check on every statement.  Execution
+continues after statement s.
 ====================
 */
-void PR_ExecuteProgram (func_t fnum)
+void PR_ExecuteTraced (int s, int exitdepth, int runaway)
 {
 	eval_t	*a, *b, *c;
-	int			s;
 	dstatement_t	*st;
-	dfunction_t	*f, *newf;
-	int		runaway;
+	dfunction_t	*newf;
 	int		i;
 	edict_t	*ed;
-	int		exitdepth;
 	eval_t	*ptr;
 
-	if (!fnum || fnum >= progs->numfunctions)
-	{
-		if (pr_global_struct->self)
-			ED_Print (PROG_TO_EDICT(pr_global_struct->self));
-		Host_Error ("PR_ExecuteProgram: NULL function");
-	}
-	
-	f = &pr_functions[fnum];
-
-	runaway = 100000;
-	pr_trace = false;
-
-// make a stack frame
-	exitdepth = pr_depth;
-
-	s = PR_EnterFunction (f);
-	
 while (1)
 {
 	s++;	// next statement
@@ -565,6 +540,8 @@ while (1)
 #endif
 		if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
 			PR_RunError ("assignment to world entity");
+		if ((unsigned)b->_int < (unsigned)progs->entityfields && pr_fieldwatch[b->_int])
+			ED_WatchedField (ed, b->_int);
 		c->_int = (byte *)((int *)&ed->v + b->_int) - (byte *)sv.edicts;
 		break;
 		
@@ -648,6 +625,7 @@ while (1)
 		
 	case OP_STATE:
 		ed = PROG_TO_EDICT(pr_global_struct->self);
+		SV_WakeEdict (ed);
 #ifdef FPS_20
 		ed->v.nextthink = pr_global_struct->time + 0.05;
 #else
@@ -666,3 +644,649 @@ while (1)
 }
 
 }
+
+
+/*
+============================================================================
+Threaded interpreter
+
+PR_DecodeProgs turns the statements into prstatement_t with the operands
+resolved to global pointers and the branch targets to statements, so the
+main loop does no address arithmetic.  With gcc the opcodes are dispatched
+by jumping straight to the label stored in each statement; other compilers
+switch on the opcode.
+============================================================================
+*/
+
+#if defined(__GNUC__)
+#define	PR_THREADED		// labels as values
+#endif
+
+#ifdef PR_THREADED
+#define	OPCODE(op)		op_##op:
+#define	DISPATCH()		goto *st->handler
+#else
+#define	OPCODE(op)		case op:
+#define	DISPATCH()		continue
+#endif
+
+#define	NEXT(n)										\
+	{												\
+		if (!--runaway)								\
+		{											\
+			vm->xstatement = st - vm->code;			\
+			PR_RunError ("runaway loop error");		\
+		}											\
+		st = (n);									\
+		DISPATCH ();								\
+	}
+
+/*
+====================
+PR_ExecuteThreaded
+
+Execution continues after statement s.  A negative s only links the opcode
+labels into pr_code.
+====================
+*/
+static void PR_ExecuteThreaded (int s, int exitdepth)
+{
+	qcvm_t	*vm;
+	prstatement_t	*st;
+	dfunction_t	*newf;
+	int		runaway;
+	int		i;
+	edict_t	*ed;
+	eval_t	*ptr;
+
+#ifdef PR_THREADED
+	static void	*oplabels[] =
+	{
+		&&op_OP_DONE,
+		&&op_OP_MUL_F, &&op_OP_MUL_V, &&op_OP_MUL_FV, &&op_OP_MUL_VF,
+		&&op_OP_DIV_F,
+		&&op_OP_ADD_F, &&op_OP_ADD_V,
+		&&op_OP_SUB_F, &&op_OP_SUB_V,
+
+		&&op_OP_EQ_F, &&op_OP_EQ_V, &&op_OP_EQ_S, &&op_OP_EQ_E, &&op_OP_EQ_FNC,
+
+		&&op_OP_NE_F, &&op_OP_NE_V, &&op_OP_NE_S, &&op_OP_NE_E, &&op_OP_NE_FNC,
+
+		&&op_OP_LE, &&op_OP_GE, &&op_OP_LT, &&op_OP_GT,
+
+		&&op_OP_LOAD_F, &&op_OP_LOAD_V, &&op_OP_LOAD_S, &&op_OP_LOAD_ENT,
+		&&op_OP_LOAD_FLD, &&op_OP_LOAD_FNC,
+
+		&&op_OP_ADDRESS,
+
+		&&op_OP_STORE_F, &&op_OP_STORE_V, &&op_OP_STORE_S, &&op_OP_STORE_ENT,
+		&&op_OP_STORE_FLD, &&op_OP_STORE_FNC,
+
+		&&op_OP_STOREP_F, &&op_OP_STOREP_V, &&op_OP_STOREP_S, &&op_OP_STOREP_ENT,
+		&&op_OP_STOREP_FLD, &&op_OP_STOREP_FNC,
+
+		&&op_OP_RETURN,
+		&&op_OP_NOT_F, &&op_OP_NOT_V, &&op_OP_NOT_S, &&op_OP_NOT_ENT, &&op_OP_NOT_FNC,
+		&&op_OP_IF, &&op_OP_IFNOT,
+		&&op_OP_CALL0, &&op_OP_CALL1, &&op_OP_CALL2, &&op_OP_CALL3, &&op_OP_CALL4,
+		&&op_OP_CALL5, &&op_OP_CALL6, &&op_OP_CALL7, &&op_OP_CALL8,
+		&&op_OP_STATE,
+		&&op_OP_GOTO,
+		&&op_OP_AND, &&op_OP_OR,
+
+		&&op_OP_BITAND, &&op_OP_BITOR
+	};
+
+	if (s < 0)
+	{
+		for (i=0 ; i<progs->numstatements ; i++)
+		{
+			if ((unsigned)pr_code[i].op < sizeof(oplabels)/sizeof(oplabels[0]))
+				pr_code[i].handler = oplabels[pr_code[i].op];
+			else
+				pr_code[i].handler = &&op_bad;
+		}
+		return;
+	}
+#else
+	if (s < 0)
+		return;
+#endif
+
+	vm = qcvm;		// stays current until this returns
+	st = vm->code + s + 1;
+	runaway = 100000 - 1;	// the first statement
+
+#ifdef PR_THREADED
+	DISPATCH ();
+#else
+while (1)
+{
+	switch (st->op)
+	{
+#endif
+
+	OPCODE(OP_ADD_F)
+		st->c->_float = st->a->_float + st->b->_float;
+		NEXT(st + 1);
+	OPCODE(OP_ADD_V)
+		st->c->vector[0] = st->a->vector[0] + st->b->vector[0];
+		st->c->vector[1] = st->a->vector[1] + st->b->vector[1];
+		st->c->vector[2] = st->a->vector[2] + st->b->vector[2];
+		NEXT(st + 1);
+
+	OPCODE(OP_SUB_F)
+		st->c->_float = st->a->_float - st->b->_float;
+		NEXT(st + 1);
+	OPCODE(OP_SUB_V)
+		st->c->vector[0] = st->a->vector[0] - st->b->vector[0];
+		st->c->vector[1] = st->a->vector[1] - st->b->vector[1];
+		st->c->vector[2] = st->a->vector[2] - st->b->vector[2];
+		NEXT(st + 1);
+
+	OPCODE(OP_MUL_F)
+		st->c->_float = st->a->_float * st->b->_float;
+		NEXT(st + 1);
+	OPCODE(OP_MUL_V)
+		st->c->_float = st->a->vector[0]*st->b->vector[0]
+				+ st->a->vector[1]*st->b->vector[1]
+				+ st->a->vector[2]*st->b->vector[2];
+		NEXT(st + 1);
+	OPCODE(OP_MUL_FV)
+		st->c->vector[0] = st->a->_float * st->b->vector[0];
+		st->c->vector[1] = st->a->_float * st->b->vector[1];
+		st->c->vector[2] = st->a->_float * st->b->vector[2];
+		NEXT(st + 1);
+	OPCODE(OP_MUL_VF)
+		st->c->vector[0] = st->b->_float * st->a->vector[0];
+		st->c->vector[1] = st->b->_float * st->a->vector[1];
+		st->c->vector[2] = st->b->_float * st->a->vector[2];
+		NEXT(st + 1);
+
+	OPCODE(OP_DIV_F)
+		st->c->_float = st->a->_float / st->b->_float;
+		NEXT(st + 1);
+
+	OPCODE(OP_BITAND)
+		st->c->_float = (int)st->a->_float & (int)st->b->_float;
+		NEXT(st + 1);
+
+	OPCODE(OP_BITOR)
+		st->c->_float = (int)st->a->_float | (int)st->b->_float;
+		NEXT(st + 1);
+
+	OPCODE(OP_GE)
+		st->c->_float = st->a->_float >= st->b->_float;
+		NEXT(st + 1);
+	OPCODE(OP_LE)
+		st->c->_float = st->a->_float <= st->b->_float;
+		NEXT(st + 1);
+	OPCODE(OP_GT)
+		st->c->_float = st->a->_float > st->b->_float;
+		NEXT(st + 1);
+	OPCODE(OP_LT)
+		st->c->_float = st->a->_float < st->b->_float;
+		NEXT(st + 1);
+	OPCODE(OP_AND)
+		st->c->_float = st->a->_float && st->b->_float;
+		NEXT(st + 1);
+	OPCODE(OP_OR)
+		st->c->_float = st->a->_float || st->b->_float;
+		NEXT(st + 1);
+
+	OPCODE(OP_NOT_F)
+		st->c->_float = !st->a->_float;
+		NEXT(st + 1);
+	OPCODE(OP_NOT_V)
+		st->c->_float = !st->a->vector[0] && !st->a->vector[1] && !st->a->vector[2];
+		NEXT(st + 1);
+	OPCODE(OP_NOT_S)
+		st->c->_float = !st->a->string || !vm->strings[st->a->string];
+		NEXT(st + 1);
+	OPCODE(OP_NOT_FNC)
+		st->c->_float = !st->a->function;
+		NEXT(st + 1);
+	OPCODE(OP_NOT_ENT)
+		st->c->_float = (PROG_TO_EDICT(st->a->edict) == sv.edicts);
+		NEXT(st + 1);
+
+	OPCODE(OP_EQ_F)
+		st->c->_float = st->a->_float == st->b->_float;
+		NEXT(st + 1);
+	OPCODE(OP_EQ_V)
+		st->c->_float = (st->a->vector[0] == st->b->vector[0]) &&
+					(st->a->vector[1] == st->b->vector[1]) &&
+					(st->a->vector[2] == st->b->vector[2]);
+		NEXT(st + 1);
+	OPCODE(OP_EQ_S)
+		st->c->_float = !strcmp(vm->strings+st->a->string,vm->strings+st->b->string);
+		NEXT(st + 1);
+	OPCODE(OP_EQ_E)
+		st->c->_float = st->a->_int == st->b->_int;
+		NEXT(st + 1);
+	OPCODE(OP_EQ_FNC)
+		st->c->_float = st->a->function == st->b->function;
+		NEXT(st + 1);
+
+	OPCODE(OP_NE_F)
+		st->c->_float = st->a->_float != st->b->_float;
+		NEXT(st + 1);
+	OPCODE(OP_NE_V)
+		st->c->_float = (st->a->vector[0] != st->b->vector[0]) ||
+					(st->a->vector[1] != st->b->vector[1]) ||
+					(st->a->vector[2] != st->b->vector[2]);
+		NEXT(st + 1);
+	OPCODE(OP_NE_S)
+		st->c->_float = strcmp(vm->strings+st->a->string,vm->strings+st->b->string);
+		NEXT(st + 1);
+	OPCODE(OP_NE_E)
+		st->c->_float = st->a->_int != st->b->_int;
+		NEXT(st + 1);
+	OPCODE(OP_NE_FNC)
+		st->c->_float = st->a->function != st->b->function;
+		NEXT(st + 1);
+
+//==================
+	OPCODE(OP_STORE_F)
+	OPCODE(OP_STORE_ENT)
+	OPCODE(OP_STORE_FLD)		// integers
+	OPCODE(OP_STORE_S)
+	OPCODE(OP_STORE_FNC)		// pointers
+		st->b->_int = st->a->_int;
+		NEXT(st + 1);
+	OPCODE(OP_STORE_V)
+		st->b->vector[0] = st->a->vector[0];
+		st->b->vector[1] = st->a->vector[1];
+		st->b->vector[2] = st->a->vector[2];
+		NEXT(st + 1);
+
+	OPCODE(OP_STOREP_F)
+	OPCODE(OP_STOREP_ENT)
+	OPCODE(OP_STOREP_FLD)		// integers
+	OPCODE(OP_STOREP_S)
+	OPCODE(OP_STOREP_FNC)		// pointers
+		ptr = (eval_t *)((byte *)sv.edicts + st->b->_int);
+		ptr->_int = st->a->_int;
+		NEXT(st + 1);
+	OPCODE(OP_STOREP_V)
+		ptr = (eval_t *)((byte *)sv.edicts + st->b->_int);
+		ptr->vector[0] = st->a->vector[0];
+		ptr->vector[1] = st->a->vector[1];
+		ptr->vector[2] = st->a->vector[2];
+		NEXT(st + 1);
+
+	OPCODE(OP_ADDRESS)
+		ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);		// make sure it's in range
+#endif
+		if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		{
+			vm->xstatement = st - vm->code;
+			PR_RunError ("assignment to world entity");
+		}
+		if ((unsigned)st->b->_int < (unsigned)vm->header->entityfields && vm->fieldwatch[st->b->_int])
+			ED_WatchedField (ed, st->b->_int);
+		st->c->_int = (byte *)((int *)&ed->v + st->b->_int) - (byte *)sv.edicts;
+		NEXT(st + 1);
+
+	OPCODE(OP_LOAD_F)
+	OPCODE(OP_LOAD_FLD)
+	OPCODE(OP_LOAD_ENT)
+	OPCODE(OP_LOAD_S)
+	OPCODE(OP_LOAD_FNC)
+		ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);		// make sure it's in range
+#endif
+		ptr = (eval_t *)((int *)&ed->v + st->b->_int);
+		st->c->_int = ptr->_int;
+		NEXT(st + 1);
+
+	OPCODE(OP_LOAD_V)
+		ed = PROG_TO_EDICT(st->a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);		// make sure it's in range
+#endif
+		ptr = (eval_t *)((int *)&ed->v + st->b->_int);
+		st->c->vector[0] = ptr->vector[0];
+		st->c->vector[1] = ptr->vector[1];
+		st->c->vector[2] = ptr->vector[2];
+		NEXT(st + 1);
+
+//==================
+
+	OPCODE(OP_IFNOT)
+		if (!st->a->_int)
+			NEXT(st->jump);
+		NEXT(st + 1);
+
+	OPCODE(OP_IF)
+		if (st->a->_int)
+			NEXT(st->jump);
+		NEXT(st + 1);
+
+	OPCODE(OP_GOTO)
+		NEXT(st->jump);
+
+	OPCODE(OP_CALL0)
+	OPCODE(OP_CALL1)
+	OPCODE(OP_CALL2)
+	OPCODE(OP_CALL3)
+	OPCODE(OP_CALL4)
+	OPCODE(OP_CALL5)
+	OPCODE(OP_CALL6)
+	OPCODE(OP_CALL7)
+	OPCODE(OP_CALL8)
+		vm->argc = st->op - OP_CALL0;
+		vm->xstatement = st - vm->code;
+		if (!st->a->function)
+			PR_RunError ("NULL function");
+
+		newf = &vm->functions[st->a->function];
+
+		if (newf->first_statement < 0)
+		{	// negative statements are built in functions
+			i = -newf->first_statement;
+			if (i >= pr_numbuiltins)
+				PR_RunError ("Bad builtin call number");
+			pr_builtins[i] ();
+
+			if (vm->trace)
+			{	// traceon, so finish in the reference interpreter
+				PR_ExecuteTraced (st - vm->code, exitdepth, runaway);
+				return;
+			}
+			NEXT(st + 1);
+		}
+
+		NEXT(vm->code + PR_EnterFunction (newf) + 1);
+
+	OPCODE(OP_DONE)
+	OPCODE(OP_RETURN)
+		((int *)vm->globals)[OFS_RETURN] = st->a->_int;
+		((int *)vm->globals)[OFS_RETURN+1] = ((int *)st->a)[1];
+		((int *)vm->globals)[OFS_RETURN+2] = ((int *)st->a)[2];
+
+		vm->xstatement = st - vm->code;
+		s = PR_LeaveFunction ();
+		if (vm->depth == exitdepth)
+			return;		// all done
+		NEXT(vm->code + s + 1);
+
+	OPCODE(OP_STATE)
+		ed = PROG_TO_EDICT(vm->global_struct->self);
+		SV_WakeEdict (ed);
+#ifdef FPS_20
+		ed->v.nextthink = vm->global_struct->time + 0.05;
+#else
+		ed->v.nextthink = vm->global_struct->time + 0.1;
+#endif
+		if (st->a->_float != ed->v.frame)
+		{
+			ed->v.frame = st->a->_float;
+		}
+		ed->v.think = st->b->function;
+		NEXT(st + 1);
+
+#ifdef PR_THREADED
+op_bad:
+#else
+	default:
+#endif
+		vm->xstatement = st - vm->code;
+		PR_RunError ("Bad opcode %i", st->op);
+
+#ifndef PR_THREADED
+	}
+}
+#endif
+}
+
+/*
+====================
+PR_DecodeProgs
+
+Builds pr_code from the loaded statements
+====================
+*/
+void PR_DecodeProgs (void)
+{
+	int				i;
+	dstatement_t	*st;
+	prstatement_t	*ps;
+
+	pr_code = (prstatement_t *)Hunk_AllocName (progs->numstatements * sizeof(prstatement_t), "prcode");
+
+	for (i=0 ; i<progs->numstatements ; i++)
+	{
+		st = &pr_statements[i];
+		ps = &pr_code[i];
+
+		ps->op = st->op;
+		ps->a = (eval_t *)&pr_globals[st->a];
+		ps->b = (eval_t *)&pr_globals[st->b];
+
+		switch (st->op)
+		{
+		case OP_IF:
+		case OP_IFNOT:
+			ps->jump = ps + st->b;
+			break;
+		case OP_GOTO:
+			ps->jump = ps + st->a;
+			break;
+		default:
+			ps->c = (eval_t *)&pr_globals[st->c];
+			break;
+		}
+	}
+
+	PR_ExecuteThreaded (-1, 0);
+}
+
+/*
+====================
+PR_ExecuteProgram
+
+Runs fnum in vm, which is current on this thread until it returns
+====================
+*/
+void PR_ExecuteProgram (qcvm_t *vm, func_t fnum)
+{
+	qcvm_t		*oldvm;
+	dfunction_t	*f;
+	int		s;
+	int		exitdepth;
+
+	oldvm = qcvm;
+	if (vm != oldvm)
+	{
+		qcvm = vm;
+		if (pr_nativefunctions)
+			PR_BindNative ();
+	}
+
+	if (!fnum || fnum >= progs->numfunctions)
+	{
+		if (pr_global_struct->self)
+			ED_Print (PROG_TO_EDICT(pr_global_struct->self));
+		Host_Error ("PR_ExecuteProgram: NULL function");
+	}
+	
+	f = &pr_functions[fnum];
+
+	pr_trace = false;
+
+// make a stack frame
+	exitdepth = pr_depth;
+
+	s = PR_EnterFunction (f);
+
+	if (pr_profile.value)
+		PR_ExecuteTraced (s, exitdepth, 100000);
+	else if (pr_nativefunctions)
+		PR_ExecuteNative (fnum, exitdepth);
+	else
+		PR_ExecuteThreaded (s, exitdepth);
+
+	if (vm != oldvm)
+	{
+		qcvm = oldvm;
+		if (qcvm && pr_nativefunctions)
+			PR_BindNative ();
+	}
+}
+
+/*
+====================
+PR_ThreadCheck_f
+
+Runs the functions of the server's progs that only do arithmetic on their
+parameters and locals in two copies of its vm, on two threads at once,
+and checks every result against running them one after another on this
+thread first.  A vm whose state leaked to the other thread gives wrong
+results, and one that reached the server's own globals changes them.
+====================
+*/
+#define	CHECK_INPUTS	8
+#define	CHECK_ROUNDS	40000
+
+static qcvm_t	pr_checkvms[2];
+static int		*pr_checkfuncs;
+static int		pr_numcheckfuncs;
+static float	*pr_checkresults;		// [function][input] return value
+static int		pr_checkerrors[2];
+
+static qboolean PR_CheckableFunction (int fnum)
+{
+	int				i, first, end;
+	prstatement_t	*st;
+
+	first = pr_functions[fnum].first_statement;
+	if (first <= 0)
+		return false;
+	end = progs->numstatements;
+	for (i=1 ; i<progs->numfunctions ; i++)
+		if (pr_functions[i].first_statement > first && pr_functions[i].first_statement < end)
+			end = pr_functions[i].first_statement;
+
+	for (i=first, st=&pr_code[first] ; i<end ; i++, st++)
+	{
+		switch (st->op)
+		{
+		case OP_LOAD_F: case OP_LOAD_V: case OP_LOAD_S: case OP_LOAD_ENT:
+		case OP_LOAD_FLD: case OP_LOAD_FNC: case OP_ADDRESS:
+		case OP_STOREP_F: case OP_STOREP_V: case OP_STOREP_S: case OP_STOREP_ENT:
+		case OP_STOREP_FLD: case OP_STOREP_FNC:
+		case OP_EQ_S: case OP_NE_S: case OP_NOT_S:
+		case OP_CALL0: case OP_CALL1: case OP_CALL2: case OP_CALL3: case OP_CALL4:
+		case OP_CALL5: case OP_CALL6: case OP_CALL7: case OP_CALL8:
+		case OP_STATE:
+			return false;
+		}
+	}
+	return true;
+}
+
+static void PR_CheckSetParms (qcvm_t *vm, int input)
+{
+	int		i;
+
+	for (i=0 ; i<MAX_PARMS*3 ; i++)
+		vm->globals[OFS_PARM0+i] = ((input*7 + i*3) % 31) - 15 + 0.25f*input;
+}
+
+static void PR_ThreadCheckWork (int work)
+{
+	int		round, i, input;
+	qcvm_t	*vm;
+	float	*result;
+
+	vm = &pr_checkvms[work];
+	for (round=0 ; round<CHECK_ROUNDS ; round++)
+	{
+		result = pr_checkresults;
+		for (i=0 ; i<pr_numcheckfuncs ; i++)
+			for (input=0 ; input<CHECK_INPUTS ; input++, result++)
+			{
+				PR_CheckSetParms (vm, input);
+				PR_ExecuteProgram (vm, pr_checkfuncs[i]);
+				if (memcmp (&vm->globals[OFS_RETURN], result, sizeof(*result)))
+					pr_checkerrors[work]++;
+			}
+	}
+}
+
+void PR_ThreadCheck_f (void)
+{
+	int		i, input, mark, changed;
+	float	*result, *saved;
+	double	start;
+	qcvm_t	*oldvm;
+
+	if (!sv.active)
+	{
+		Con_Printf ("no server running\n");
+		return;
+	}
+	if (pr_profile.value)
+	{
+		Con_Printf ("pr_profile has to be 0, it counts into the shared functions\n");
+		return;
+	}
+	if (Sys_NumThreads () < 2)
+		Con_Printf ("only one thread, run with -threads 2 or more to check anything\n");
+
+	mark = Hunk_LowMark ();
+	pr_checkfuncs = (int *)Hunk_Alloc (progs->numfunctions * sizeof(int));
+	pr_numcheckfuncs = 0;
+	for (i=1 ; i<progs->numfunctions ; i++)
+		if (PR_CheckableFunction (i))
+			pr_checkfuncs[pr_numcheckfuncs++] = i;
+	pr_checkresults = (float *)Hunk_Alloc (pr_numcheckfuncs * CHECK_INPUTS * sizeof(float));
+
+	saved = (float *)Hunk_Alloc (progs->numglobals * 4);
+	memcpy (saved, pr_globals, progs->numglobals * 4);
+
+// copies of the server's vm with globals of their own, and statements
+// decoded again to point at them
+	oldvm = qcvm;
+	for (i=0 ; i<2 ; i++)
+	{
+		pr_checkvms[i] = *sv.qcvm;
+		pr_checkvms[i].globals = (float *)Hunk_Alloc (progs->numglobals * 4);
+		memcpy (pr_checkvms[i].globals, saved, progs->numglobals * 4);
+		pr_checkvms[i].global_struct = (globalvars_t *)pr_checkvms[i].globals;
+		pr_checkvms[i].depth = 0;
+		pr_checkvms[i].localstack_used = 0;
+		pr_checkvms[i].xfunction = NULL;
+		qcvm = &pr_checkvms[i];
+		PR_DecodeProgs ();
+		if (pr_checkvms[i].nativefunctions)
+			PR_SetNativeImport (&pr_checkvms[i]);
+		pr_checkerrors[i] = 0;
+	}
+	qcvm = oldvm;
+
+	result = pr_checkresults;
+	for (i=0 ; i<pr_numcheckfuncs ; i++)
+		for (input=0 ; input<CHECK_INPUTS ; input++, result++)
+		{
+			PR_CheckSetParms (&pr_checkvms[0], input);
+			PR_ExecuteProgram (&pr_checkvms[0], pr_checkfuncs[i]);
+			*result = pr_checkvms[0].globals[OFS_RETURN];
+		}
+
+	start = Sys_FloatTime ();
+	Sys_RunThreadsOn (2, PR_ThreadCheckWork);
+	changed = 0;
+	for (i=0 ; i<progs->numglobals ; i++)
+		if (memcmp (&pr_globals[i], &saved[i], 4))
+			changed++;
+	Con_Printf ("%i functions, %i calls on each of 2 threads in %.2f s: %i wrong results, %i server globals changed\n",
+		pr_numcheckfuncs, pr_numcheckfuncs*CHECK_INPUTS*CHECK_ROUNDS, Sys_FloatTime () - start,
+		pr_checkerrors[0] + pr_checkerrors[1], changed);
+
+	Hunk_FreeToLowMark (mark);
+}
@@ -0,0 +1,768 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// pr_native.c -- progs translated ahead of time to C++
+
+/*
+
+pr_writenative translates every function in the loaded progs.dat into a C++
+function that works directly on pr_globals, with calls through constant
+function globals going straight to the builtin or translated function.
+Built into progs_native.dll / .so in the game directory, it is loaded by
+PR_LoadProgs when pr_native is set and its crc matches progs.dat.
+
+The interpreter still runs everything when pr_profile is set, and if a
+builtin turns on tracing the rest of the call is handed over to it.
+
+*/
+
+#include "quakedef.h"
+
+cvar_t	pr_native = {"pr_native", "0"};		// run progs_native if it matches
+
+/*
+============================================================================
+
+RUNTIME
+
+============================================================================
+*/
+
+static void PR_NativeEnter (int fnum)
+{
+	PR_EnterFunction (&pr_functions[fnum]);
+}
+
+static void PR_NativeLeave (void)
+{
+	PR_LeaveFunction ();
+}
+
+/*
+====================
+PR_NativeTraceon
+
+A builtin turned on tracing, so the interpreter finishes the call from the
+statement after the builtin and the translated functions unwind
+====================
+*/
+static void PR_NativeTraceon (int statement)
+{
+	qcvm->nativeunwind = true;
+	PR_ExecuteTraced (statement, qcvm->nativeexitdepth, qcvm->nativerunaway);
+}
+
+/*
+====================
+PR_NativeCall
+
+A call through a function variable.  Returns true if the caller should
+unwind.
+====================
+*/
+static int PR_NativeCall (int fnum, int argc, int statement)
+{
+	dfunction_t	*newf;
+	int			i;
+
+	pr_argc = argc;
+	pr_xstatement = statement;
+	if (!fnum)
+		PR_RunError ("NULL function");
+
+	newf = &pr_functions[fnum];
+
+	if (newf->first_statement < 0)
+	{	// negative statements are built in functions
+		i = -newf->first_statement;
+		if (i >= pr_numbuiltins)
+			PR_RunError ("Bad builtin call number");
+		pr_builtins[i] ();
+
+		if (pr_trace)
+		{
+			PR_NativeTraceon (statement);
+			return true;
+		}
+		return false;
+	}
+
+	PR_EnterFunction (newf);
+	pr_nativefunctions[fnum] ();
+	return qcvm->nativeunwind;
+}
+
+static void PR_NativeError (int statement, const char *message)
+{
+	pr_xstatement = statement;
+	PR_RunError ("%s", message);
+}
+
+static int PR_NativeWorldLocked (void)
+{
+	return sv.state == ss_active;
+}
+
+static void PR_NativeWake (int ent)
+{
+	SV_WakeEdict (PROG_TO_EDICT(ent));
+}
+
+static void PR_NativeWatched (int ent, int field)
+{
+	ED_WatchedField (PROG_TO_EDICT(ent), field);
+}
+
+/*
+====================
+PR_ExecuteNative
+
+The stack frame for fnum has already been entered
+====================
+*/
+void PR_ExecuteNative (func_t fnum, int exitdepth)
+{
+	qcvm_t	*vm;
+	int		oldexitdepth, oldrunaway;
+
+	vm = qcvm;
+	oldexitdepth = vm->nativeexitdepth;
+	oldrunaway = vm->nativerunaway;
+
+	vm->nativeexitdepth = exitdepth;
+	vm->nativerunaway = 100000;
+
+	vm->nativefunctions[fnum] ();
+
+	vm->nativeunwind = false;
+	vm->nativeexitdepth = oldexitdepth;
+	vm->nativerunaway = oldrunaway;
+}
+
+/*
+============================================================================
+
+LOADING
+
+============================================================================
+*/
+
+/*
+====================
+PR_UnloadNative
+====================
+*/
+void PR_UnloadNative (void)
+{
+	qcvm->native = NULL;
+	qcvm->nativefunctions = NULL;
+	if (qcvm->nativelib)
+		Sys_FreeLibrary (qcvm->nativelib);
+	qcvm->nativelib = NULL;
+}
+
+/*
+====================
+PR_BindNative
+
+Points the translated progs at the import of the current vm.  They keep
+the pointer per thread, so this is needed whenever a vm becomes current
+on a thread, even if it was the last one there.
+====================
+*/
+void PR_BindNative (void)
+{
+	qcvm->native->init (&qcvm->nativeimport);
+}
+
+/*
+====================
+PR_SetNativeImport
+
+Fills in what the translated progs are handed for vm.  Everything in it
+that changes points into vm.
+====================
+*/
+void PR_SetNativeImport (qcvm_t *vm)
+{
+	prnativeimport_t	*import;
+
+	import = &vm->nativeimport;
+	import->globals = vm->globals;
+	import->strings = vm->strings;
+	import->edicts = (unsigned char **)&sv.edicts;
+	import->entvars = offsetof(edict_t, v);
+	import->argc = &vm->argc;
+	import->xstatement = &vm->xstatement;
+	import->trace = &vm->trace;
+	import->unwind = &vm->nativeunwind;
+	import->runaway = &vm->nativerunaway;
+	import->builtins = pr_builtins;
+	import->enter = PR_NativeEnter;
+	import->leave = PR_NativeLeave;
+	import->call = PR_NativeCall;
+	import->traceon = PR_NativeTraceon;
+	import->error = PR_NativeError;
+	import->worldlocked = PR_NativeWorldLocked;
+	import->wake = PR_NativeWake;
+	import->fieldwatch = vm->fieldwatch;
+	import->watched = PR_NativeWatched;
+}
+
+/*
+====================
+PR_LoadNative
+
+Called by PR_LoadProgs after the statements are decoded
+====================
+*/
+void PR_LoadNative (void)
+{
+	char			name[MAX_OSPATH];
+	prnativeentry_t	entry;
+	prnativeprogs_t	*native;
+
+	PR_UnloadNative ();
+
+	if (!pr_native.value)
+		return;
+
+	if (snprintf (name, sizeof(name), "%s/%s", com_gamedir, PR_NATIVE_NAME) >= (int)sizeof(name))
+	{
+		Con_Printf ("Game directory too long for %s, interpreting progs\n", PR_NATIVE_NAME);
+		return;
+	}
+	qcvm->nativelib = Sys_LoadLibrary (name);
+	if (!qcvm->nativelib)
+	{
+		Con_Printf ("Couldn't load %s, interpreting progs\n", name);
+		return;
+	}
+
+	entry = (prnativeentry_t)Sys_GetProcAddress (qcvm->nativelib, PR_NATIVE_ENTRY);
+	native = entry ? entry () : NULL;
+	if (!native || native->version != PR_NATIVE_VERSION)
+	{
+		Con_Printf ("%s has the wrong version, interpreting progs\n", name);
+		PR_UnloadNative ();
+		return;
+	}
+
+	if (native->crc != pr_crc || native->numstatements != progs->numstatements
+	|| native->numfunctions != progs->numfunctions || native->numbuiltins > pr_numbuiltins)
+	{
+		Con_Printf ("%s doesn't match progs.dat, interpreting progs\n", name);
+		PR_UnloadNative ();
+		return;
+	}
+
+	qcvm->native = native;
+	qcvm->nativefunctions = native->functions;
+	PR_SetNativeImport (qcvm);
+	PR_BindNative ();
+
+	Con_DPrintf ("Running native progs from %s\n", name);
+}
+
+/*
+============================================================================
+
+TRANSLATION
+
+============================================================================
+*/
+
+static FILE		*nf;
+static byte		*nleader;		// statement starts a basic block
+static byte		*ntarget;		// statement is jumped to
+
+/*
+====================
+PR_NativeDirectCall
+
+Returns the function a call through global ofs will usually reach, or 0.
+Only the constant globals qcc makes for function names qualify, and the
+generated code still checks the global before taking the direct path.
+====================
+*/
+static int PR_NativeDirectCall (int ofs)
+{
+	ddef_t	*def;
+	int		fnum;
+
+	def = ED_GlobalAtOfs (ofs);
+	if (!def || (def->type & ~DEF_SAVEGLOBAL) != ev_function)
+		return 0;
+
+	fnum = ((int *)pr_globals)[ofs];
+	if (fnum <= 0 || fnum >= progs->numfunctions)
+		return 0;
+	if (strcmp (pr_strings + def->s_name, pr_strings + pr_functions[fnum].s_name))
+		return 0;
+	if (pr_functions[fnum].first_statement < 0 && -pr_functions[fnum].first_statement >= pr_numbuiltins)
+		return 0;
+
+	return fnum;
+}
+
+/*
+====================
+PR_NativeStatement
+====================
+*/
+static void PR_NativeStatement (int s, int *maxbuiltin)
+{
+	dstatement_t	*st;
+	int		a, b, c;
+	int		i, fnum;
+
+	st = &pr_statements[s];
+	a = st->a;
+	b = st->b;
+	c = st->c;
+
+	switch (st->op)
+	{
+	case OP_ADD_F:
+		fprintf (nf, "\tF(%i) = F(%i) + F(%i);\n", c, a, b);
+		break;
+	case OP_ADD_V:
+		for (i=0 ; i<3 ; i++)
+			fprintf (nf, "\tF(%i) = F(%i) + F(%i);\n", c+i, a+i, b+i);
+		break;
+
+	case OP_SUB_F:
+		fprintf (nf, "\tF(%i) = F(%i) - F(%i);\n", c, a, b);
+		break;
+	case OP_SUB_V:
+		for (i=0 ; i<3 ; i++)
+			fprintf (nf, "\tF(%i) = F(%i) - F(%i);\n", c+i, a+i, b+i);
+		break;
+
+	case OP_MUL_F:
+		fprintf (nf, "\tF(%i) = F(%i) * F(%i);\n", c, a, b);
+		break;
+	case OP_MUL_V:
+		fprintf (nf, "\tF(%i) = F(%i)*F(%i) + F(%i)*F(%i) + F(%i)*F(%i);\n", c, a, b, a+1, b+1, a+2, b+2);
+		break;
+	case OP_MUL_FV:
+		for (i=0 ; i<3 ; i++)
+			fprintf (nf, "\tF(%i) = F(%i) * F(%i);\n", c+i, a, b+i);
+		break;
+	case OP_MUL_VF:
+		for (i=0 ; i<3 ; i++)
+			fprintf (nf, "\tF(%i) = F(%i) * F(%i);\n", c+i, b, a+i);
+		break;
+
+	case OP_DIV_F:
+		fprintf (nf, "\tF(%i) = F(%i) / F(%i);\n", c, a, b);
+		break;
+
+	case OP_BITAND:
+		fprintf (nf, "\tF(%i) = (int)F(%i) & (int)F(%i);\n", c, a, b);
+		break;
+	case OP_BITOR:
+		fprintf (nf, "\tF(%i) = (int)F(%i) | (int)F(%i);\n", c, a, b);
+		break;
+
+	case OP_GE:
+		fprintf (nf, "\tF(%i) = F(%i) >= F(%i);\n", c, a, b);
+		break;
+	case OP_LE:
+		fprintf (nf, "\tF(%i) = F(%i) <= F(%i);\n", c, a, b);
+		break;
+	case OP_GT:
+		fprintf (nf, "\tF(%i) = F(%i) > F(%i);\n", c, a, b);
+		break;
+	case OP_LT:
+		fprintf (nf, "\tF(%i) = F(%i) < F(%i);\n", c, a, b);
+		break;
+	case OP_AND:
+		fprintf (nf, "\tF(%i) = F(%i) && F(%i);\n", c, a, b);
+		break;
+	case OP_OR:
+		fprintf (nf, "\tF(%i) = F(%i) || F(%i);\n", c, a, b);
+		break;
+
+	case OP_NOT_F:
+		fprintf (nf, "\tF(%i) = !F(%i);\n", c, a);
+		break;
+	case OP_NOT_V:
+		fprintf (nf, "\tF(%i) = !F(%i) && !F(%i) && !F(%i);\n", c, a, a+1, a+2);
+		break;
+	case OP_NOT_S:
+		fprintf (nf, "\tF(%i) = !I(%i) || !*S(%i);\n", c, a, a);
+		break;
+	case OP_NOT_FNC:
+	case OP_NOT_ENT:		// entity 0 is the world
+		fprintf (nf, "\tF(%i) = !I(%i);\n", c, a);
+		break;
+
+	case OP_EQ_F:
+		fprintf (nf, "\tF(%i) = F(%i) == F(%i);\n", c, a, b);
+		break;
+	case OP_EQ_V:
+		fprintf (nf, "\tF(%i) = (F(%i) == F(%i)) && (F(%i) == F(%i)) && (F(%i) == F(%i));\n", c, a, b, a+1, b+1, a+2, b+2);
+		break;
+	case OP_EQ_S:
+		fprintf (nf, "\tF(%i) = !strcmp (S(%i), S(%i));\n", c, a, b);
+		break;
+	case OP_EQ_E:
+	case OP_EQ_FNC:
+		fprintf (nf, "\tF(%i) = I(%i) == I(%i);\n", c, a, b);
+		break;
+
+	case OP_NE_F:
+		fprintf (nf, "\tF(%i) = F(%i) != F(%i);\n", c, a, b);
+		break;
+	case OP_NE_V:
+		fprintf (nf, "\tF(%i) = (F(%i) != F(%i)) || (F(%i) != F(%i)) || (F(%i) != F(%i));\n", c, a, b, a+1, b+1, a+2, b+2);
+		break;
+	case OP_NE_S:
+		fprintf (nf, "\tF(%i) = strcmp (S(%i), S(%i));\n", c, a, b);
+		break;
+	case OP_NE_E:
+	case OP_NE_FNC:
+		fprintf (nf, "\tF(%i) = I(%i) != I(%i);\n", c, a, b);
+		break;
+
+	case OP_STORE_F:
+	case OP_STORE_ENT:
+	case OP_STORE_FLD:
+	case OP_STORE_S:
+	case OP_STORE_FNC:
+		fprintf (nf, "\tI(%i) = I(%i);\n", b, a);
+		break;
+	case OP_STORE_V:
+		for (i=0 ; i<3 ; i++)
+			fprintf (nf, "\tF(%i) = F(%i);\n", b+i, a+i);
+		break;
+
+	case OP_STOREP_F:
+	case OP_STOREP_ENT:
+	case OP_STOREP_FLD:
+	case OP_STOREP_S:
+	case OP_STOREP_FNC:
+		fprintf (nf, "\tP(I(%i))[0].i = I(%i);\n", b, a);
+		break;
+	case OP_STOREP_V:
+		fprintf (nf, "\tp = P(I(%i));\n", b);
+		for (i=0 ; i<3 ; i++)
+			fprintf (nf, "\tp[%i].f = F(%i);\n", i, a+i);
+		break;
+
+	case OP_ADDRESS:
+		fprintf (nf, "\tif (!I(%i) && pr.worldlocked ())\n\t\tpr.error (%i, \"assignment to world entity\");\n", a, s);
+		fprintf (nf, "\tif ((unsigned)I(%i) < %i && pr.fieldwatch[I(%i)])\n\t\tpr.watched (I(%i), I(%i));\n",
+			b, progs->entityfields, b, a, b);
+		fprintf (nf, "\tI(%i) = I(%i) + pr.entvars + I(%i)*4;\n", c, a, b);
+		break;
+
+	case OP_LOAD_F:
+	case OP_LOAD_FLD:
+	case OP_LOAD_ENT:
+	case OP_LOAD_S:
+	case OP_LOAD_FNC:
+		fprintf (nf, "\tI(%i) = E(I(%i))[I(%i)].i;\n", c, a, b);
+		break;
+	case OP_LOAD_V:
+		fprintf (nf, "\tp = E(I(%i)) + I(%i);\n", a, b);
+		for (i=0 ; i<3 ; i++)
+			fprintf (nf, "\tF(%i) = p[%i].f;\n", c+i, i);
+		break;
+
+	case OP_IFNOT:
+		fprintf (nf, "\tif (!I(%i))\n\t\tgoto s%i;\n", a, s + b);
+		break;
+	case OP_IF:
+		fprintf (nf, "\tif (I(%i))\n\t\tgoto s%i;\n", a, s + b);
+		break;
+	case OP_GOTO:
+		fprintf (nf, "\tgoto s%i;\n", s + a);
+		break;
+
+	case OP_CALL0:
+	case OP_CALL1:
+	case OP_CALL2:
+	case OP_CALL3:
+	case OP_CALL4:
+	case OP_CALL5:
+	case OP_CALL6:
+	case OP_CALL7:
+	case OP_CALL8:
+		fnum = PR_NativeDirectCall (a);
+		if (fnum)
+		{
+			fprintf (nf, "\tif (I(%i) == %i)\n\t{\t// %s\n", a, fnum, pr_strings + pr_functions[fnum].s_name);
+			fprintf (nf, "\t\t*pr.argc = %i;\n\t\t*pr.xstatement = %i;\n", st->op - OP_CALL0, s);
+			if (pr_functions[fnum].first_statement < 0)
+			{
+				i = -pr_functions[fnum].first_statement;
+				if (i + 1 > *maxbuiltin)
+					*maxbuiltin = i + 1;
+				fprintf (nf, "\t\tpr.builtins[%i] ();\n", i);
+				fprintf (nf, "\t\tif (*pr.trace)\n\t\t{\n\t\t\tpr.traceon (%i);\n\t\t\treturn;\n\t\t}\n", s);
+			}
+			else
+			{
+				fprintf (nf, "\t\tpr.enter (%i);\n\t\tqf_%i ();\n", fnum, fnum);
+				fprintf (nf, "\t\tif (*pr.unwind)\n\t\t\treturn;\n");
+			}
+			fprintf (nf, "\t}\n\telse ");
+		}
+		else
+			fprintf (nf, "\t");
+		fprintf (nf, "if (pr.call (I(%i), %i, %i))\n\t\treturn;\n", a, st->op - OP_CALL0, s);
+		break;
+
+	case OP_DONE:
+	case OP_RETURN:
+		for (i=0 ; i<3 ; i++)
+			fprintf (nf, "\tI(%i) = I(%i);\n", OFS_RETURN+i, a+i);
+		fprintf (nf, "\tpr.leave ();\n\treturn;\n");
+		break;
+
+	case OP_STATE:
+		fprintf (nf, "\tpr.wake (I(%i));\n", (int)(&pr_global_struct->self - (int *)pr_globals));
+		fprintf (nf, "\tp = E(I(%i));\n", (int)(&pr_global_struct->self - (int *)pr_globals));
+#ifdef FPS_20
+		fprintf (nf, "\tp[%i].f = F(%i) + 0.05;\n", (int)(offsetof(entvars_t, nextthink)/4), (int)(&pr_global_struct->time - pr_globals));
+#else
+		fprintf (nf, "\tp[%i].f = F(%i) + 0.1;\n", (int)(offsetof(entvars_t, nextthink)/4), (int)(&pr_global_struct->time - pr_globals));
+#endif
+		fprintf (nf, "\tif (F(%i) != p[%i].f)\n\t\tp[%i].f = F(%i);\n", a, (int)(offsetof(entvars_t, frame)/4), (int)(offsetof(entvars_t, frame)/4), a);
+		fprintf (nf, "\tp[%i].i = I(%i);\n", (int)(offsetof(entvars_t, think)/4), b);
+		break;
+
+	default:
+		fprintf (nf, "\tpr.error (%i, \"Bad opcode %i\");\n", s, st->op);
+		break;
+	}
+}
+
+/*
+====================
+PR_NativeFunction
+
+Translates statements first to end-1, or returns false
+====================
+*/
+static qboolean PR_NativeFunction (int fnum, int first, int end, int *maxbuiltin)
+{
+	dfunction_t		*f;
+	dstatement_t	*st;
+	int		s, target, next;
+
+	f = &pr_functions[fnum];
+
+// find the basic blocks
+	for (s=first ; s<end ; s++)
+	{
+		st = &pr_statements[s];
+		switch (st->op)
+		{
+		case OP_IF:
+		case OP_IFNOT:
+			target = s + st->b;
+			break;
+		case OP_GOTO:
+			target = s + st->a;
+			break;
+		case OP_DONE:
+		case OP_RETURN:
+			target = -1;
+			break;
+		default:
+			continue;
+		}
+
+		if (target != -1)
+		{
+			if (target < first || target >= end)
+			{
+				Con_Printf ("%s: branch out of the function\n", pr_strings + f->s_name);
+				return false;
+			}
+			ntarget[target] = nleader[target] = true;
+		}
+		if (s + 1 < end)
+			nleader[s+1] = true;
+	}
+	nleader[first] = true;
+
+	st = &pr_statements[end-1];
+	if (st->op != OP_DONE && st->op != OP_RETURN && st->op != OP_GOTO)
+	{
+		Con_Printf ("%s: doesn't end with a return\n", pr_strings + f->s_name);
+		return false;
+	}
+
+	fprintf (nf, "\n// %s : %s\n", pr_strings + f->s_file, pr_strings + f->s_name);
+	fprintf (nf, "static void qf_%i (void)\n{\n\tprnativeimport_t\t&pr = *pr_import;\n\tpeval_t\t*p;\n\n", fnum);
+
+	for (s=first ; s<end ; s++)
+	{
+		if (ntarget[s])
+			fprintf (nf, "s%i:\n", s);
+		if (nleader[s])
+		{
+			for (next=s+1 ; next<end && !nleader[next] ; next++)
+				;
+			fprintf (nf, "\tRUNAWAY(%i, %i);\n", next - s, s);
+		}
+		PR_NativeStatement (s, maxbuiltin);
+	}
+
+	fprintf (nf, "}\n");
+	return true;
+}
+
+/*
+====================
+PR_WriteNative_f
+
+pr_writenative [filename]
+====================
+*/
+void PR_WriteNative_f (void)
+{
+	char	name[MAX_OSPATH];
+	int		*order;
+	int		i, j, fnum, end, mark;
+	int		maxbuiltin;
+	qboolean	ok;
+
+	if (!progs)
+	{
+		Con_Printf ("No progs loaded, start a map first\n");
+		return;
+	}
+
+	if (Cmd_Argc() > 1)
+	{
+		if (strstr(Cmd_Argv(1), ".."))
+		{
+			Con_Printf ("Relative pathnames are not allowed.\n");
+			return;
+		}
+		i = snprintf (name, sizeof(name), "%s/%s", com_gamedir, Cmd_Argv(1));
+	}
+	else
+		i = snprintf (name, sizeof(name), "%s/%s.cpp", com_gamedir, PR_NATIVE_NAME);
+	if (i >= (int)sizeof(name))
+	{
+		Con_Printf ("ERROR: path too long.\n");
+		return;
+	}
+
+	nf = fopen (name, "w");
+	if (!nf)
+	{
+		Con_Printf ("ERROR: couldn't open %s.\n", name);
+		return;
+	}
+
+	mark = Hunk_LowMark ();
+	order = (int *)Hunk_Alloc (progs->numfunctions * sizeof(int));
+	nleader = (byte *)Hunk_Alloc (progs->numstatements);
+	ntarget = (byte *)Hunk_Alloc (progs->numstatements);
+
+// functions in statement order, to find where each one ends
+	for (i=0 ; i<progs->numfunctions ; i++)
+		order[i] = i;
+	for (i=1 ; i<progs->numfunctions ; i++)
+	{
+		fnum = order[i];
+		for (j=i ; j>0 && pr_functions[order[j-1]].first_statement > pr_functions[fnum].first_statement ; j--)
+			order[j] = order[j-1];
+		order[j] = fnum;
+	}
+
+	fprintf (nf, "// %s.cpp -- written by pr_writenative, do not edit\n", PR_NATIVE_NAME);
+	fprintf (nf, "//\n// build it with the quake code directory on the include path, with\n");
+	fprintf (nf, "// -fno-strict-aliasing and without floating point contraction, e.g.\n");
+	fprintf (nf, "// g++ -O2 -shared -fPIC -fno-strict-aliasing -ffp-contract=off -I<code> %s.cpp -o %s.so\n\n", PR_NATIVE_NAME, PR_NATIVE_NAME);
+	fprintf (nf, "#include <string.h>\n#include \"pr_native.h\"\n\n");
+	fprintf (nf, "typedef union\n{\n\tfloat\tf;\n\tint\t\ti;\n} peval_t;\n\n");
+	fprintf (nf, "// the import of the vm current on each thread, read once per function\n");
+	fprintf (nf, "#if defined(__GNUC__) && !defined(_WIN32)\n");
+	fprintf (nf, "static thread_local prnativeimport_t\t*pr_import __attribute__((tls_model(\"initial-exec\")));\n");
+	fprintf (nf, "#else\nstatic thread_local prnativeimport_t\t*pr_import;\n#endif\n\n");
+	fprintf (nf, "#define\tF(o)\t(((peval_t *)pr.globals)[o].f)\n");
+	fprintf (nf, "#define\tI(o)\t(((peval_t *)pr.globals)[o].i)\n");
+	fprintf (nf, "#define\tS(o)\t(pr.strings + I(o))\n");
+	fprintf (nf, "#define\tP(p)\t((peval_t *)(*pr.edicts + (p)))\n");
+	fprintf (nf, "#define\tE(e)\t((peval_t *)(*pr.edicts + (e) + pr.entvars))\n");
+	fprintf (nf, "#define\tRUNAWAY(n,s)\tif ((*pr.runaway -= (n)) <= 0) pr.error (s, \"runaway loop error\")\n\n");
+
+	for (i=1 ; i<progs->numfunctions ; i++)
+		if (pr_functions[i].first_statement >= 0)
+			fprintf (nf, "static void qf_%i (void);\n", i);
+
+	ok = true;
+	maxbuiltin = 0;
+	for (i=0 ; i<progs->numfunctions && ok ; i++)
+	{
+		fnum = order[i];
+		if (fnum == 0 || pr_functions[fnum].first_statement < 0)
+			continue;
+
+		end = progs->numstatements;
+		for (j=i+1 ; j<progs->numfunctions ; j++)
+			if (pr_functions[order[j]].first_statement > pr_functions[fnum].first_statement)
+			{
+				end = pr_functions[order[j]].first_statement;
+				break;
+			}
+
+		ok = PR_NativeFunction (fnum, pr_functions[fnum].first_statement, end, &maxbuiltin);
+	}
+
+	if (ok)
+	{
+		fprintf (nf, "\nstatic prnative_t\tfunctions[%i] =\n{\n", progs->numfunctions);
+		for (i=0 ; i<progs->numfunctions ; i++)
+		{
+			if (i == 0 || pr_functions[i].first_statement < 0)
+				fprintf (nf, "\t0,\n");
+			else
+				fprintf (nf, "\tqf_%i,\n", i);
+		}
+		fprintf (nf, "};\n\n");
+
+		fprintf (nf, "static void Init (prnativeimport_t *import)\n{\n\tpr_import = import;\n}\n\n");
+		fprintf (nf, "static prnativeprogs_t\tprogs =\n{\n");
+		fprintf (nf, "\t%i, %i, %i, %i, %i,\n\tfunctions,\n\tInit\n};\n\n",
+			PR_NATIVE_VERSION, pr_crc, progs->numstatements, progs->numfunctions, maxbuiltin);
+		fprintf (nf, "extern \"C\"\n#ifdef _WIN32\n__declspec(dllexport)\n#endif\n");
+		fprintf (nf, "prnativeprogs_t *%s (void)\n{\n\treturn &progs;\n}\n", PR_NATIVE_ENTRY);
+	}
+
+	fclose (nf);
+	Hunk_FreeToLowMark (mark);
+
+	if (!ok)
+	{
+		remove (name);
+		Con_Printf ("Couldn't translate progs.dat\n");
+		return;
+	}
+
+	Con_Printf ("Wrote %s\n", name);
+}
@@ -0,0 +1,71 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// pr_native.h -- interface between the engine and progs translated to C++
+
+// this file is shared by the engine and the code written by pr_writenative,
+// so it can't depend on anything else in quake
+
+#define	PR_NATIVE_VERSION	5
+
+#define	PR_NATIVE_NAME		"progs_native"		// .dll / .so in the game directory
+#define	PR_NATIVE_ENTRY		"GetNativeProgs"
+
+typedef void (*prnative_t) (void);
+
+// engine state handed to the translated progs when they are loaded
+typedef struct
+{
+	float		*globals;
+	char		*strings;
+	unsigned char	**edicts;			// points at sv.edicts
+	int			entvars;				// offset of the progs fields in an edict
+
+	int			*argc;					// pr_argc
+	int			*xstatement;			// pr_xstatement
+	int			*trace;					// pr_trace
+	int			*unwind;				// set when the interpreter has taken over
+	int			*runaway;
+
+	prnative_t	*builtins;
+
+	void		(*enter) (int fnum);
+	void		(*leave) (void);
+	int			(*call) (int fnum, int argc, int statement);	// true to unwind
+	void		(*traceon) (int statement);
+	void		(*error) (int statement, const char *message);
+	int			(*worldlocked) (void);	// true if assigning to world fields is an error
+	void		(*wake) (int ent);		// a field physics mirrors is about to change
+	const unsigned char	*fieldwatch;	// [entityfields] set for fields the engine keeps state for
+	void		(*watched) (int ent, int field);	// one of them is about to change
+} prnativeimport_t;
+
+// what the translated progs export through PR_NATIVE_ENTRY
+typedef struct
+{
+	int			version;				// PR_NATIVE_VERSION
+	int			crc;					// pr_crc of the progs.dat it was written from
+	int			numstatements;
+	int			numfunctions;
+	int			numbuiltins;			// highest builtin called directly + 1
+	prnative_t	*functions;				// NULL for builtins
+	void		(*init) (prnativeimport_t *import);	// used on the calling thread until the next init
+} prnativeprogs_t;
+
+typedef prnativeprogs_t *(*prnativeentry_t) (void);
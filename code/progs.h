@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "pr_comp.h"			// defs shared with qcc
 #include "progdefs.h"			// generated by program cdefs
+#include "pr_native.h"			// interface to progs translated to C++
 
 typedef union eval_s
 {
@@ -35,7 +36,10 @@ typedef union eval_s
 typedef struct edict_s
 {
 	qboolean	free;
-	link_t		area;				// linked to a division node or leaf
+	link_t		area;				// linked to a node of the area tree
+	struct areanode_s	*areanode;	// the node area is linked to
+	qboolean	areatrigger;		// in the trigger list of areanode
+	unsigned	tracestamp;			// area stamp of its last change a trace could see
 	
 	int			entnum;
 
@@ -45,39 +49,167 @@ typedef struct edict_s
 	entity_state_t	baseline;
 	
 	float		freetime;			// sv.time when the object was freed
+	link_t		freelink;			// in sv.free_edicts, oldest first
 	entvars_t	v;					// C exported fields from progs
 // other fields from progs come immediately after
 } edict_t;
 #define	EDICT_FROM_AREA(l) STRUCT_FROM_LINK(l,edict_t,area)
+#define	EDICT_FROM_FREE(l) STRUCT_FROM_LINK(l,edict_t,freelink)
+
+// a dstatement_t decoded at load time for the threaded interpreter
+typedef struct prstatement_s
+{
+	void		*handler;		// opcode label when direct threaded
+	eval_t		*a, *b;
+	union
+	{
+		eval_t					*c;
+		struct prstatement_s	*jump;	// OP_IF, OP_IFNOT and OP_GOTO
+	};
+	int			op;
+} prstatement_t;
 
 //============================================================================
 
-extern	dprograms_t		*progs;
-extern	dfunction_t		*pr_functions;
-extern	char			*pr_strings;
-extern	ddef_t			*pr_globaldefs;
-extern	ddef_t			*pr_fielddefs;
-extern	dstatement_t	*pr_statements;
-extern	globalvars_t	*pr_global_struct;
-extern	float			*pr_globals;			// same as pr_global_struct
+#define	MAX_STACK_DEPTH		32
+#define	LOCALSTACK_SIZE		2048
 
-extern	int				pr_edict_size;	// in bytes
+typedef struct
+{
+	int				s;
+	dfunction_t		*f;
+} prstack_t;
+
+// name lookups for the defs and functions, built by PR_LoadProgs
+typedef struct
+{
+	int		mask;				// size - 1, size is a power of two
+	int		*heads;				// first index in each chain, -1 if empty
+	int		*next;				// next index with the same hash
+} prhash_t;
+
+/*
+A loaded progs.dat and everything the interpreter keeps while running it.
+PR_ExecuteProgram makes its vm current on the calling thread for the
+length of the call, so the builtins and the rest of the engine reach it
+through the pr_* names below.  The decoded code points straight at the
+globals, so a copy of a vm has to run PR_DecodeProgs for its own; after
+that threads can each run their own vm at once (see pr_threadcheck).
+*/
+typedef struct qcvm_s
+{
+	dprograms_t		*header;			// progs.dat as loaded
+	dfunction_t		*functions;
+	char			*strings;
+	ddef_t			*globaldefs;
+	ddef_t			*fielddefs;
+	dstatement_t	*statements;
+	prstatement_t	*code;				// statements decoded
+	globalvars_t	*global_struct;
+	float			*globals;			// same as global_struct
+	int				edict_size;			// in bytes
+	unsigned short	crc;
+	char			*string_temp;		// ftos/vtos/etos results
+	byte			*fieldwatch;		// [entityfields] FW_* bits
+
+	prhash_t		fieldhash, globalhash, functionhash;
+
+// interpreter state
+	prstack_t		stack[MAX_STACK_DEPTH];
+	int				depth;
+	int				localstack[LOCALSTACK_SIZE];
+	int				localstack_used;
+	qboolean		trace;
+	dfunction_t		*xfunction;
+	int				xstatement;
+	int				argc;
+
+// progs_native, see pr_native.cpp
+	void			*nativelib;
+	prnativeprogs_t	*native;
+	prnative_t		*nativefunctions;	// NULL when interpreting
+	prnativeimport_t	nativeimport;
+	qboolean		nativeunwind;		// interpreter has finished the call
+	int				nativeexitdepth;
+	int				nativerunaway;
+} qcvm_t;
+
+extern	thread_local qcvm_t	*qcvm;				// the vm being run on this thread
+
+#define	progs				(qcvm->header)
+#define	pr_functions		(qcvm->functions)
+#define	pr_strings			(qcvm->strings)
+#define	pr_globaldefs		(qcvm->globaldefs)
+#define	pr_fielddefs		(qcvm->fielddefs)
+#define	pr_statements		(qcvm->statements)
+#define	pr_code				(qcvm->code)
+#define	pr_global_struct	(qcvm->global_struct)
+#define	pr_globals			(qcvm->globals)
+#define	pr_edict_size		(qcvm->edict_size)
+#define	pr_crc				(qcvm->crc)
+#define	pr_string_temp		(qcvm->string_temp)
+#define	pr_fieldwatch		(qcvm->fieldwatch)
+#define	pr_stack			(qcvm->stack)
+#define	pr_depth			(qcvm->depth)
+#define	pr_trace			(qcvm->trace)
+#define	pr_xfunction		(qcvm->xfunction)
+#define	pr_xstatement		(qcvm->xstatement)
+#define	pr_argc				(qcvm->argc)
+#define	pr_nativefunctions	(qcvm->nativefunctions)
+
+#define	PR_STRING_TEMP	128
+
+// fields the engine keeps state about, so QC stores to them have to call
+// ED_WatchedField before writing
+#define	FW_PHYS			1			// SV_WakeEdict
+#define	FW_AREA			2			// SV_AreaMoved
+#define	FW_FIND			4			// ED_Reindex
+#define	FW_TRACE		8			// SV_TraceChanged
 
 //============================================================================
 
 void PR_Init (void);
 
-void PR_ExecuteProgram (func_t fnum);
-void PR_LoadProgs (void);
+void PR_ExecuteProgram (qcvm_t *vm, func_t fnum);
+void PR_ExecuteTraced (int s, int exitdepth, int runaway);
+int PR_EnterFunction (dfunction_t *f);
+int PR_LeaveFunction (void);
+void PR_LoadProgs (qcvm_t *vm);
+void PR_DecodeProgs (void);
 
 void PR_Profile_f (void);
+void PR_ThreadCheck_f (void);
+
+void PR_LoadNative (void);
+void PR_UnloadNative (void);
+void PR_BindNative (void);
+void PR_SetNativeImport (qcvm_t *vm);
+void PR_ExecuteNative (func_t fnum, int exitdepth);
+void PR_WriteNative_f (void);
+
+void PR_TimeFindRadius_f (void);
 
 edict_t *ED_Alloc (void);
 void ED_Free (edict_t *ed);
 
+void ED_WatchedField (edict_t *ed, int field);
+
+void ED_ClearFindIndex (void);
+void ED_Reindex (edict_t *ed);
+int ED_FindString (int e, int field, char *s);
+// returns the first edict after e that isn't free and whose string field
+// is s, 0 if there is none, or -1 if the field isn't indexed
+
+void ED_RebuildFreeList (void);
+
 char	*ED_NewString (char *string);
 // returns a copy of the string allocated from the server's string heap
 
+string_t ED_EngineString (char *string);
+// returns a string_t for text that lives outside the progs
+
+ddef_t *ED_GlobalAtOfs (int ofs);
+
 void ED_Print (edict_t *ed);
 void ED_Write (FILE *f, edict_t *ed);
 char *ED_ParseEdict (char *data, edict_t *ent);
@@ -119,13 +251,8 @@ typedef void (*builtin_t) (void);
 extern	builtin_t *pr_builtins;
 extern int pr_numbuiltins;
 
-extern int		pr_argc;
-
-extern	qboolean	pr_trace;
-extern	dfunction_t	*pr_xfunction;
-extern	int			pr_xstatement;
-
-extern	unsigned short		pr_crc;
+extern	cvar_t	pr_profile;
+extern	cvar_t	pr_native;
 
 void PR_RunError (char *error, ...);
 
@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // protocol.h -- communications protocols
 
 #define	PROTOCOL_VERSION	15
+#define	PROTOCOL_DELTA		16		// PROTOCOL_VERSION with svc_packetentities
 
 // if the high bit of the servercmd is set, the low bits are fast update flags:
 #define	U_MOREBITS	(1<<0)
@@ -39,6 +40,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	U_SKIN		(1<<12)
 #define	U_EFFECTS	(1<<13)
 #define	U_LONGENTITY	(1<<14)
+#define	U_REMOVE		(1<<15)		// svc_packetentities only, entity left the frame
 
 
 #define	SU_VIEWHEIGHT	(1<<0)
@@ -61,6 +63,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	SND_VOLUME		(1<<0)		// a byte
 #define	SND_ATTENUATION	(1<<1)		// a byte
 #define	SND_LOOPING		(1<<2)		// a long
+#define	SND_LARGEENTITY	(1<<3)		// a short entity and a byte channel
 
 
 // defaults for clientinfo messages
@@ -130,6 +133,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #define svc_cutscene		34
 
+#define	svc_packetentities	35	// PROTOCOL_DELTA only
+						// [long] frame sequence
+						// [long] sequence the updates are from, -1 for baselines
+						// <fast updates>...[byte] 0
+
 //
 // client to server
 //
@@ -138,6 +146,28 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	clc_disconnect	2
 #define	clc_move		3			// [usercmd_t]
 #define	clc_stringcmd	4		// [string] message
+#define	clc_ackframe	5		// [long] last svc_packetentities frame, PROTOCOL_DELTA only
+
+
+//
+// svc_packetentities frames
+//
+#define	UPDATE_BACKUP		16		// frames kept for deltas, power of 2
+#define	UPDATE_MASK			(UPDATE_BACKUP-1)
+#define	MAX_PACKET_ENTITIES	256		// entities in one frame
+
+typedef struct
+{
+	int				number;
+	entity_state_t	state;			// as the client decoded it
+} packetentity_t;
+
+typedef struct
+{
+	int				sequence;		// -1 if not valid
+	int				num_entities;
+	packetentity_t	entities[MAX_PACKET_ENTITIES];	// in number order
+} packetframe_t;
 
 
 //
@@ -44,6 +44,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <stdio.h>
 #include <stdlib.h>
 #include <setjmp.h>
+#include <stdint.h>
 
 #if defined(_WIN32) && !defined(WINDED)
 
@@ -104,7 +105,8 @@ void	VID_UnlockBuffer (void);
 //
 // per-level limits
 //
-#define	MAX_EDICTS		600			// FIXME: ouch! ouch! ouch!
+#define	MIN_EDICTS		600			// default and lower bound for -maxedicts
+#define	MAX_EDICTS		65535		// sent over the net as unsigned shorts
 #define	MAX_LIGHTSTYLES	64
 #define	MAX_MODELS		256			// these are sent over the net as bytes
 #define	MAX_SOUNDS		256			// so they cannot be blindly increased
@@ -339,5 +341,7 @@ void Chase_Init (void);
 void Chase_Reset (void);
 void Chase_Update (void);
 
+#ifdef _WIN32
 LONG CDAudio_MessageHandler(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+#endif
 qboolean SV_RecursiveHullCheck(hull_t* hull, int num, float p1f, float p2f, const vec3_t & p1, const vec3_t & p2, trace_t* trace);
\ No newline at end of file
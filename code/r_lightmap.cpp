@@ -0,0 +1,365 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_lightmap.c -- combining light styles into lightmap texels.  No gl
+// calls, so the dedicated server links it too and can run timelightmaps.
+
+#include "quakedef.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define	LIGHT_SSE2	1
+#else
+#define	LIGHT_SSE2	0
+#endif
+
+/*
+Each sample is gamma corrected with pow (sample/255, 0.75) and scaled by its
+style's value/255.  Rather than doing that per texel, every style keeps a
+table of all 256 corrected and scaled samples in LIGHT_ONE fixed point,
+rebuilt by R_UpdateLightStyleTables when the style's value changes.
+*/
+
+static float	lightgamma[256];
+static int		lightstyletables[255][256];
+static int		lightstylevalues[255];		// the value each table was built for
+
+void R_TimeLightmaps_f (void);
+
+/*
+===============
+R_InitLightmaps
+===============
+*/
+void R_InitLightmaps (void)
+{
+	int		i;
+
+	for (i=0 ; i<256 ; i++)
+		lightgamma[i] = pow (i/255.0f, 0.75f);
+	for (i=0 ; i<255 ; i++)
+		lightstylevalues[i] = -1;
+
+	Cmd_AddCommand ("timelightmaps", R_TimeLightmaps_f);
+}
+
+/*
+===============
+R_UpdateLightStyleTables
+
+Rebuilds the tables of the styles whose value changed.  Called before a
+batch of lightmaps is built, so the threads building them only read.
+===============
+*/
+void R_UpdateLightStyleTables (void)
+{
+	int		i, style, value;
+	int		*table;
+	float	scale;
+
+	for (style=0 ; style<255 ; style++)
+	{
+		value = d_lightstylevalue[style];
+		if (lightstylevalues[style] == value)
+			continue;
+		lightstylevalues[style] = value;
+		table = lightstyletables[style];
+		scale = value * (LIGHT_ONE / 255.0f);
+		for (i=0 ; i<256 ; i++)
+			table[i] = (int)(lightgamma[i]*scale + 0.5f);
+	}
+}
+
+/*
+===============
+R_AccumulateLightmap
+
+Adds up all the styles of the surface into bl, one pass over the texels.
+The style tables have to be up to date.
+===============
+*/
+void R_AccumulateLightmap (msurface_t *surf, int *bl)
+{
+	int		i, size, maps;
+	byte	*l0, *l1, *l2, *l3;
+	int		*t0, *t1, *t2, *t3;
+
+	size = ((surf->extents[0]>>4)+1) * ((surf->extents[1]>>4)+1);
+
+	maps = 0;
+	if (surf->samples)
+		for ( ; maps < MAXLIGHTMAPS && surf->styles[maps] != 255 ; maps++)
+			surf->cached_light[maps] = d_lightstylevalue[surf->styles[maps]];
+
+	l0 = surf->samples;
+	l1 = l0 + size;
+	l2 = l1 + size;
+	l3 = l2 + size;
+	switch (maps)
+	{
+	case 0:
+		memset (bl, 0, size*sizeof(*bl));
+		break;
+	case 1:
+		t0 = lightstyletables[surf->styles[0]];
+		for (i=0 ; i<size ; i++)
+			bl[i] = t0[l0[i]];
+		break;
+	case 2:
+		t0 = lightstyletables[surf->styles[0]];
+		t1 = lightstyletables[surf->styles[1]];
+		for (i=0 ; i<size ; i++)
+			bl[i] = t0[l0[i]] + t1[l1[i]];
+		break;
+	case 3:
+		t0 = lightstyletables[surf->styles[0]];
+		t1 = lightstyletables[surf->styles[1]];
+		t2 = lightstyletables[surf->styles[2]];
+		for (i=0 ; i<size ; i++)
+			bl[i] = t0[l0[i]] + t1[l1[i]] + t2[l2[i]];
+		break;
+	default:
+		t0 = lightstyletables[surf->styles[0]];
+		t1 = lightstyletables[surf->styles[1]];
+		t2 = lightstyletables[surf->styles[2]];
+		t3 = lightstyletables[surf->styles[3]];
+		for (i=0 ; i<size ; i++)
+			bl[i] = t0[l0[i]] + t1[l1[i]] + t2[l2[i]] + t3[l3[i]];
+		break;
+	}
+}
+
+/*
+===============
+R_StoreLightmap
+
+Bound, invert and write smax*tmax texels of bl in the lightmap format,
+4 bytes a texel with the light in alpha, or 1 byte.  The light is rounded
+up, so the inverted texel rounds down as it always has.  bl has to stay
+below LIGHT_ONE*127.
+===============
+*/
+void R_StoreLightmap (int *bl, int smax, int tmax, byte *dest, int stride, int texelbytes)
+{
+	int		i, j, t;
+#if LIGHT_SSE2
+	__m128i	v, zero, invert, round255, round256;
+
+	zero = _mm_setzero_si128 ();
+	invert = _mm_set1_epi8 ((char)0xff);
+	round255 = _mm_set1_epi32 (0xffff);
+	round256 = _mm_set1_epi32 (0xff);
+#endif
+
+	switch (texelbytes)
+	{
+	case 4:
+		for (i=0 ; i<tmax ; i++, bl += smax, dest += stride)
+		{
+			j = 0;
+#if LIGHT_SSE2
+			for ( ; j+4 <= smax ; j+=4)
+			{
+				v = _mm_loadu_si128 ((__m128i *)(bl+j));
+				v = _mm_sub_epi32 (_mm_slli_epi32 (v, 8), v);	// *255
+				v = _mm_srai_epi32 (_mm_add_epi32 (v, round255), 16);
+				v = _mm_packs_epi32 (v, v);
+				v = _mm_xor_si128 (_mm_packus_epi16 (v, v), invert);
+				v = _mm_unpacklo_epi16 (zero, _mm_unpacklo_epi8 (zero, v));
+				_mm_storeu_si128 ((__m128i *)(dest + j*4), v);
+			}
+#endif
+			for ( ; j<smax ; j++)
+			{
+				t = (bl[j]*255 + 0xffff) >> 16;
+				if (t > 255)
+					t = 255;
+				dest[j*4+3] = 255-t;
+			}
+		}
+		break;
+	case 1:
+		for (i=0 ; i<tmax ; i++, bl += smax, dest += stride)
+		{
+			j = 0;
+#if LIGHT_SSE2
+			for ( ; j+4 <= smax ; j+=4)
+			{
+				v = _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(bl+j)), round256);	// *256
+				v = _mm_srai_epi32 (v, 8);
+				v = _mm_packs_epi32 (v, v);
+				v = _mm_xor_si128 (_mm_packus_epi16 (v, v), invert);
+				*(int *)(dest + j) = _mm_cvtsi128_si32 (v);
+			}
+#endif
+			for ( ; j<smax ; j++)
+			{
+				t = (bl[j] + 0xff) >> 8;
+				if (t > 255)
+					t = 255;
+				dest[j] = 255-t;
+			}
+		}
+		break;
+	default:
+		Sys_Error ("Bad lightmap format");
+	}
+}
+
+/*
+===============
+R_TimeLightmaps_f
+
+Rebuilds every lightmap of the current world with the light styles stepping
+through their values, in both lightmap formats, on one thread and then on
+all of them.  Needs no renderer, so it runs on the dedicated server with
+the map the server has loaded.
+===============
+*/
+#define	TIME_RUNS	5
+#define	TIME_STEPS	26
+#define	TIME_CHUNK	64		// surfaces a work item builds
+
+static model_t	*timemodel;
+static int		timetexelbytes;
+static unsigned	*timesums;		// each surface's checksum, when not NULL
+
+static void R_TimeLightmapStyles (int step)
+{
+	int		i;
+
+	for (i=0 ; i<256 ; i++)
+		d_lightstylevalue[i] = ((i + step) % 26) * 22;
+	R_UpdateLightStyleTables ();
+}
+
+static void R_TimeLightmapSurfaces (int first, int end)
+{
+	int			i, j, smax, tmax;
+	msurface_t	*surf;
+	int			bl[18*18];
+	byte		dest[18*18*4];
+	unsigned	sum;
+
+	for (i=first, surf=timemodel->surfaces+first ; i<end ; i++, surf++)
+	{
+		if (surf->flags & (SURF_DRAWSKY|SURF_DRAWTURB))
+			continue;
+		smax = (surf->extents[0]>>4)+1;
+		tmax = (surf->extents[1]>>4)+1;
+		R_AccumulateLightmap (surf, bl);
+		R_StoreLightmap (bl, smax, tmax, dest, smax*timetexelbytes, timetexelbytes);
+		if (timesums)
+		{
+			sum = 0;
+			for (j=timetexelbytes-1 ; j<smax*tmax*timetexelbytes ; j+=timetexelbytes)
+				sum = sum*31 + dest[j];
+			timesums[i] = sum;
+		}
+	}
+}
+
+static void R_TimeLightmapWork (int work)
+{
+	int		end;
+
+	end = (work+1)*TIME_CHUNK;
+	if (end > timemodel->numsurfaces)
+		end = timemodel->numsurfaces;
+	R_TimeLightmapSurfaces (work*TIME_CHUNK, end);
+}
+
+static void R_TimeLightmapStep (int step, int threads)
+{
+	R_TimeLightmapStyles (step);
+	if (threads > 1)
+		Sys_RunThreadsOn ((timemodel->numsurfaces+TIME_CHUNK-1)/TIME_CHUNK, R_TimeLightmapWork);
+	else
+		R_TimeLightmapSurfaces (0, timemodel->numsurfaces);
+}
+
+void R_TimeLightmaps_f (void)
+{
+	int			i, maps, step, run, texels, surfaces, threads;
+	msurface_t	*surf;
+	int			savedvalues[256];
+	unsigned	sum, *sums;
+	double		start, t, best;
+
+	timemodel = cl.worldmodel;
+	if (!timemodel && sv.active)
+		timemodel = sv.worldmodel;
+	if (!timemodel)
+	{
+		Con_Printf ("no map loaded\n");
+		return;
+	}
+
+	surfaces = texels = 0;
+	for (i=0, surf=timemodel->surfaces ; i<timemodel->numsurfaces ; i++, surf++)
+	{
+		if (surf->flags & (SURF_DRAWSKY|SURF_DRAWTURB))
+			continue;
+		surfaces++;
+		texels += ((surf->extents[0]>>4)+1) * ((surf->extents[1]>>4)+1);
+	}
+
+	memcpy (savedvalues, d_lightstylevalue, sizeof(savedvalues));
+	Con_Printf ("%s: %i surfaces, %i texels\n", timemodel->name, surfaces, texels);
+	Con_Printf ("bytes  threads  Mtexels/s  checksum\n");
+	sums = (unsigned *)Hunk_TempAlloc (timemodel->numsurfaces*sizeof(unsigned));
+	for (timetexelbytes=1 ; timetexelbytes<=4 ; timetexelbytes+=3)
+	{
+		for (threads=1 ; ; threads=Sys_NumThreads ())
+		{
+		// an untimed pass on the same threads for the checksum, combined
+		// in surface order whichever thread built each one
+			memset (sums, 0, timemodel->numsurfaces*sizeof(unsigned));
+			timesums = sums;
+			sum = 0;
+			for (step=0 ; step<TIME_STEPS ; step++)
+			{
+				R_TimeLightmapStep (step, threads);
+				for (i=0 ; i<timemodel->numsurfaces ; i++)
+					sum = sum*31 + sums[i];
+			}
+			timesums = NULL;
+
+			best = 0;
+			for (run=0 ; run<TIME_RUNS ; run++)
+			{
+				start = Sys_FloatTime ();
+				for (step=0 ; step<TIME_STEPS ; step++)
+					R_TimeLightmapStep (step, threads);
+				t = Sys_FloatTime () - start;
+				if (!run || t < best)
+					best = t;
+			}
+			Con_Printf ("%5i  %7i  %9.2f  %08x\n", timetexelbytes, threads, texels*(double)TIME_STEPS/best/1000000, sum);
+			if (threads == Sys_NumThreads ())
+				break;
+		}
+	}
+	memcpy (d_lightstylevalue, savedvalues, sizeof(savedvalues));
+
+// the lightmaps in use were built with other values
+	for (i=0, surf=timemodel->surfaces ; i<timemodel->numsurfaces ; i++, surf++)
+		for (maps=0 ; maps<MAXLIGHTMAPS ; maps++)
+			surf->cached_light[maps] = -1;
+}
@@ -0,0 +1,257 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_null.c -- refresh, 2D drawing and screen entry points for the headless
+// dedicated server.  The client code is linked in so the host can run
+// unchanged, but with cls.state == ca_dedicated none of it ever draws.
+
+#include "quakedef.h"
+
+//
+// refresh
+//
+refdef_t	r_refdef;
+vec3_t		r_origin, vpn, vright, vup;
+texture_t	*r_notexture_mip;
+int			d_lightstylevalue[256];	// only for timelightmaps
+
+/*
+==================
+R_InitTextures
+
+needed even for dedicated servers, missing map textures point here
+==================
+*/
+void	R_InitTextures (void)
+{
+	int		x,y, m;
+	byte	*dest;
+
+// create a simple checkerboard texture for the default
+	r_notexture_mip = (texture_s *)Hunk_AllocName (sizeof(texture_t) + 16*16+8*8+4*4+2*2, "notexture");
+
+	r_notexture_mip->width = r_notexture_mip->height = 16;
+	r_notexture_mip->offsets[0] = sizeof(texture_t);
+	r_notexture_mip->offsets[1] = r_notexture_mip->offsets[0] + 16*16;
+	r_notexture_mip->offsets[2] = r_notexture_mip->offsets[1] + 8*8;
+	r_notexture_mip->offsets[3] = r_notexture_mip->offsets[2] + 4*4;
+
+	for (m=0 ; m<4 ; m++)
+	{
+		dest = (byte *)r_notexture_mip + r_notexture_mip->offsets[m];
+		for (y=0 ; y< (16>>m) ; y++)
+			for (x=0 ; x< (16>>m) ; x++)
+			{
+				if (  (y< (8>>m) ) ^ (x< (8>>m) ) )
+					*dest++ = 0;
+				else
+					*dest++ = 0xff;
+			}
+	}
+}
+
+void R_Init (void)
+{
+}
+
+void R_InitSky (texture_t *mt)
+{
+}
+
+void R_NewMap (void)
+{
+}
+
+void R_RenderView (void)
+{
+}
+
+void R_PushDlights (void)
+{
+}
+
+void R_AddEfrags (entity_t *ent)
+{
+}
+
+void R_RemoveEfrags (entity_t *ent)
+{
+}
+
+void R_TranslatePlayerSkin (int playernum)
+{
+}
+
+void D_FlushCaches (void)
+{
+}
+
+void R_ParseParticleEffect (void)
+{
+	int		i;
+
+// keep the message stream in sync
+	for (i=0 ; i<3 ; i++)
+		MSG_ReadCoord ();
+	for (i=0 ; i<3 ; i++)
+		MSG_ReadChar ();
+	MSG_ReadByte ();
+	MSG_ReadByte ();
+}
+
+void R_RunParticleEffect (const vec3_t & org, const vec3_t & dir, int color, int count)
+{
+}
+
+void R_RocketTrail (vec3_t &start, const vec3_t & end, int type)
+{
+}
+
+void R_EntityParticles (entity_t *ent)
+{
+}
+
+void R_BlobExplosion (const vec3_t & org)
+{
+}
+
+void R_ParticleExplosion (const vec3_t & org)
+{
+}
+
+void R_ParticleExplosion2 (const vec3_t & org, int colorStart, int colorLength)
+{
+}
+
+void R_LavaSplash (const vec3_t & org)
+{
+}
+
+void R_TeleportSplash (const vec3_t & org)
+{
+}
+
+//
+// 2D drawing
+//
+qpic_t		*draw_disc;
+
+void Draw_Init (void)
+{
+}
+
+void Draw_Character (int x, int y, int num)
+{
+}
+
+void Draw_String (int x, int y, char *str)
+{
+}
+
+void Draw_Pic (int x, int y, qpic_t *pic)
+{
+}
+
+void Draw_TransPic (int x, int y, qpic_t *pic)
+{
+}
+
+void Draw_TransPicTranslate (int x, int y, qpic_t *pic, byte *translation)
+{
+}
+
+void Draw_ConsoleBackground (int lines)
+{
+}
+
+void Draw_BeginDisc (void)
+{
+}
+
+void Draw_EndDisc (void)
+{
+}
+
+void Draw_TileClear (int x, int y, int w, int h)
+{
+}
+
+void Draw_Fill (int x, int y, int w, int h, int c)
+{
+}
+
+void Draw_FadeScreen (void)
+{
+}
+
+qpic_t *Draw_PicFromWad (char *name)
+{
+	return (qpic_t *)W_GetLumpName (name);
+}
+
+qpic_t *Draw_CachePic (char *path)
+{
+	return NULL;
+}
+
+//
+// screen
+//
+int			scr_copytop;
+int			scr_copyeverything;
+
+float		scr_con_current;
+float		scr_conlines;
+
+cvar_t		scr_viewsize = {"viewsize","100", true};
+
+int			scr_fullupdate;
+int			clearnotify;
+int			sb_lines;
+
+qboolean	scr_disabled_for_loading;
+qboolean	scr_skipupdate;
+qboolean	block_drawing;
+
+float		scr_centertime_off;
+
+void SCR_Init (void)
+{
+}
+
+void SCR_UpdateScreen (void)
+{
+}
+
+void SCR_CenterPrint (char *str)
+{
+}
+
+void SCR_BeginLoadingPlaque (void)
+{
+}
+
+void SCR_EndLoadingPlaque (void)
+{
+}
+
+int SCR_ModalMessage (char *text)
+{
+	return true;
+}
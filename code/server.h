@@ -23,15 +23,52 @@ typedef struct
 {
 	int			maxclients;
 	int			maxclientslimit;
+	int			maxedicts;			// -maxedicts, size of sv.edicts
 	struct client_s	*clients;		// [maxclients]
+	int			activeconnections;	// clients with a netconnection
 	int			serverflags;		// episode completion information
 	qboolean	changelevel_issued;	// cleared when at SV_SpawnServer
+	qcvm_t		qcvm;				// kept over levels for its progs_native
 } server_static_t;
 
 //=============================================================================
 
 typedef enum {ss_loading, ss_active} server_state_t;
 
+#define	MAX_PVS_CACHE		64
+#define	MAX_FAT_CACHE		32		// must be more than MAX_SCOREBOARD
+#define	MAX_FAT_LEAFS		32		// points touching more aren't cached
+
+typedef struct
+{
+	struct mleaf_s	*leaf;
+	int			lastused;
+	unsigned	*row;
+} pvscache_t;
+
+typedef struct
+{
+	int			numleafs;			// -1 if not a valid key
+	struct mleaf_s	*leafs[MAX_FAT_LEAFS];	// in the order the bsp is walked
+	int			lastused;
+	unsigned	*row;
+} fatcache_t;
+
+#define	NUM_FIND_FIELDS		3		// classname, targetname and target
+#define	FIND_HASH			512
+#define	FIND_NONE			-1
+
+typedef struct
+{
+	int			field;				// entvars offset / 4
+	int			*bucket;			// [max_edicts] FIND_NONE if not indexed
+	int			*next, *prev;		// [max_edicts] in the same bucket, in edict order
+	int			heads[FIND_HASH], tails[FIND_HASH];
+} findindex_t;
+
+#define	MAX_SIGNON			(MAX_MSGLEN-2)	// room for the svc_signonnum after it
+#define	MAX_SIGNON_BUFFERS	64				// baselines and statics for big maps
+
 typedef struct
 {
 	qboolean	active;				// false if only a net client
@@ -39,10 +76,13 @@ typedef struct
 	qboolean	paused;
 	qboolean	loadgame;			// handle connections specially
 
+	qcvm_t		*qcvm;				// progs run by this server
+
 	double		time;
 	
 	int			lastcheck;			// used by PF_checkclient
 	double		lastchecktime;
+	byte		checkpvs[MAX_MAP_LEAFS/8];	// of lastcheck
 	
 	char		name[64];			// map name
 #ifdef QUAKE2
@@ -59,6 +99,7 @@ typedef struct
 	edict_t		*edicts;			// can NOT be array indexed, because
 									// edict_t is variable sized, but can
 									// be used to reference the world ent
+	link_t		free_edicts;		// reused by ED_Alloc in the order freed
 	server_state_t	state;			// some actions are only valid during load
 
 	sizebuf_t	datagram;
@@ -67,10 +108,92 @@ typedef struct
 	sizebuf_t	reliable_datagram;	// copied to all clients at end of frame
 	byte		reliable_datagram_buf[MAX_DATAGRAM];
 
-	sizebuf_t	signon;
-	byte		signon_buf[8192];
+	sizebuf_t	signon;				// the signon buffer being written
+	byte		signon_buf[MAX_SIGNON];
+
+	int			num_signon_buffers;	// filled buffers sent before signon
+	sizebuf_t	signon_buffers[MAX_SIGNON_BUFFERS];
+
+	edict_t		**moved_edict;		// [max_edicts] for SV_PushMove
+	vec3_t		*moved_from;
+
+// compact copy of what SV_Physics needs to skip idle edicts, see SV_WakeEdict
+	byte		*physdirty;			// [max_edicts] entvars read since the copy
+	byte		*physstate;			// PHYS_*
+	float		*physthink;			// nextthink of PHYS_IDLE edicts
+
+// entities touching each world leaf, kept by SV_LinkEdict for
+// SV_WriteEntitiesToClient
+	link_t		*leafents;			// [numleafs]
+	link_t		*leaflinks;			// [max_edicts*MAX_ENT_LEAFS] one per leafnums
+	unsigned	*visents;			// [maxclients*(max_edicts/32+1)] scratch bits
+
+// edicts whose absmin / absmax may be out of date, see SV_AreaMoved
+	byte		*areamoved;			// [max_edicts]
+	int			*movededicts;		// [max_edicts]
+	int			nummoved;
+	edict_t		**arealist;			// [max_edicts*2] for findradius and findbox
+	struct svworld_s	*world;		// area tree and trace cache, see SV_ClearWorld
+
+// string lookups for find, see ED_FindString
+	findindex_t	findindex[NUM_FIND_FIELDS];
+	byte		*findmarked;		// [max_edicts] in finddirty
+	int			*finddirty;			// [max_edicts] edicts to reindex
+	int			numfinddirty;
+
+// entity updates are encoded once per frame and copied to each client
+	int			sendframe;
+	struct entupdate_s	*entupdates;	// [max_edicts]
+
+	int			protocol;			// sv_protocol when the level started
+	packetframe_t	*clientframes;	// [maxclients*UPDATE_BACKUP] PROTOCOL_DELTA only
+	int			droppedentities;	// visible entities left out of full frames this level
+
+// decompressed leaf PVS rows and fat PVS results, see SV_FatPVS
+	int			pvswords;			// size of a row
+	int			pvsused;			// LRU counter
+	pvscache_t	pvscache[MAX_PVS_CACHE];
+	fatcache_t	fatcache[MAX_FAT_CACHE];
 } server_t;
 
+typedef struct entupdate_s
+{
+	int			sendframe;			// sv.sendframe data was written in
+	int			size;
+	byte		data[20];
+} entupdate_t;
+
+// physstate values
+#define	PHYS_AWAKE			0		// runs the full physics every frame
+#define	PHYS_IDLE			1		// does nothing until nextthink is due
+#define	PHYS_FREE			2
+
+// the entvars fields physstate is worked out from.  Anything that changes
+// one of them on an edict other than the one being run must call
+// SV_WakeEdict first
+#define	PHYS_MOVETYPE		(int)(offsetof(entvars_t, movetype)/4)
+#define	PHYS_NEXTTHINK		(int)(offsetof(entvars_t, nextthink)/4)
+#define	PHYS_FLAGS			(int)(offsetof(entvars_t, flags)/4)
+#define	PHYS_FIELD(ofs)		((ofs) == PHYS_MOVETYPE || (ofs) == PHYS_NEXTTHINK || (ofs) == PHYS_FLAGS)
+
+// the entvars fields absmin / absmax are worked out from.  Changing one
+// without relinking the edict must call SV_AreaMoved
+#define	AREA_FIELD_ORIGIN	(int)(offsetof(entvars_t, origin)/4)
+#define	AREA_FIELD_MINS		(int)(offsetof(entvars_t, mins)/4)
+#define	AREA_FIELD_MAXS		(int)(offsetof(entvars_t, maxs)/4)
+#define	AREA_FIELD_SOLID	(int)(offsetof(entvars_t, solid)/4)
+#define	AREA_FIELD(ofs)		((unsigned)((ofs) - AREA_FIELD_ORIGIN) < 3 || (unsigned)((ofs) - AREA_FIELD_MINS) < 3 \
+							|| (unsigned)((ofs) - AREA_FIELD_MAXS) < 3 || (ofs) == AREA_FIELD_SOLID)
+
+// the other entvars fields SV_Move reads from the edicts it clips against.
+// Changing one, or an AREA_FIELD, must call SV_TraceChanged for sv_tracecache
+#define	TRACE_FIELD_OWNER		(int)(offsetof(entvars_t, owner)/4)
+#define	TRACE_FIELD_FLAGS		(int)(offsetof(entvars_t, flags)/4)
+#define	TRACE_FIELD_SIZE		(int)(offsetof(entvars_t, size)/4)
+#define	TRACE_FIELD_MODELINDEX	(int)(offsetof(entvars_t, modelindex)/4)
+#define	TRACE_FIELD(ofs)	((ofs) == TRACE_FIELD_OWNER || (ofs) == TRACE_FIELD_FLAGS \
+							|| (unsigned)((ofs) - TRACE_FIELD_SIZE) < 3 || (ofs) == TRACE_FIELD_MODELINDEX)
+
 
 #define	NUM_PING_TIMES		16
 #define	NUM_SPAWN_PARMS		16
@@ -82,6 +205,7 @@ typedef struct client_s
 	qboolean		dropasap;			// has been told to go to another level
 	qboolean		privileged;			// can execute any host command
 	qboolean		sendsignon;			// only valid before spawned
+	int				signonbuf;			// next signon buffer to send, -1 if none
 
 	double			last_message;		// reliable messages must be sent
 										// periodically
@@ -94,6 +218,10 @@ typedef struct client_s
 	sizebuf_t		message;			// can be added to at any time,
 										// copied and clear once per frame
 	byte			msgbuf[MAX_MSGLEN];
+
+	sizebuf_t		datagram;			// built by the worker threads
+	byte			datagram_buf[MAX_DATAGRAM];
+	byte			*fatpvs;			// SV_FatPVS of the view for this frame
 	edict_t			*edict;				// EDICT_NUM(clientnum+1)
 	char			name[32];			// for printing to other people
 	int				colors;
@@ -106,6 +234,9 @@ typedef struct client_s
 
 // client known data for deltas	
 	int				old_frags;
+	int				framecount;			// svc_packetentities sequence
+	int				ackframe;			// last frame the client received, -1 if none
+	int				droppedentities;	// visible entities past MAX_PACKET_ENTITIES last frame
 } client_t;
 
 
@@ -202,8 +333,39 @@ extern	cvar_t	coop;
 extern	cvar_t	fraglimit;
 extern	cvar_t	timelimit;
 
-extern	server_static_t	svs;				// persistant server info
-extern	server_t		sv;					// local server
+//============================================================================
+
+/*
+Each instance is a complete server with its own level, progs, memory and
+clients.  Host_ServerFrame runs them one after another, making each current
+in turn, and console commands go to the one picked with the instance
+command.  Models are loaded on the hunk and shared by all of them.
+*/
+#define	MAX_INSTANCES		16
+
+#define	NUM_INSTANCE_CVARS	8		// game rules each instance keeps its own of
+
+typedef struct
+{
+	server_static_t	stat;			// persistant server info
+	server_t	server;				// the level
+
+	hunkarena_t	arena;				// level memory while other instances run
+	hunkarena_t	high;				// ... on top of the hunk while alone
+	hunkarena_t	*hunk;				// where the level is
+
+	char		*cvarstrings[NUM_INSTANCE_CVARS];	// while not current
+	float		cvarvalues[NUM_INSTANCE_CVARS];
+	int			skill;				// current_skill while not current
+} svinstance_t;
+
+extern	svinstance_t	sv_instances[MAX_INSTANCES];
+extern	int				sv_numinstances;		// -instances
+extern	svinstance_t	*sv_instance;			// the one sv and svs refer to
+extern	svinstance_t	*sv_cmdinstance;		// the one console commands go to
+
+#define	svs		(sv_instance->stat)
+#define	sv		(sv_instance->server)
 
 extern	client_t	*host_client;
 
@@ -216,6 +378,13 @@ extern	edict_t		*sv_player;
 //===========================================================
 
 void SV_Init (void);
+void SV_InitInstances (void);
+void SV_SetInstance (svinstance_t *in);
+int SV_RunningInstances (void);
+svinstance_t *SV_NewClientInstance (void);
+void SV_InstanceCommand (char *text);
+void SV_Instance_f (void);
+void SV_ReleaseModels (void);
 
 void SV_StartParticle (const vec3_t & org, const vec3_t & dir, int color, int count);
 void SV_StartSound (edict_t *entity, int channel, char *sample, int volume,
@@ -226,9 +395,13 @@ void SV_DropClient (qboolean crash);
 void SV_SendClientMessages (void);
 void SV_ClearDatagram (void);
 
+void SV_WriteSignon (client_t *client);
+void SV_ReserveSignonSpace (int bytes);
+
 int SV_ModelIndex (char *name);
 
 void SV_SetIdealPitch (void);
+unsigned *SV_LeafPVS (struct mleaf_s *leaf);
 
 void SV_AddUpdates (void);
 
@@ -239,6 +412,8 @@ void SV_ClientPrintf (char *fmt, ...);
 void SV_BroadcastPrintf (char *fmt, ...);
 
 void SV_Physics (void);
+void SV_WakeEdict (edict_t *ent);
+void SV_WakeAllEdicts (void);
 
 qboolean SV_CheckBottom (edict_t *ent);
 qboolean SV_movestep (edict_t *ent, const vec3_t & move, qboolean relink);
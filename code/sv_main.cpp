@@ -21,8 +21,18 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 
-server_t		sv;
-server_static_t	svs;
+svinstance_t	sv_instances[MAX_INSTANCES];
+int				sv_numinstances = 1;
+svinstance_t	*sv_instance = sv_instances;
+svinstance_t	*sv_cmdinstance = sv_instances;	// console commands go to
+
+#define	INSTANCE_MEMORY			0x800000	// an arena without -instancemem, in bytes
+#define	INSTANCE_EDICT_MEMORY	0x800		// ... and this much more for each edict, half
+											// for it and half for its tables
+
+static	int		sv_instancemem;			// -instancemem, in bytes
+
+cvar_t	sv_protocol = {"sv_protocol", "15"};	// PROTOCOL_DELTA for svc_packetentities
 
 char	localmodels[MAX_MODELS][5];			// inline model names for precache
 
@@ -39,6 +49,7 @@ void SV_Init (void)
 	extern	cvar_t	sv_maxvelocity;
 	extern	cvar_t	sv_gravity;
 	extern	cvar_t	sv_nostep;
+	extern	cvar_t	sv_parallelphysics;
 	extern	cvar_t	sv_friction;
 	extern	cvar_t	sv_edgefriction;
 	extern	cvar_t	sv_stopspeed;
@@ -57,9 +68,307 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_idealpitchscale);
 	Cvar_RegisterVariable (&sv_aim);
 	Cvar_RegisterVariable (&sv_nostep);
+	Cvar_RegisterVariable (&sv_parallelphysics);
+	Cvar_RegisterVariable (&sv_protocol);
+	Cvar_RegisterVariable (&sv_tracecache);
+
+	Cmd_AddCommand ("areastats", SV_AreaStats_f);
+	Cmd_AddCommand ("tracestats", SV_TraceStats_f);
+	Cmd_AddCommand ("timetraces", SV_TimeTraces_f);
+	Cmd_AddCommand ("instance", SV_Instance_f);
 
 	for (i=0 ; i<MAX_MODELS ; i++)
 		sprintf (localmodels[i], "*%i", i);
+
+	i = COM_CheckParm ("-threads");
+	if (i && i < com_argc-1)
+		Sys_InitThreads (Q_atoi (com_argv[i+1]));
+	else
+		Sys_InitThreads (0);		// one per processor
+
+	svs.maxedicts = MIN_EDICTS;
+	i = COM_CheckParm ("-maxedicts");
+	if (i && i < com_argc-1)
+	{
+		svs.maxedicts = Q_atoi (com_argv[i+1]);
+		if (svs.maxedicts < MIN_EDICTS)
+			svs.maxedicts = MIN_EDICTS;
+		if (svs.maxedicts > MAX_EDICTS)
+			svs.maxedicts = MAX_EDICTS;
+	}
+	for (i=1 ; i<sv_numinstances ; i++)
+		sv_instances[i].stat.maxedicts = svs.maxedicts;
+}
+
+/*
+=============================================================================
+
+INSTANCES
+
+=============================================================================
+*/
+
+extern	cvar_t	noexit;
+extern	cvar_t	samelevel;
+
+static	cvar_t	*sv_instancecvars[NUM_INSTANCE_CVARS] =
+{
+	&deathmatch, &coop, &skill, &teamplay, &fraglimit, &timelimit, &noexit, &samelevel
+};
+
+/*
+===============
+SV_InitInstances
+
+Called by Host_FindMaxClients once the first instance is set up, before
+NET_Init sizes the socket pool
+===============
+*/
+void SV_InitInstances (void)
+{
+	int		i;
+	svinstance_t	*in;
+
+	i = COM_CheckParm ("-instances");
+	if (i && i < com_argc-1)
+	{
+		sv_numinstances = Q_atoi (com_argv[i+1]);
+		if (sv_numinstances < 1)
+			sv_numinstances = 1;
+		if (sv_numinstances > MAX_INSTANCES)
+			sv_numinstances = MAX_INSTANCES;
+	}
+
+	i = COM_CheckParm ("-instancemem");
+	if (i && i < com_argc-1)
+		sv_instancemem = (int)(Q_atof (com_argv[i+1]) * 1024 * 1024);
+
+	for (i=1, in=sv_instances+1 ; i<sv_numinstances ; i++, in++)
+	{
+		in->stat.maxclients = svs.maxclients;
+		in->stat.maxclientslimit = svs.maxclientslimit;
+		in->stat.clients = (client_s *)Hunk_AllocName (svs.maxclientslimit*sizeof(client_t), "clients");
+	}
+}
+
+/*
+===============
+SV_SetInstance
+
+Makes in the one sv and svs refer to, handing it its copy of the rule
+cvars and its progs
+===============
+*/
+void SV_SetInstance (svinstance_t *in)
+{
+	int		i;
+	cvar_t	*var;
+	svinstance_t	*out;
+
+	out = sv_instance;
+	if (in == out)
+		return;
+
+	for (i=0 ; i<NUM_INSTANCE_CVARS ; i++)
+	{
+		var = sv_instancecvars[i];
+		out->cvarstrings[i] = var->string;
+		out->cvarvalues[i] = var->value;
+		if (!in->cvarstrings[i])
+		{	// first time current, start from the rules it was created under
+			in->cvarstrings[i] = (char *)Z_Malloc (Q_strlen(var->string)+1);
+			Q_strcpy (in->cvarstrings[i], var->string);
+			in->cvarvalues[i] = var->value;
+		}
+		var->string = in->cvarstrings[i];
+		var->value = in->cvarvalues[i];
+	}
+	out->skill = current_skill;
+	current_skill = in->skill;
+
+	sv_instance = in;
+	qcvm = &svs.qcvm;
+	if (pr_nativefunctions)
+		PR_BindNative ();
+}
+
+/*
+===============
+SV_RunningInstances
+===============
+*/
+int SV_RunningInstances (void)
+{
+	int		i, count;
+
+	count = 0;
+	for (i=0 ; i<sv_numinstances ; i++)
+		if (sv_instances[i].server.active)
+			count++;
+	return count;
+}
+
+/*
+===============
+SV_NewClientInstance
+
+The running instance new connections are given to, the first one with a
+free slot
+===============
+*/
+svinstance_t *SV_NewClientInstance (void)
+{
+	int		i;
+	svinstance_t	*in, *first;
+
+	first = NULL;
+	for (i=0, in=sv_instances ; i<sv_numinstances ; i++, in++)
+	{
+		if (!in->server.active)
+			continue;
+		if (in->stat.activeconnections < in->stat.maxclients)
+			return in;
+		if (!first)
+			first = in;
+	}
+	return first;
+}
+
+/*
+===============
+SV_InstanceCommand
+
+Queues a command the progs issued, to be executed for the instance that
+is current now
+===============
+*/
+void SV_InstanceCommand (char *text)
+{
+	char	cmd[1024];
+
+	if (sv_numinstances == 1)
+	{
+		Cbuf_AddText (text);
+		return;
+	}
+	Q_strncpy (cmd, text, sizeof(cmd)-1);	// text may be in the va buffer
+	cmd[sizeof(cmd)-1] = 0;
+	Cbuf_AddText (va("instance %i\n", (int)(sv_instance - sv_instances)));
+	Cbuf_AddText (cmd);
+	Cbuf_AddText (va("\ninstance %i\n", (int)(sv_cmdinstance - sv_instances)));
+}
+
+/*
+===============
+SV_InstanceMemory
+
+While it is the only one running, the level being spawned goes on top of
+the hunk, clear of the models kept at the bottom.  Otherwise it goes in the
+instance's own arena, so it can be thrown away later without disturbing the
+others.
+===============
+*/
+static void SV_InstanceMemory (int others)
+{
+	byte	*buf;
+	int		i, size;
+	svinstance_t	*in, *other;
+	hunkarena_t	*prev;
+
+	in = sv_instance;
+	for (i=0, other=sv_instances ; i<sv_numinstances ; i++, other++)
+		if (other->hunk == &other->high && (other == in || !others))
+		{	// there is never more than one, so it is all that's there
+			Hunk_FreeToHighMark (other->high.highmark);
+			other->hunk = NULL;
+		}
+
+	if (!others)
+	{
+		Hunk_InitHighArena (&in->high);
+		in->hunk = &in->high;
+		return;
+	}
+
+	if (!in->arena.base)
+	{
+		size = sv_instancemem;
+		if (!size)
+			size = INSTANCE_MEMORY + svs.maxedicts*INSTANCE_EDICT_MEMORY;
+		buf = (byte *)malloc (size + 15);
+		if (!buf)
+			Sys_Error ("Couldn't allocate %i megabytes for instance %i, lower -instancemem or -maxedicts",
+				size>>20, (int)(in - sv_instances));
+		buf = (byte *)(((intptr_t)buf + 15) & ~15);
+		Hunk_InitArena (&in->arena, buf, size);
+	}
+	else
+	{	// only what the last level used needs clearing
+		prev = Hunk_SetArena (&in->arena);
+		Hunk_FreeToLowMark (0);
+		Hunk_SetArena (prev);
+		in->arena.peak = 0;
+	}
+
+	in->hunk = &in->arena;
+}
+
+/*
+===============
+SV_ReleaseModels
+
+Lets go of the models the level held, called as it ends
+===============
+*/
+void SV_ReleaseModels (void)
+{
+	int		i;
+
+	for (i=0 ; i<MAX_MODELS ; i++)
+		if (sv.models[i])
+		{
+			Mod_Release (sv.models[i]);
+			sv.models[i] = NULL;
+		}
+}
+
+/*
+===============
+SV_Instance_f
+
+instance		lists the instances
+instance <n>	sends the following console commands to instance n
+===============
+*/
+void SV_Instance_f (void)
+{
+	int		i;
+	svinstance_t	*in;
+
+	if (Cmd_Argc() == 1)
+	{
+		for (i=0, in=sv_instances ; i<sv_numinstances ; i++, in++)
+		{
+			Con_Printf ("%c%2i ", in == sv_cmdinstance ? '*' : ' ', i);
+			if (!in->server.active)
+			{
+				Con_Printf ("not running\n");
+				continue;
+			}
+			Con_Printf ("%-16s %2i/%-2i %5ik of %ik%s\n", in->server.name, in->stat.activeconnections, in->stat.maxclients,
+				in->hunk->peak/1024, in->hunk->size/1024, in->hunk == &in->high ? " on the hunk" : "");
+		}
+		return;
+	}
+
+	i = Q_atoi (Cmd_Argv(1));
+	if (i < 0 || i >= sv_numinstances)
+	{
+		Con_Printf ("instance must be 0 to %i\n", sv_numinstances-1);
+		return;
+	}
+	SV_SetInstance (&sv_instances[i]);
+	sv_cmdinstance = sv_instance;
 }
 
 /*
@@ -149,13 +458,13 @@ void SV_StartSound (edict_t *entity, int channel, char *sample, int volume,
     
 	ent = NUM_FOR_EDICT(entity);
 
-	channel = (ent<<3) | channel;
-
 	field_mask = 0;
 	if (volume != DEFAULT_SOUND_PACKET_VOLUME)
 		field_mask |= SND_VOLUME;
 	if (attenuation != DEFAULT_SOUND_PACKET_ATTENUATION)
 		field_mask |= SND_ATTENUATION;
+	if (ent >= 8192)
+		field_mask |= SND_LARGEENTITY;	// doesn't fit in the channel short
 
 // directed messages go only to the entity the are targeted on
 	MSG_WriteByte (&sv.datagram, svc_sound);
@@ -164,7 +473,13 @@ void SV_StartSound (edict_t *entity, int channel, char *sample, int volume,
 		MSG_WriteByte (&sv.datagram, volume);
 	if (field_mask & SND_ATTENUATION)
 		MSG_WriteByte (&sv.datagram, attenuation*64);
-	MSG_WriteShort (&sv.datagram, channel);
+	if (field_mask & SND_LARGEENTITY)
+	{
+		MSG_WriteShort (&sv.datagram, ent);
+		MSG_WriteByte (&sv.datagram, channel);
+	}
+	else
+		MSG_WriteShort (&sv.datagram, (ent<<3) | channel);
 	MSG_WriteByte (&sv.datagram, sound_num);
 	for (i=0 ; i<3 ; i++)
 		MSG_WriteCoord (&sv.datagram, entity->v.origin[i]+0.5*(entity->v.mins[i]+entity->v.maxs[i]));
@@ -190,13 +505,15 @@ void SV_SendServerinfo (client_t *client)
 {
 	char			**s;
 	char			message[2048];
+	int				i;
+	packetframe_t	*frames;
 
 	MSG_WriteByte (&client->message, svc_print);
 	sprintf (message, "%c\nVERSION %4.2f SERVER (%i CRC)", 2, VERSION, pr_crc);
 	MSG_WriteString (&client->message,message);
 
 	MSG_WriteByte (&client->message, svc_serverinfo);
-	MSG_WriteLong (&client->message, PROTOCOL_VERSION);
+	MSG_WriteLong (&client->message, sv.protocol);
 	MSG_WriteByte (&client->message, svs.maxclients);
 
 	if (!coop.value && deathmatch.value)
@@ -230,6 +547,78 @@ void SV_SendServerinfo (client_t *client)
 
 	client->sendsignon = true;
 	client->spawned = false;		// need prespawn, spawn, etc
+	client->signonbuf = -1;
+
+// the new client state has nothing to delta from.  framecount keeps
+// counting over level changes, so a late ack can't match a new frame
+	client->ackframe = -1;
+	if (sv.clientframes)
+	{
+		frames = sv.clientframes + (client - svs.clients)*UPDATE_BACKUP;
+		for (i=0 ; i<UPDATE_BACKUP ; i++)
+			frames[i].sequence = -1;
+	}
+}
+
+/*
+================
+SV_WriteSignon
+
+Queues as much of the level signon as fits in the client's message.  Big
+maps can have more baselines and statics than one reliable message holds,
+so the rest is sent from SV_SendClientMessages as the earlier parts are
+acknowledged.  The signon stage is sent after the last buffer.
+================
+*/
+void SV_WriteSignon (client_t *client)
+{
+	sizebuf_t	*buf;
+
+	while (client->signonbuf < sv.num_signon_buffers)
+	{
+		buf = &sv.signon_buffers[client->signonbuf];
+		if (client->message.cursize + buf->cursize > client->message.maxsize)
+			break;
+		SZ_Write (&client->message, buf->data, buf->cursize);
+		client->signonbuf++;
+	}
+
+	if (client->signonbuf == sv.num_signon_buffers
+	&& client->message.cursize + sv.signon.cursize + 2 <= client->message.maxsize)
+	{
+		SZ_Write (&client->message, sv.signon.data, sv.signon.cursize);
+		MSG_WriteByte (&client->message, svc_signonnum);
+		MSG_WriteByte (&client->message, 2);
+		client->signonbuf = -1;
+	}
+
+	if (client->message.cursize)
+		client->sendsignon = true;	// make room for the rest
+}
+
+/*
+================
+SV_ReserveSignonSpace
+
+Starts a new signon buffer if the next message wouldn't fit in this one,
+so a message is never split between two packets.
+================
+*/
+void SV_ReserveSignonSpace (int bytes)
+{
+	hunkarena_t	*arena;
+
+	if (sv.signon.cursize + bytes <= sv.signon.maxsize)
+		return;
+
+	if (sv.num_signon_buffers == MAX_SIGNON_BUFFERS)
+		Host_Error ("SV_ReserveSignonSpace: too many signon buffers");
+
+	sv.signon_buffers[sv.num_signon_buffers++] = sv.signon;
+	arena = Hunk_SetArena (sv_instance->hunk);
+	sv.signon.data = (byte *)Hunk_AllocName (MAX_SIGNON, "signon");
+	Hunk_SetArena (arena);
+	sv.signon.cursize = 0;
 }
 
 /*
@@ -272,6 +661,8 @@ void SV_ConnectClient (int clientnum)
 	client->message.data = client->msgbuf;
 	client->message.maxsize = sizeof(client->msgbuf);
 	client->message.allowoverflow = true;		// we can catch it
+	client->datagram.data = client->datagram_buf;
+	client->datagram.maxsize = sizeof(client->datagram_buf);
 
 #ifdef IDGODS
 	client->privileged = IsID(&client->netconnection->addr);
@@ -284,7 +675,7 @@ void SV_ConnectClient (int clientnum)
 	else
 	{
 	// call the progs to get default spawn parms for the _new client
-		PR_ExecuteProgram (pr_global_struct->SetNewParms);
+		PR_ExecuteProgram (sv.qcvm, pr_global_struct->SetNewParms);
 		for (i=0 ; i<NUM_SPAWN_PARMS ; i++)
 			client->spawn_parms[i] = (&pr_global_struct->parm1)[i];
 	}
@@ -325,7 +716,7 @@ void SV_CheckForNewClients (void)
 		svs.clients[i].netconnection = ret;
 		SV_ConnectClient (i);	
 	
-		net_activeconnections++;
+		svs.activeconnections++;
 	}
 }
 
@@ -361,13 +752,128 @@ crosses a waterline.
 =============================================================================
 */
 
-int		fatbytes;
-byte	fatpvs[MAX_MAP_LEAFS/8];
+/*
+=============
+SV_NextPVSUse
+
+Bumps the LRU counter of the PVS caches.  Long before it could overflow,
+every entry is moved down by the same amount, those older than
+PVS_USE_KEEP all to 0, so the entries used lately keep their order.
+=============
+*/
+#define	PVS_USE_LIMIT	0x40000000
+#define	PVS_USE_KEEP	0x100000	// far more than a frame uses
+
+static void SV_NextPVSUse (void)
+{
+	int		i, shift;
+
+	if (++sv.pvsused < PVS_USE_LIMIT)
+		return;
+
+	shift = sv.pvsused - PVS_USE_KEEP;
+	for (i=0 ; i<MAX_PVS_CACHE ; i++)
+		sv.pvscache[i].lastused = sv.pvscache[i].lastused > shift ? sv.pvscache[i].lastused - shift : 0;
+	for (i=0 ; i<MAX_FAT_CACHE ; i++)
+		sv.fatcache[i].lastused = sv.fatcache[i].lastused > shift ? sv.fatcache[i].lastused - shift : 0;
+	sv.pvsused -= shift;
+}
+
+/*
+=============
+SV_LeafPVS
+
+The decompressed PVS row of a leaf, straight from the world's PVS table
+when it has one, else from a small LRU cache of rows.  The row is only
+good until the next call
+=============
+*/
+unsigned *SV_LeafPVS (mleaf_t *leaf)
+{
+	int			i;
+	pvscache_t	*c, *best;
+	byte		*pvs;
+
+	if (sv.worldmodel->pvstable)
+	{	// the table's rows stay good, there is nothing to cache
+		i = leaf - sv.worldmodel->leafs - 1;
+		if (i >= 0 && i < sv.worldmodel->numleafs)
+			return (unsigned *)(sv.worldmodel->pvstable + i*sv.worldmodel->pvsrowbytes);
+	}
+
+	SV_NextPVSUse ();
+
+	best = sv.pvscache;
+	for (i=0, c = sv.pvscache ; i<MAX_PVS_CACHE ; i++, c++)
+	{
+		if (c->leaf == leaf)
+		{
+			c->lastused = sv.pvsused;
+			return c->row;
+		}
+		if (c->lastused < best->lastused)
+			best = c;
+	}
+
+	pvs = Mod_LeafPVS (leaf, sv.worldmodel, (byte *)best->row);
+	if (pvs != (byte *)best->row)
+		memcpy (best->row, pvs, (sv.worldmodel->numleafs+7)>>3);
+	best->leaf = leaf;
+	best->lastused = sv.pvsused;
+	return best->row;
+}
+
+/*
+=============
+SV_FindFatLeafs
+
+Lists the leafs within 8 units of the point, false if there are more
+than MAX_FAT_LEAFS
+=============
+*/
+qboolean SV_FindFatLeafs (const vec3_t & org, mnode_t *node, fatcache_t *fat)
+{
+	mplane_t	*plane;
+	float	d;
+
+	while (1)
+	{
+		if (node->contents < 0)
+		{
+			if (node->contents == CONTENTS_SOLID)
+				return true;
+			if (fat->numleafs == MAX_FAT_LEAFS)
+				return false;
+			fat->leafs[fat->numleafs++] = (mleaf_t *)node;
+			return true;
+		}
+	
+		plane = node->plane;
+		d = DotProduct (org, plane->normal) - plane->dist;
+		if (d > 8)
+			node = node->children[0];
+		else if (d < -8)
+			node = node->children[1];
+		else
+		{	// go down both
+			if (!SV_FindFatLeafs (org, node->children[0], fat))
+				return false;
+			node = node->children[1];
+		}
+	}
+}
+
+/*
+=============
+SV_AddToFatPVS
 
-void SV_AddToFatPVS (const vec3_t & org, mnode_t *node)
+Used when the point touches too many leafs to be a cache key
+=============
+*/
+void SV_AddToFatPVS (const vec3_t & org, mnode_t *node, unsigned *fatpvs)
 {
 	int		i;
-	byte	*pvs;
+	unsigned	*pvs;
 	mplane_t	*plane;
 	float	d;
 
@@ -378,8 +884,8 @@ void SV_AddToFatPVS (const vec3_t & org, mnode_t *node)
 		{
 			if (node->contents != CONTENTS_SOLID)
 			{
-				pvs = Mod_LeafPVS ( (mleaf_t *)node, sv.worldmodel);
-				for (i=0 ; i<fatbytes ; i++)
+				pvs = SV_LeafPVS ((mleaf_t *)node);
+				for (i=0 ; i<sv.pvswords ; i++)
 					fatpvs[i] |= pvs[i];
 			}
 			return;
@@ -393,7 +899,7 @@ void SV_AddToFatPVS (const vec3_t & org, mnode_t *node)
 			node = node->children[1];
 		else
 		{	// go down both
-			SV_AddToFatPVS (org, node->children[0]);
+			SV_AddToFatPVS (org, node->children[0], fatpvs);
 			node = node->children[1];
 		}
 	}
@@ -405,14 +911,84 @@ SV_FatPVS
 
 Calculates a PVS that is the inclusive or of all leafs within 8 pixels of the
 given point.
+
+The results are kept in an LRU cache keyed by the leafs the point touches,
+so players that stand still or close together cost almost nothing.  With
+MAX_FAT_CACHE > MAX_SCOREBOARD the rows returned for every client in a
+frame stay valid until the next frame.
 =============
 */
 byte *SV_FatPVS (const vec3_t & org)
 {
-	fatbytes = (sv.worldmodel->numleafs+31)>>3;
-	Q_memset (fatpvs, 0, fatbytes);
-	SV_AddToFatPVS (org, sv.worldmodel->nodes);
-	return fatpvs;
+	int			i, j;
+	unsigned	*pvs;
+	fatcache_t	key, *c, *best;
+
+	key.numleafs = 0;
+	if (!SV_FindFatLeafs (org, sv.worldmodel->nodes, &key))
+		key.numleafs = -1;		// never matches
+
+	SV_NextPVSUse ();
+
+	best = sv.fatcache;
+	for (i=0, c = sv.fatcache ; i<MAX_FAT_CACHE ; i++, c++)
+	{
+		if (key.numleafs >= 0 && c->numleafs == key.numleafs
+		&& !memcmp (c->leafs, key.leafs, key.numleafs*sizeof(key.leafs[0])))
+		{
+			c->lastused = sv.pvsused;
+			return (byte *)c->row;
+		}
+		if (c->lastused < best->lastused)
+			best = c;
+	}
+
+	best->numleafs = key.numleafs;
+	memcpy (best->leafs, key.leafs, sizeof(key.leafs));
+	best->lastused = sv.pvsused;
+
+	memset (best->row, 0, sv.pvswords*sizeof(unsigned));
+	if (key.numleafs < 0)
+		SV_AddToFatPVS (org, sv.worldmodel->nodes, best->row);
+	else
+	{
+		for (i=0 ; i<key.numleafs ; i++)
+		{
+			pvs = SV_LeafPVS (key.leafs[i]);
+			for (j=0 ; j<sv.pvswords ; j++)
+				best->row[j] |= pvs[j];
+		}
+	}
+
+	return (byte *)best->row;
+}
+
+/*
+=============
+SV_ClearPVSCache
+
+Sets up the caches for a new world model
+=============
+*/
+void SV_ClearPVSCache (void)
+{
+	int		i;
+
+	sv.pvswords = (sv.worldmodel->numleafs+31)>>5;
+	sv.pvsused = 0;
+
+	for (i=0 ; i<MAX_PVS_CACHE ; i++)
+	{
+		sv.pvscache[i].leaf = NULL;
+		sv.pvscache[i].lastused = 0;
+		sv.pvscache[i].row = (unsigned *)Hunk_AllocName (sv.pvswords*sizeof(unsigned), "pvscache");
+	}
+	for (i=0 ; i<MAX_FAT_CACHE ; i++)
+	{
+		sv.fatcache[i].numleafs = -1;
+		sv.fatcache[i].lastused = 0;
+		sv.fatcache[i].row = (unsigned *)Hunk_AllocName (sv.pvswords*sizeof(unsigned), "pvscache");
+	}
 }
 
 //=============================================================================
@@ -420,131 +996,419 @@ byte *SV_FatPVS (const vec3_t & org)
 
 /*
 =============
-SV_WriteEntitiesToClient
+SV_WriteEntityUpdate
+
+Writes the fields of ent selected by bits as a fast update
+=============
+*/
+void SV_WriteEntityUpdate (int e, edict_t *ent, int bits, sizebuf_t *msg)
+{
+	if (e >= 256)
+		bits |= U_LONGENTITY;
+		
+	if (bits >= 256)
+		bits |= U_MOREBITS;
+
+	MSG_WriteByte (msg,bits | U_SIGNAL);
+	
+	if (bits & U_MOREBITS)
+		MSG_WriteByte (msg, bits>>8);
+	if (bits & U_LONGENTITY)
+		MSG_WriteShort (msg,e);
+	else
+		MSG_WriteByte (msg,e);
+
+	if (bits & U_MODEL)
+		MSG_WriteByte (msg,	ent->v.modelindex);
+	if (bits & U_FRAME)
+		MSG_WriteByte (msg, ent->v.frame);
+	if (bits & U_COLORMAP)
+		MSG_WriteByte (msg, ent->v.colormap);
+	if (bits & U_SKIN)
+		MSG_WriteByte (msg, ent->v.skin);
+	if (bits & U_EFFECTS)
+		MSG_WriteByte (msg, ent->v.effects);
+	if (bits & U_ORIGIN1)
+		MSG_WriteCoord (msg, ent->v.origin[0]);		
+	if (bits & U_ANGLE1)
+		MSG_WriteAngle(msg, ent->v.angles[0]);
+	if (bits & U_ORIGIN2)
+		MSG_WriteCoord (msg, ent->v.origin[1]);
+	if (bits & U_ANGLE2)
+		MSG_WriteAngle(msg, ent->v.angles[1]);
+	if (bits & U_ORIGIN3)
+		MSG_WriteCoord (msg, ent->v.origin[2]);
+	if (bits & U_ANGLE3)
+		MSG_WriteAngle(msg, ent->v.angles[2]);
+}
+
+/*
+=============
+SV_EncodeEntity
+
+The update for an entity is the same for every client that can see it,
+so it is only built for the first one each frame
+=============
+*/
+void SV_EncodeEntity (int e, edict_t *ent, entupdate_t *up)
+{
+	int			i;
+	int			bits;
+	float		miss;
+	sizebuf_t	buf;
+
+	buf.data = up->data;
+	buf.maxsize = sizeof(up->data);
+	buf.cursize = 0;
+	buf.allowoverflow = false;
+	buf.overflowed = false;
+
+	bits = 0;
+	
+	for (i=0 ; i<3 ; i++)
+	{
+		miss = ent->v.origin[i] - ent->baseline.origin[i];
+		if ( miss < -0.1 || miss > 0.1 )
+			bits |= U_ORIGIN1<<i;
+	}
+
+	if ( ent->v.angles[0] != ent->baseline.angles[0] )
+		bits |= U_ANGLE1;
+		
+	if ( ent->v.angles[1] != ent->baseline.angles[1] )
+		bits |= U_ANGLE2;
+		
+	if ( ent->v.angles[2] != ent->baseline.angles[2] )
+		bits |= U_ANGLE3;
+		
+	if (ent->v.movetype == MOVETYPE_STEP)
+		bits |= U_NOLERP;	// don't mess up the step animation
+	
+	if (ent->baseline.colormap != ent->v.colormap)
+		bits |= U_COLORMAP;
+		
+	if (ent->baseline.skin != ent->v.skin)
+		bits |= U_SKIN;
+		
+	if (ent->baseline.frame != ent->v.frame)
+		bits |= U_FRAME;
+	
+	if (ent->baseline.effects != ent->v.effects)
+		bits |= U_EFFECTS;
+	
+	if (ent->baseline.modelindex != ent->v.modelindex)
+		bits |= U_MODEL;
+
+	SV_WriteEntityUpdate (e, ent, bits, &buf);
+
+	up->size = buf.cursize;
+	up->sendframe = sv.sendframe;
+}
+
+/*
+=============
+SV_QuantizeState
+
+Rounds a state the way the client will read it back from a message
+=============
+*/
+void SV_QuantizeState (entity_state_t *s)
+{
+	int		i;
+
+	for (i=0 ; i<3 ; i++)
+	{
+		s->origin[i] = (short)(int)(s->origin[i]*8) * (1.0/8);
+		s->angles[i] = (signed char)(((int)s->angles[i]*256/360) & 255) * (360.0/256);
+	}
+	s->modelindex &= 255;
+	s->frame &= 255;
+	s->colormap &= 255;
+	s->skin &= 255;
+	s->effects &= 255;
+}
+
+/*
+=============
+SV_DeltaBits
 
+The update bits needed to take the client from one quantized state
+to the other
 =============
 */
-void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
+int SV_DeltaBits (entity_state_t *from, entity_state_t *to)
 {
-	int		e, i;
+	int		i;
 	int		bits;
-	byte	*pvs;
-	vec3_t	org;
-	float	miss;
-	edict_t	*ent;
 
-// find the client's PVS
-	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
-	pvs = SV_FatPVS (org);
+	bits = 0;
 
-// send over all entities (excpet the client) that touch the pvs
-	ent = NEXT_EDICT(sv.edicts);
-	for (e=1 ; e<sv.num_edicts ; e++, ent = NEXT_EDICT(ent))
+	for (i=0 ; i<3 ; i++)
+		if (from->origin[i] != to->origin[i])
+			bits |= U_ORIGIN1<<i;
+
+	if (from->angles[0] != to->angles[0])
+		bits |= U_ANGLE1;
+	if (from->angles[1] != to->angles[1])
+		bits |= U_ANGLE2;
+	if (from->angles[2] != to->angles[2])
+		bits |= U_ANGLE3;
+
+	if (from->modelindex != to->modelindex)
+		bits |= U_MODEL;
+	if (from->frame != to->frame)
+		bits |= U_FRAME;
+	if (from->colormap != to->colormap)
+		bits |= U_COLORMAP;
+	if (from->skin != to->skin)
+		bits |= U_SKIN;
+	if (from->effects != to->effects)
+		bits |= U_EFFECTS;
+
+	return bits;
+}
+
+/*
+=============
+SV_DropPacketEntity
+
+An entity of the acknowledged frame that isn't visible any more.
+Once the packet is full it stays in the new frame, because the client
+keeps every old entity the message doesn't mention
+=============
+*/
+qboolean SV_DropPacketEntity (packetentity_t *old, packetframe_t *to, qboolean full, sizebuf_t *msg)
+{
+	if (!full && msg->maxsize - msg->cursize < 21)
+		full = true;
+
+	if (full)
+		to->entities[to->num_entities++] = *old;
+	else
+		SV_WriteEntityUpdate (old->number, sv.edicts, U_REMOVE, msg);
+
+	return full;
+}
+
+/*
+=============
+SV_WritePacketEntities
+
+PROTOCOL_DELTA: the visible entities are sent as a delta against the last
+frame the client acknowledged, or against the baselines if that frame is
+too old.  The new frame is remembered so it can be delta'd from when the
+client acks it.
+=============
+*/
+void SV_WritePacketEntities (client_t *client, unsigned *visents, int numwords, sizebuf_t *msg)
+{
+	int				e, i, bits;
+	int				oldindex, oldmax;
+	unsigned		vis;
+	qboolean		full;
+	edict_t			*ent, *clent;
+	packetframe_t	*frames, *from, *to;
+	packetentity_t	*old;
+	entity_state_t	state, base;
+
+	if (msg->maxsize - msg->cursize < 10)
+	{
+		msg->overflowed = true;
+		return;
+	}
+
+	frames = sv.clientframes + (client - svs.clients)*UPDATE_BACKUP;
+	from = NULL;
+	if (client->ackframe >= 0 && client->framecount - client->ackframe < UPDATE_BACKUP)
 	{
+		from = &frames[client->ackframe & UPDATE_MASK];
+		if (from->sequence != client->ackframe)
+			from = NULL;
+	}
+	to = &frames[client->framecount & UPDATE_MASK];
+
+	MSG_WriteByte (msg, svc_packetentities);
+	MSG_WriteLong (msg, client->framecount);
+	MSG_WriteLong (msg, from ? from->sequence : -1);
+
+	to->sequence = client->framecount++;
+	to->num_entities = 0;
+	client->droppedentities = 0;
+
+	oldindex = 0;
+	oldmax = from ? from->num_entities : 0;
+	full = false;
+	clent = client->edict;
+
+// merge the visible entities with the old frame, both in number order
+	for (i=0 ; i<numwords ; i++)
+	{
+		for (vis = visents[i], e = i<<5 ; vis ; vis >>= 1, e++)
+		{
+			if (!(vis & 1))
+				continue;
+			if (e == 0 || e >= sv.num_edicts)
+				continue;
+			ent = EDICT_NUM(e);
+
 #ifdef QUAKE2
-		// don't send if flagged for NODRAW and there are no lighting effects
-		if (ent->v.effects == EF_NODRAW)
-			continue;
+			// don't send if flagged for NODRAW and there are no lighting effects
+			if (ent->v.effects == EF_NODRAW)
+				continue;
 #endif
 
-// ignore if not touching a PV leaf
-		if (ent != clent)	// clent is ALLWAYS sent
-		{
 // ignore ents without visible models
-			if (!ent->v.modelindex || !pr_strings[ent->v.model])
+			if (ent != clent && (!ent->v.modelindex || !pr_strings[ent->v.model]))
 				continue;
 
-			for (i=0 ; i < ent->num_leafs ; i++)
-				if (pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i]&7) ))
-					break;
-				
-			if (i == ent->num_leafs)
-				continue;		// not visible
+			while (oldindex < oldmax && from->entities[oldindex].number < e)
+				full = SV_DropPacketEntity (&from->entities[oldindex++], to, full, msg);
+
+			old = NULL;
+			if (oldindex < oldmax && from->entities[oldindex].number == e)
+				old = &from->entities[oldindex++];
+
+			if (!full && msg->maxsize - msg->cursize < 21)
+				full = true;
+			if (full)
+			{
+				if (old)
+					to->entities[to->num_entities++] = *old;
+				continue;
+			}
+
+		// what's left of the old frame must still fit after a new entity,
+		// the ones that don't are counted for SV_SendClientDatagram
+			if (!old && to->num_entities + oldmax - oldindex >= MAX_PACKET_ENTITIES)
+			{
+				client->droppedentities++;
+				continue;
+			}
+
+			VectorCopy (ent->v.origin, state.origin);
+			VectorCopy (ent->v.angles, state.angles);
+			state.modelindex = ent->v.modelindex;
+			state.frame = ent->v.frame;
+			state.colormap = ent->v.colormap;
+			state.skin = ent->v.skin;
+			state.effects = ent->v.effects;
+			SV_QuantizeState (&state);
+
+			if (old)
+				bits = SV_DeltaBits (&old->state, &state);
+			else
+			{
+				base = ent->baseline;
+				base.effects = 0;		// not sent with the baseline
+				SV_QuantizeState (&base);
+				bits = SV_DeltaBits (&base, &state);
+			}
+
+			if (bits && ent->v.movetype == MOVETYPE_STEP)
+				bits |= U_NOLERP;	// don't mess up the step animation
+
+			if (bits || !old)
+				SV_WriteEntityUpdate (e, ent, bits, msg);
+
+			to->entities[to->num_entities].number = e;
+			to->entities[to->num_entities].state = state;
+			to->num_entities++;
 		}
+	}
+
+	while (oldindex < oldmax)
+		full = SV_DropPacketEntity (&from->entities[oldindex++], to, full, msg);
 
-		if (msg->maxsize - msg->cursize < 16)
+	if (full)
+		msg->overflowed = true;		// reported by SV_SendClientDatagram
+
+	MSG_WriteByte (msg, 0);
+}
+
+/*
+=============
+SV_WriteEntitiesToClient
+
+Only the entities in the leafs of the client's PVS are looked at
+=============
+*/
+void SV_WriteEntitiesToClient (client_t *client, sizebuf_t *msg)
+{
+	int			e, i, leaf, numleafs, numwords;
+	unsigned	vis, *visents;
+	byte		*pvs;
+	edict_t		*ent, *clent;
+	link_t		*l, *head;
+	entupdate_t	*up;
+
+	clent = client->edict;
+	pvs = client->fatpvs;
+
+// mark the entities touching a visible leaf, the bits keep them in
+// entity number order
+	visents = sv.visents + (client - svs.clients)*((sv.max_edicts+31)>>5);
+	numwords = (sv.num_edicts+31)>>5;
+	memset (visents, 0, numwords*sizeof(unsigned));
+
+	numleafs = sv.worldmodel->numleafs;
+	for (leaf=0 ; leaf<numleafs ; leaf++)
+	{
+		if (!pvs[leaf>>3])
 		{
-			Con_Printf ("packet overflow\n");
-			return;
+			leaf |= 7;
+			continue;
 		}
-
-// send an update
-		bits = 0;
-		
-		for (i=0 ; i<3 ; i++)
+		if (!(pvs[leaf>>3] & (1<<(leaf&7))))
+			continue;
+		head = &sv.leafents[leaf];
+		for (l = head->next ; l != head ; l = l->next)
 		{
-			miss = ent->v.origin[i] - ent->baseline.origin[i];
-			if ( miss < -0.1 || miss > 0.1 )
-				bits |= U_ORIGIN1<<i;
+			e = (l - sv.leaflinks) / MAX_ENT_LEAFS;
+			visents[e>>5] |= 1u<<(e&31);
 		}
+	}
 
-		if ( ent->v.angles[0] != ent->baseline.angles[0] )
-			bits |= U_ANGLE1;
-			
-		if ( ent->v.angles[1] != ent->baseline.angles[1] )
-			bits |= U_ANGLE2;
-			
-		if ( ent->v.angles[2] != ent->baseline.angles[2] )
-			bits |= U_ANGLE3;
-			
-		if (ent->v.movetype == MOVETYPE_STEP)
-			bits |= U_NOLERP;	// don't mess up the step animation
-	
-		if (ent->baseline.colormap != ent->v.colormap)
-			bits |= U_COLORMAP;
-			
-		if (ent->baseline.skin != ent->v.skin)
-			bits |= U_SKIN;
-			
-		if (ent->baseline.frame != ent->v.frame)
-			bits |= U_FRAME;
-		
-		if (ent->baseline.effects != ent->v.effects)
-			bits |= U_EFFECTS;
-		
-		if (ent->baseline.modelindex != ent->v.modelindex)
-			bits |= U_MODEL;
+	e = NUM_FOR_EDICT(clent);		// clent is ALLWAYS sent
+	visents[e>>5] |= 1u<<(e&31);
 
-		if (e >= 256)
-			bits |= U_LONGENTITY;
-			
-		if (bits >= 256)
-			bits |= U_MOREBITS;
+	if (sv.protocol == PROTOCOL_DELTA)
+	{
+		SV_WritePacketEntities (client, visents, numwords, msg);
+		return;
+	}
 
-	//
-	// write the message
-	//
-		MSG_WriteByte (msg,bits | U_SIGNAL);
-		
-		if (bits & U_MOREBITS)
-			MSG_WriteByte (msg, bits>>8);
-		if (bits & U_LONGENTITY)
-			MSG_WriteShort (msg,e);
-		else
-			MSG_WriteByte (msg,e);
-
-		if (bits & U_MODEL)
-			MSG_WriteByte (msg,	ent->v.modelindex);
-		if (bits & U_FRAME)
-			MSG_WriteByte (msg, ent->v.frame);
-		if (bits & U_COLORMAP)
-			MSG_WriteByte (msg, ent->v.colormap);
-		if (bits & U_SKIN)
-			MSG_WriteByte (msg, ent->v.skin);
-		if (bits & U_EFFECTS)
-			MSG_WriteByte (msg, ent->v.effects);
-		if (bits & U_ORIGIN1)
-			MSG_WriteCoord (msg, ent->v.origin[0]);		
-		if (bits & U_ANGLE1)
-			MSG_WriteAngle(msg, ent->v.angles[0]);
-		if (bits & U_ORIGIN2)
-			MSG_WriteCoord (msg, ent->v.origin[1]);
-		if (bits & U_ANGLE2)
-			MSG_WriteAngle(msg, ent->v.angles[1]);
-		if (bits & U_ORIGIN3)
-			MSG_WriteCoord (msg, ent->v.origin[2]);
-		if (bits & U_ANGLE3)
-			MSG_WriteAngle(msg, ent->v.angles[2]);
+// send over all entities (excpet the world) that touch the pvs
+	for (i=0 ; i<numwords ; i++)
+	{
+		for (vis = visents[i], e = i<<5 ; vis ; vis >>= 1, e++)
+		{
+			if (!(vis & 1))
+				continue;
+			if (e == 0 || e >= sv.num_edicts)
+				continue;
+			ent = EDICT_NUM(e);
+
+#ifdef QUAKE2
+			// don't send if flagged for NODRAW and there are no lighting effects
+			if (ent->v.effects == EF_NODRAW)
+				continue;
+#endif
+
+// ignore ents without visible models
+			if (ent != clent && (!ent->v.modelindex || !pr_strings[ent->v.model]))
+				continue;
+
+			if (msg->maxsize - msg->cursize < 16)
+			{
+				msg->overflowed = true;		// reported by SV_SendClientDatagram
+				return;
+			}
+
+			up = &sv.entupdates[e];
+			if (up->sendframe != sv.sendframe)
+				SV_EncodeEntity (e, ent, up);
+			SZ_Write (msg, up->data, up->size);
+		}
 	}
 }
 
@@ -601,9 +1465,9 @@ void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg)
 
 //
 // send the current viewpos offset from the view entity
+// (idealpitch has been set by SV_SetIdealPitch, it traces so it can't
+// be done from the threads building the datagrams)
 //
-	SV_SetIdealPitch ();		// how much to look up / down ideally
-
 // a fixangle might get lost in a dropped packet.  Oh well.
 	if ( ent->v.fixangle )
 	{
@@ -714,32 +1578,87 @@ void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg)
 
 /*
 =======================
-SV_SendClientDatagram
+SV_EncodeEntities
+
+Fills sv.entupdates before the datagrams are built on several threads,
+for every entity SV_WriteEntitiesToClient could send
 =======================
 */
-qboolean SV_SendClientDatagram (client_t *client)
+#define	ENCODE_CHUNK	64
+
+void SV_EncodeEntities (int work)
 {
-	byte		buf[MAX_DATAGRAM];
-	sizebuf_t	msg;
-	
-	msg.data = buf;
-	msg.maxsize = sizeof(buf);
-	msg.cursize = 0;
+	int			e, last;
+	edict_t		*ent;
+
+	e = work*ENCODE_CHUNK + 1;
+	last = e + ENCODE_CHUNK;
+	if (last > sv.num_edicts)
+		last = sv.num_edicts;
 
-	MSG_WriteByte (&msg, svc_time);
-	MSG_WriteFloat (&msg, sv.time);
+	for (ent = EDICT_NUM(e) ; e<last ; e++, ent = NEXT_EDICT(ent))
+	{
+		if (e > svs.maxclients && (!ent->v.modelindex || !pr_strings[ent->v.model]))
+			continue;
+		SV_EncodeEntity (e, ent, &sv.entupdates[e]);
+	}
+}
+
+/*
+=======================
+SV_BuildClientDatagram
+
+Everything in a client's datagram but sv.datagram.  The datagrams are
+built by Sys_RunThreadsOn after the physics has run, so this can only
+write to the client and its own edict
+=======================
+*/
+client_t	*sv_buildclients[MAX_SCOREBOARD];
+
+void SV_BuildClientDatagram (int work)
+{
+	client_t	*client;
+	sizebuf_t	*msg;
+
+	client = sv_buildclients[work];
+	msg = &client->datagram;
+	msg->cursize = 0;
+	msg->overflowed = false;
+
+	MSG_WriteByte (msg, svc_time);
+	MSG_WriteFloat (msg, sv.time);
 
 // add the client specific data to the datagram
-	SV_WriteClientdataToMessage (client->edict, &msg);
+	SV_WriteClientdataToMessage (client->edict, msg);
+
+	SV_WriteEntitiesToClient (client, msg);
+}
+
+/*
+=======================
+SV_SendClientDatagram
+=======================
+*/
+qboolean SV_SendClientDatagram (client_t *client)
+{
+	sizebuf_t	*msg;
 
-	SV_WriteEntitiesToClient (client->edict, &msg);
+	msg = &client->datagram;
+	if (msg->overflowed)
+		Con_Printf ("packet overflow\n");
+	if (client->droppedentities)
+	{
+		sv.droppedentities += client->droppedentities;
+		Con_DPrintf ("%s: %i visible entities over the %i in a frame\n", client->name, client->droppedentities, MAX_PACKET_ENTITIES);
+		client->droppedentities = 0;
+	}
 
 // copy the server datagram if there is space
-	if (msg.cursize + sv.datagram.cursize < msg.maxsize)
-		SZ_Write (&msg, sv.datagram.data, sv.datagram.cursize);
+	if (msg->cursize + sv.datagram.cursize < msg->maxsize)
+		SZ_Write (msg, sv.datagram.data, sv.datagram.cursize);
 
 // send the datagram
-	if (NET_SendUnreliableMessage (client->netconnection, &msg) == -1)
+	if (NET_SendUnreliableMessage (client->netconnection, msg) == -1)
 	{
 		SV_DropClient (true);// if the message couldn't send, kick off
 		return false;
@@ -818,12 +1737,45 @@ SV_SendClientMessages
 */
 void SV_SendClientMessages (void)
 {
-	int			i;
+	int			i, numbuild;
+	vec3_t		org;
 	
 // update frags, names, etc
 	SV_UpdateToReliableMessages ();
 
-// build individual updates
+	sv.sendframe++;		// entity updates have to be encoded again
+
+// build the datagrams of all the spawned clients at once
+	numbuild = 0;
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	{
+		if (!host_client->active || !host_client->spawned)
+			continue;
+		sv_player = host_client->edict;
+		SV_SetIdealPitch ();		// how much to look up / down ideally
+
+	// the pvs cache isn't thread safe either
+		VectorAdd (sv_player->v.origin, sv_player->v.view_ofs, org);
+		host_client->fatpvs = SV_FatPVS (org);
+
+		sv_buildclients[numbuild++] = host_client;
+	}
+
+	if (numbuild > 1 && Sys_NumThreads () > 1)
+	{
+	// the encoding cache is filled in by the first client to see an
+	// entity, which can't be done from several threads
+		if (sv.protocol != PROTOCOL_DELTA)
+			Sys_RunThreadsOn ((sv.num_edicts+ENCODE_CHUNK-2)/ENCODE_CHUNK, SV_EncodeEntities);
+		Sys_RunThreadsOn (numbuild, SV_BuildClientDatagram);
+	}
+	else
+	{
+		for (i=0 ; i<numbuild ; i++)
+			SV_BuildClientDatagram (i);
+	}
+
+// send them and the reliable messages
 	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
 	{
 		if (!host_client->active)
@@ -841,6 +1793,8 @@ void SV_SendClientMessages (void)
 		// send a full message when the next signon stage has been requested
 		// some other message data (name changes, etc) may accumulate 
 		// between signon stages
+			if (host_client->signonbuf >= 0)
+				SV_WriteSignon (host_client);
 			if (!host_client->sendsignon)
 			{
 				if (realtime - host_client->last_message > 5)
@@ -959,6 +1913,7 @@ void SV_CreateBaseline (void)
 	//
 	// add to the message
 	//
+		SV_ReserveSignonSpace (16);
 		MSG_WriteByte (&sv.signon,svc_spawnbaseline);		
 		MSG_WriteShort (&sv.signon,entnum);
 
@@ -1025,7 +1980,7 @@ void SV_SaveSpawnparms (void)
 
 	// call the progs to get default spawn parms for the _new client
 		pr_global_struct->self = EDICT_TO_PROG(host_client->edict);
-		PR_ExecuteProgram (pr_global_struct->SetChangeParms);
+		PR_ExecuteProgram (sv.qcvm, pr_global_struct->SetChangeParms);
 		for (j=0 ; j<NUM_SPAWN_PARMS ; j++)
 			host_client->spawn_parms[j] = (&pr_global_struct->parm1)[j];
 	}
@@ -1048,7 +2003,9 @@ void SV_SpawnServer (char *server)
 #endif
 {
 	edict_t		*ent;
-	int			i;
+	int			i, others;
+	double		frametime;
+	hunkarena_t	*arena;
 
 	// let's not have any servers with no name
 	if (hostname.string[0] == 0)
@@ -1080,11 +2037,21 @@ void SV_SpawnServer (char *server)
 	Cvar_SetValue ("skill", (float)current_skill);
 	
 //
-// set up the _new server
+// set up the _new server, keeping the models the next level may want
 //
-	Host_ClearMemory ();
+	SV_ReleaseModels ();
+	for (i=0, others=0 ; i<sv_numinstances ; i++)
+		if (&sv_instances[i] != sv_instance && sv_instances[i].server.active)
+			others++;
+	if (others)
+		Mod_ClearUnused ();
+	else
+		Host_ClearMemory ();
+	SV_InstanceMemory (others);
+	arena = Hunk_SetArena (sv_instance->hunk);
 
 	memset (&sv, 0, sizeof(sv));
+	ClearLink (&sv.free_edicts);
 
 	strcpy (sv.name, server);
 #ifdef QUAKE2
@@ -1093,12 +2060,39 @@ void SV_SpawnServer (char *server)
 #endif
 
 // load progs to get entity field count
-	PR_LoadProgs ();
-
-// allocate server memory
-	sv.max_edicts = MAX_EDICTS;
+	sv.qcvm = &svs.qcvm;
+	PR_LoadProgs (sv.qcvm);
+
+// allocate server memory, with every edict starting on a cache line
+	sv.max_edicts = svs.maxedicts;
+	// rather than running out partway through the edicts and their tables
+	if (sv_instance->hunk->base && sv_instance->hunk->size - sv_instance->hunk->used < sv.max_edicts*(pr_edict_size+INSTANCE_EDICT_MEMORY/2))
+		Sys_Error ("%i edicts don't fit in instance %i's %i megabytes, raise -instancemem",
+			sv.max_edicts, (int)(sv_instance - sv_instances), sv_instance->hunk->size>>20);
 	
-	sv.edicts = (edict_t *)Hunk_AllocName (sv.max_edicts*pr_edict_size, "edicts");
+	sv.edicts = (edict_t *)Hunk_AllocName (sv.max_edicts*pr_edict_size + CACHE_SIZE-1, "edicts");
+	sv.edicts = (edict_t *)(((intptr_t)sv.edicts + CACHE_SIZE-1) & ~(CACHE_SIZE-1));
+
+	sv.moved_edict = (edict_t **)Hunk_AllocName (sv.max_edicts*sizeof(edict_t *), "moved");
+	sv.moved_from = (vec3_t *)Hunk_AllocName (sv.max_edicts*sizeof(vec3_t), "moved");
+
+	sv.physdirty = (byte *)Hunk_AllocName (sv.max_edicts, "physics");
+	sv.physstate = (byte *)Hunk_AllocName (sv.max_edicts, "physics");
+	sv.physthink = (float *)Hunk_AllocName (sv.max_edicts*sizeof(float), "physics");
+	SV_WakeAllEdicts ();
+	ED_ClearFindIndex ();
+
+	sv.visents = (unsigned *)Hunk_AllocName (svs.maxclients*((sv.max_edicts+31)>>5)*sizeof(unsigned), "visents");
+	sv.entupdates = (entupdate_t *)Hunk_AllocName (sv.max_edicts*sizeof(entupdate_t), "entupd");
+
+	sv.protocol = (int)sv_protocol.value;
+	if (sv.protocol != PROTOCOL_VERSION && sv.protocol != PROTOCOL_DELTA)
+	{
+		Con_Printf ("sv_protocol must be %i or %i\n", PROTOCOL_VERSION, PROTOCOL_DELTA);
+		sv.protocol = PROTOCOL_VERSION;
+	}
+	if (sv.protocol == PROTOCOL_DELTA)
+		sv.clientframes = (packetframe_t *)Hunk_AllocName (svs.maxclients*UPDATE_BACKUP*sizeof(packetframe_t), "frames");
 
 	sv.datagram.maxsize = sizeof(sv.datagram_buf);
 	sv.datagram.cursize = 0;
@@ -1108,7 +2102,7 @@ void SV_SpawnServer (char *server)
 	sv.reliable_datagram.cursize = 0;
 	sv.reliable_datagram.data = sv.reliable_datagram_buf;
 	
-	sv.signon.maxsize = sizeof(sv.signon_buf);
+	sv.signon.maxsize = MAX_SIGNON;
 	sv.signon.cursize = 0;
 	sv.signon.data = sv.signon_buf;
 	
@@ -1132,9 +2126,13 @@ void SV_SpawnServer (char *server)
 	{
 		Con_Printf ("Couldn't spawn server %s\n", sv.modelname);
 		sv.active = false;
+		Hunk_SetArena (arena);
 		return;
 	}
 	sv.models[1] = sv.worldmodel;
+	Mod_Reference (sv.worldmodel);
+
+	SV_ClearPVSCache ();
 	
 //
 // clear world interaction links
@@ -1148,7 +2146,9 @@ void SV_SpawnServer (char *server)
 	for (i=1 ; i<sv.worldmodel->numsubmodels ; i++)
 	{
 		sv.model_precache[1+i] = localmodels[i];
-		sv.models[i+1] = Mod_ForName (localmodels[i], false);
+		sv.models[i+1] = Mod_InlineModel (sv.worldmodel, i);
+		if (sv.models[i+1])
+			Mod_Reference (sv.models[i+1]);
 	}
 
 //
@@ -1157,7 +2157,7 @@ void SV_SpawnServer (char *server)
 	ent = EDICT_NUM(0);
 	memset (&ent->v, 0, progs->entityfields * 4);
 	ent->free = false;
-	ent->v.model = sv.worldmodel->name - pr_strings;
+	ent->v.model = ED_EngineString (sv.worldmodel->name);
 	ent->v.modelindex = 1;		// world model
 	ent->v.solid = SOLID_BSP;
 	ent->v.movetype = MOVETYPE_PUSH;
@@ -1167,9 +2167,9 @@ void SV_SpawnServer (char *server)
 	else
 		pr_global_struct->deathmatch = deathmatch.value;
 
-	pr_global_struct->mapname = sv.name - pr_strings;
+	pr_global_struct->mapname = ED_EngineString (sv.name);
 #ifdef QUAKE2
-	pr_global_struct->startspot = sv.startspot - pr_strings;
+	pr_global_struct->startspot = ED_EngineString (sv.startspot);
 #endif
 
 // serverflags are for cross level information (sigils)
@@ -1183,9 +2183,12 @@ void SV_SpawnServer (char *server)
 	sv.state = ss_active;
 	
 // run two frames to allow everything to settle
+	frametime = host_frametime;
 	host_frametime = 0.1;
 	SV_Physics ();
 	SV_Physics ();
+	if (others)
+		host_frametime = frametime;		// the others still run this frame
 
 // create a baseline for more efficient communications
 	SV_CreateBaseline ();
@@ -1194,7 +2197,8 @@ void SV_SpawnServer (char *server)
 	for (i=0,host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
 		if (host_client->active)
 			SV_SendServerinfo (host_client);
-	
+
+	Hunk_SetArena (arena);
 	Con_DPrintf ("Server spawned.\n");
 }
 
@@ -37,8 +37,9 @@ int c_yes, c_no;
 qboolean SV_CheckBottom (edict_t *ent)
 {
 	vec3_t	mins, maxs, start, stop;
-	trace_t	trace;
-	int		x, y;
+	vec3_t	corners[4], cornerstops[4];
+	trace_t	trace, cornertraces[4];
+	int		x, y, i;
 	float	mid, bottom;
 	
 	VectorAdd (ent->v.origin, ent->v.mins, mins);
@@ -81,16 +82,22 @@ realcheck:
 	for	(x=0 ; x<=1 ; x++)
 		for	(y=0 ; y<=1 ; y++)
 		{
-			start[0] = stop[0] = x ? maxs[0] : mins[0];
-			start[1] = stop[1] = y ? maxs[1] : mins[1];
-			
-			trace = SV_Move (start, vec3_origin, vec3_origin, stop, true, ent);
-			
-			if (trace.fraction != 1.0 && trace.endpos[2] > bottom)
-				bottom = trace.endpos[2];
-			if (trace.fraction == 1.0 || mid - trace.endpos[2] > STEPSIZE)
-				return false;
+			i = x*2 + y;
+			corners[i][0] = cornerstops[i][0] = x ? maxs[0] : mins[0];
+			corners[i][1] = cornerstops[i][1] = y ? maxs[1] : mins[1];
+			corners[i][2] = start[2];
+			cornerstops[i][2] = stop[2];
 		}
+	SV_MoveBatch (4, corners, vec3_origin, vec3_origin, cornerstops, true, ent, cornertraces);
+
+	for (i=0 ; i<4 ; i++)
+	{
+		trace = cornertraces[i];
+		if (trace.fraction != 1.0 && trace.endpos[2] > bottom)
+			bottom = trace.endpos[2];
+		if (trace.fraction == 1.0 || mid - trace.endpos[2] > STEPSIZE)
+			return false;
+	}
 
 	c_yes++;
 	return true;
@@ -180,6 +187,7 @@ qboolean SV_movestep (edict_t *ent, const vec3_t & move, qboolean relink)
 			VectorAdd (ent->v.origin, move, ent->v.origin);
 			if (relink)
 				SV_LinkEdict (ent, true);
+			SV_WakeEdict (ent);
 			ent->v.flags = (int)ent->v.flags & ~FL_ONGROUND;
 //	Con_Printf ("fall down\n"); 
 			return true;
@@ -104,6 +104,7 @@ void SV_CheckVelocity (edict_t *ent)
 		if (IS_NAN(ent->v.origin[i]))
 		{
 			Con_Printf ("Got a NaN origin on %s\n", pr_strings + ent->v.classname);
+			SV_AreaMoved (ent);
 			ent->v.origin[i] = 0;
 		}
 		if (ent->v.velocity[i] > sv_maxvelocity.value)
@@ -139,7 +140,7 @@ qboolean SV_RunThink (edict_t *ent)
 	pr_global_struct->time = thinktime;
 	pr_global_struct->self = EDICT_TO_PROG(ent);
 	pr_global_struct->other = EDICT_TO_PROG(sv.edicts);
-	PR_ExecuteProgram (ent->v.think);
+	PR_ExecuteProgram (sv.qcvm, ent->v.think);
 	return !ent->free;
 }
 
@@ -162,14 +163,14 @@ void SV_Impact (edict_t *e1, edict_t *e2)
 	{
 		pr_global_struct->self = EDICT_TO_PROG(e1);
 		pr_global_struct->other = EDICT_TO_PROG(e2);
-		PR_ExecuteProgram (e1->v.touch);
+		PR_ExecuteProgram (sv.qcvm, e1->v.touch);
 	}
 	
 	if (e2->v.touch && e2->v.solid != SOLID_NOT)
 	{
 		pr_global_struct->self = EDICT_TO_PROG(e2);
 		pr_global_struct->other = EDICT_TO_PROG(e1);
-		PR_ExecuteProgram (e2->v.touch);
+		PR_ExecuteProgram (sv.qcvm, e2->v.touch);
 	}
 
 	pr_global_struct->self = old_self;
@@ -267,6 +268,7 @@ int SV_FlyMove (edict_t *ent, float time, trace_t *steptrace)
 
 		if (trace.fraction > 0)
 		{	// actually covered some distance
+			SV_AreaMoved (ent);		// linked after the impacts
 			VectorCopy (trace.endpos, ent->v.origin);
 			VectorCopy (ent->v.velocity, original_velocity);
 			numplanes = 0;
@@ -364,29 +366,34 @@ int SV_FlyMove (edict_t *ent, float time, trace_t *steptrace)
 
 /*
 ============
-SV_AddGravity
+SV_EntGravity
 
 ============
 */
-void SV_AddGravity (edict_t *ent)
+float SV_EntGravity (edict_t *ent)
 {
-	float	ent_gravity;
-
 #ifdef QUAKE2
 	if (ent->v.gravity)
-		ent_gravity = ent->v.gravity;
-	else
-		ent_gravity = 1.0;
+		return ent->v.gravity;
 #else
 	eval_t	*val;
 
 	val = GetEdictFieldValue(ent, "gravity");
 	if (val && val->_float)
-		ent_gravity = val->_float;
-	else
-		ent_gravity = 1.0;
+		return val->_float;
 #endif
-	ent->v.velocity[2] -= ent_gravity * sv_gravity.value * host_frametime;
+	return 1.0;
+}
+
+/*
+============
+SV_AddGravity
+
+============
+*/
+void SV_AddGravity (edict_t *ent)
+{
+	ent->v.velocity[2] -= SV_EntGravity (ent) * sv_gravity.value * host_frametime;
 }
 
 
@@ -398,6 +405,24 @@ PUSHMOVE
 ===============================================================================
 */
 
+/*
+============
+SV_PushMoveType
+
+The MOVE_* type SV_PushEntity traces with
+============
+*/
+int SV_PushMoveType (edict_t *ent)
+{
+	if (ent->v.movetype == MOVETYPE_FLYMISSILE)
+		return MOVE_MISSILE;
+	if (ent->v.solid == SOLID_TRIGGER || ent->v.solid == SOLID_NOT)
+		return MOVE_NOMONSTERS;		// only clip against bmodels
+	return MOVE_NORMAL;
+}
+
+static	pretrace_t	*sv_pretrace;		// the move of the running edict, traced ahead
+
 /*
 ============
 SV_PushEntity
@@ -409,16 +434,16 @@ trace_t SV_PushEntity (edict_t *ent, const vec3_t & push)
 {
 	trace_t	trace;
 	vec3_t	end;
+	int		type;
 		
 	VectorAdd (ent->v.origin, push, end);
 
-	if (ent->v.movetype == MOVETYPE_FLYMISSILE)
-		trace = SV_Move (ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_MISSILE, ent);
-	else if (ent->v.solid == SOLID_TRIGGER || ent->v.solid == SOLID_NOT)
-	// only clip against bmodels
-		trace = SV_Move (ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NOMONSTERS, ent);
+	type = SV_PushMoveType (ent);
+	if (sv_pretrace && SV_PreTraced (sv_pretrace, ent->v.origin, ent->v.mins, ent->v.maxs, end, type, ent))
+		trace = sv_pretrace->trace;
 	else
-		trace = SV_Move (ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NORMAL, ent);	
+		trace = SV_Move (ent->v.origin, ent->v.mins, ent->v.maxs, end, type, ent);
+	sv_pretrace = NULL;		// only good for the edict's own move
 	
 	VectorCopy (trace.endpos, ent->v.origin);
 	SV_LinkEdict (ent, true);
@@ -443,8 +468,8 @@ void SV_PushMove (edict_t *pusher, float movetime)
 	vec3_t		mins, maxs, move;
 	vec3_t		entorig, pushorig;
 	int			num_moved;
-	edict_t		*moved_edict[MAX_EDICTS];
-	vec3_t		moved_from[MAX_EDICTS];
+	edict_t		**moved_edict = sv.moved_edict;
+	vec3_t		*moved_from = sv.moved_from;
 
 	if (!pusher->v.velocity[0] && !pusher->v.velocity[1] && !pusher->v.velocity[2])
 	{
@@ -502,7 +527,10 @@ void SV_PushMove (edict_t *pusher, float movetime)
 
 	// remove the onground flag for non-players
 		if (check->v.movetype != MOVETYPE_WALK)
+		{
+			SV_WakeEdict (check);
 			check->v.flags = (int)check->v.flags & ~FL_ONGROUND;
+		}
 		
 		VectorCopy (check->v.origin, entorig);
 		VectorCopy (check->v.origin, moved_from[num_moved]);
@@ -511,8 +539,10 @@ void SV_PushMove (edict_t *pusher, float movetime)
 
 		// try moving the contacted entity 
 		pusher->v.solid = SOLID_NOT;
+		SV_TraceChanged (pusher);
 		SV_PushEntity (check, move);
 		pusher->v.solid = SOLID_BSP;
+		SV_TraceChanged (pusher);
 
 	// if it is still inside the pusher, block
 		block = SV_TestEntityPosition (check);
@@ -522,6 +552,7 @@ void SV_PushMove (edict_t *pusher, float movetime)
 				continue;
 			if (check->v.solid == SOLID_NOT || check->v.solid == SOLID_TRIGGER)
 			{	// corpse
+				SV_AreaMoved (check);
 				check->v.mins[0] = check->v.mins[1] = 0;
 				VectorCopy (check->v.mins, check->v.maxs);
 				continue;
@@ -540,7 +571,7 @@ void SV_PushMove (edict_t *pusher, float movetime)
 			{
 				pr_global_struct->self = EDICT_TO_PROG(pusher);
 				pr_global_struct->other = EDICT_TO_PROG(check);
-				PR_ExecuteProgram (pusher->v.blocked);
+				PR_ExecuteProgram (sv.qcvm, pusher->v.blocked);
 			}
 			
 		// move back any entities we already moved
@@ -570,8 +601,8 @@ void SV_PushRotate (edict_t *pusher, float movetime)
 	vec3_t		move, a, amove;
 	vec3_t		entorig, pushorig;
 	int			num_moved;
-	edict_t		*moved_edict[MAX_EDICTS];
-	vec3_t		moved_from[MAX_EDICTS];
+	edict_t		**moved_edict = sv.moved_edict;
+	vec3_t		*moved_from = sv.moved_from;
 	vec3_t		org, org2;
 	vec3_t		forward, right, up;
 
@@ -628,7 +659,10 @@ void SV_PushRotate (edict_t *pusher, float movetime)
 
 	// remove the onground flag for non-players
 		if (check->v.movetype != MOVETYPE_WALK)
+		{
+			SV_WakeEdict (check);
 			check->v.flags = (int)check->v.flags & ~FL_ONGROUND;
+		}
 		
 		VectorCopy (check->v.origin, entorig);
 		VectorCopy (check->v.origin, moved_from[num_moved]);
@@ -644,8 +678,10 @@ void SV_PushRotate (edict_t *pusher, float movetime)
 
 		// try moving the contacted entity 
 		pusher->v.solid = SOLID_NOT;
+		SV_TraceChanged (pusher);
 		SV_PushEntity (check, move);
 		pusher->v.solid = SOLID_BSP;
+		SV_TraceChanged (pusher);
 
 	// if it is still inside the pusher, block
 		block = SV_TestEntityPosition (check);
@@ -655,6 +691,7 @@ void SV_PushRotate (edict_t *pusher, float movetime)
 				continue;
 			if (check->v.solid == SOLID_NOT || check->v.solid == SOLID_TRIGGER)
 			{	// corpse
+				SV_AreaMoved (check);
 				check->v.mins[0] = check->v.mins[1] = 0;
 				VectorCopy (check->v.mins, check->v.maxs);
 				continue;
@@ -673,7 +710,7 @@ void SV_PushRotate (edict_t *pusher, float movetime)
 			{
 				pr_global_struct->self = EDICT_TO_PROG(pusher);
 				pr_global_struct->other = EDICT_TO_PROG(check);
-				PR_ExecuteProgram (pusher->v.blocked);
+				PR_ExecuteProgram (sv.qcvm, pusher->v.blocked);
 			}
 			
 		// move back any entities we already moved
@@ -735,7 +772,7 @@ void SV_Physics_Pusher (edict_t *ent)
 		pr_global_struct->time = sv.time;
 		pr_global_struct->self = EDICT_TO_PROG(ent);
 		pr_global_struct->other = EDICT_TO_PROG(sv.edicts);
-		PR_ExecuteProgram (ent->v.think);
+		PR_ExecuteProgram (sv.qcvm, ent->v.think);
 		if (ent->free)
 			return;
 	}
@@ -795,6 +832,7 @@ void SV_CheckStuck (edict_t *ent)
 				}
 			}
 			
+	SV_AreaMoved (ent);
 	VectorCopy (org, ent->v.origin);
 	Con_DPrintf ("player is stuck.\n");
 }
@@ -1066,7 +1104,7 @@ void SV_Physics_Client (edict_t	*ent, int num)
 //	
 	pr_global_struct->time = sv.time;
 	pr_global_struct->self = EDICT_TO_PROG(ent);
-	PR_ExecuteProgram (pr_global_struct->PlayerPreThink);
+	PR_ExecuteProgram (sv.qcvm, pr_global_struct->PlayerPreThink);
 	
 //
 // do a move
@@ -1127,7 +1165,7 @@ void SV_Physics_Client (edict_t	*ent, int num)
 
 	pr_global_struct->time = sv.time;
 	pr_global_struct->self = EDICT_TO_PROG(ent);
-	PR_ExecuteProgram (pr_global_struct->PlayerPostThink);
+	PR_ExecuteProgram (sv.qcvm, pr_global_struct->PlayerPostThink);
 }
 
 //============================================================================
@@ -1498,22 +1536,261 @@ void SV_Physics_Step (edict_t *ent)
 
 //============================================================================
 
+/*
+================
+SV_WakeEdict
+
+Makes SV_Physics read the edict again before deciding to skip it
+================
+*/
+void SV_WakeEdict (edict_t *ent)
+{
+	sv.physdirty[NUM_FOR_EDICT(ent)] = true;
+}
+
+/*
+================
+SV_WakeAllEdicts
+================
+*/
+void SV_WakeAllEdicts (void)
+{
+	memset (sv.physdirty, true, sv.max_edicts);
+}
+
+/*
+================
+SV_ReadPhysicsState
+
+Idle edicts are ones whose physics would only check nextthink: pushers
+are never idle because their ltime keeps advancing, and missiles and
+monsters move or test water every frame.
+================
+*/
+void SV_ReadPhysicsState (int i, edict_t *ent)
+{
+	int		state;
+
+	sv.physdirty[i] = false;
+	sv.physthink[i] = ent->v.nextthink;
+
+	if (ent->free)
+		state = PHYS_FREE;
+	else if (i <= svs.maxclients)
+		state = PHYS_AWAKE;				// world and players
+	else if (ent->v.movetype == MOVETYPE_NONE)
+		state = PHYS_IDLE;
+#ifndef QUAKE2
+	else if ( ((int)ent->v.flags & FL_ONGROUND)
+	&& (ent->v.movetype == MOVETYPE_TOSS
+	|| ent->v.movetype == MOVETYPE_BOUNCE
+	|| ent->v.movetype == MOVETYPE_FLY
+	|| ent->v.movetype == MOVETYPE_FLYMISSILE) )
+		state = PHYS_IDLE;				// resting items and corpses
+#endif
+	else
+		state = PHYS_AWAKE;
+
+	sv.physstate[i] = state;
+}
+
+/*
+===============================================================================
+
+ISLANDS
+
+With sv_parallelphysics, the edicts are split up before they run.  A toss or
+missile whose move can only reach edicts that stay put this frame is an
+island of its own, so its trace through the world and those edicts is made
+on the worker threads ahead of time.  Everything else, and all of the
+QuakeC, still runs in edict order, and SV_PushEntity only takes a trace made
+ahead if the move came out the same and nothing in its box has changed
+since, so the frame comes out exactly as it would have in order.
+
+===============================================================================
+*/
+
+cvar_t	sv_parallelphysics = {"sv_parallelphysics","0"};
+
+#define	MAX_PRETRACES		1024
+#define	MIN_PRETRACES		16		// fewer aren't worth waking the threads for
+#define	PRETRACE_CHUNK		8
+
+static	pretrace_t	sv_pretraces[MAX_PRETRACES];		// in edict order
+static	int			sv_numpretraces;
+static	int			sv_nextpretrace;
+
+/*
+=============
+SV_PredictToss
+
+Works out the move SV_Physics_Toss will make for the edict, as long as
+nothing changes it before it runs.  Returns false if it won't move or
+its think is due first.
+=============
+*/
+qboolean SV_PredictToss (edict_t *ent, vec3_t & end)
+{
+#ifdef QUAKE2
+	return false;		// conveyors and water change the velocity first
+#else
+	vec3_t	velocity, move;
+	float	thinktime;
+	int		i;
+
+	if (ent->v.movetype != MOVETYPE_TOSS
+	&& ent->v.movetype != MOVETYPE_BOUNCE
+	&& ent->v.movetype != MOVETYPE_FLY
+	&& ent->v.movetype != MOVETYPE_FLYMISSILE)
+		return false;
+	if ((int)ent->v.flags & FL_ONGROUND)
+		return false;
+	thinktime = ent->v.nextthink;
+	if (thinktime > 0 && thinktime <= sv.time + host_frametime)
+		return false;
+
+// the same steps as SV_CheckVelocity and SV_AddGravity
+	velocity = ent->v.velocity;
+	for (i=0 ; i<3 ; i++)
+	{
+		if (IS_NAN(velocity[i]) || IS_NAN(ent->v.origin[i]))
+			return false;
+		if (velocity[i] > sv_maxvelocity.value)
+			velocity[i] = sv_maxvelocity.value;
+		else if (velocity[i] < -sv_maxvelocity.value)
+			velocity[i] = -sv_maxvelocity.value;
+	}
+	if (ent->v.movetype != MOVETYPE_FLY
+	&& ent->v.movetype != MOVETYPE_FLYMISSILE)
+		velocity[2] -= SV_EntGravity (ent) * sv_gravity.value * host_frametime;
+
+	VectorScale (velocity, host_frametime, move);
+	VectorAdd (ent->v.origin, move, end);
+	return true;
+#endif
+}
+
+/*
+=============
+SV_StaysPut
+
+True if nothing but another edict's physics or QuakeC can move the edict
+this frame
+=============
+*/
+qboolean SV_StaysPut (edict_t *ent)
+{
+	int		i;
+	float	thinktime;
+
+	i = NUM_FOR_EDICT(ent);
+	if (i <= svs.maxclients)
+		return false;
+	if (sv.physdirty[i])
+		SV_ReadPhysicsState (i, ent);
+	if (sv.physstate[i] == PHYS_AWAKE)
+		return false;
+	thinktime = sv.physthink[i];
+	return thinktime <= 0 || thinktime > sv.time + host_frametime;
+}
+
+/*
+=============
+SV_PreTraceWork
+
+=============
+*/
+void SV_PreTraceWork (int work)
+{
+	int		i, last;
+
+	last = (work+1)*PRETRACE_CHUNK;
+	if (last > sv_numpretraces)
+		last = sv_numpretraces;
+	for (i=work*PRETRACE_CHUNK ; i<last ; i++)
+		SV_PreTrace (&sv_pretraces[i]);
+}
+
+/*
+=============
+SV_PreTraceIslands
+
+Finds the edicts that are islands of their own and traces their moves on
+the worker threads
+=============
+*/
+void SV_PreTraceIslands (void)
+{
+	int			i, j, numtouch;
+	edict_t		*ent;
+	pretrace_t	*p;
+	vec3_t		end;
+
+	sv_numpretraces = 0;
+	sv_nextpretrace = 0;
+
+	ent = NEXT_EDICT(sv.edicts);
+	for (i=1 ; i<sv.num_edicts && sv_numpretraces<MAX_PRETRACES ; i++, ent = NEXT_EDICT(ent))
+	{
+		if (i <= svs.maxclients)
+			continue;
+		if (sv.physdirty[i])
+			SV_ReadPhysicsState (i, ent);
+		if (sv.physstate[i] != PHYS_AWAKE)
+			continue;
+		if (!SV_PredictToss (ent, end))
+			continue;
+
+		p = &sv_pretraces[sv_numpretraces];
+		numtouch = SV_InitPreTrace (p, ent->v.origin, ent->v.mins, ent->v.maxs, end, SV_PushMoveType (ent), ent);
+		if (numtouch == MAX_PRETOUCH)
+			continue;
+		for (j=0 ; j<numtouch ; j++)
+			if (p->touch[j] != ent && !SV_StaysPut (p->touch[j]))
+				break;
+		if (j < numtouch)
+			continue;		// shares an island, so it's left to run in order
+		sv_numpretraces++;
+	}
+
+	if (sv_numpretraces < MIN_PRETRACES)
+	{
+		sv_numpretraces = 0;
+		return;
+	}
+
+	sv_tracethreads = true;
+	Sys_RunThreadsOn ((sv_numpretraces+PRETRACE_CHUNK-1)/PRETRACE_CHUNK, SV_PreTraceWork);
+	sv_tracethreads = false;
+}
+
 /*
 ================
 SV_Physics
 
+The skip test only reads the compact sv.phys* arrays, so idle and free
+edicts cost a couple of bytes each instead of a cache miss into entvars
 ================
 */
 void SV_Physics (void)
 {
 	int		i;
 	edict_t	*ent;
+	float	thinktime;
+	qboolean	pretraces;
+
+	pretraces = sv_parallelphysics.value && Sys_NumThreads () > 1;
+	SV_NewTraceFrame (pretraces);
 
 // let the progs know that a _new frame has started
 	pr_global_struct->self = EDICT_TO_PROG(sv.edicts);
 	pr_global_struct->other = EDICT_TO_PROG(sv.edicts);
 	pr_global_struct->time = sv.time;
-	PR_ExecuteProgram (pr_global_struct->StartFrame);
+	PR_ExecuteProgram (sv.qcvm, pr_global_struct->StartFrame);
+
+	sv_numpretraces = 0;
+	if (pretraces && !pr_global_struct->force_retouch)
+		SV_PreTraceIslands ();
 
 //SV_CheckAllEnts ();
 
@@ -1523,14 +1800,35 @@ void SV_Physics (void)
 	ent = sv.edicts;
 	for (i=0 ; i<sv.num_edicts ; i++, ent = NEXT_EDICT(ent))
 	{
-		if (ent->free)
-			continue;
+		if (sv.physdirty[i])
+			SV_ReadPhysicsState (i, ent);
+
+		if (sv.physstate[i] != PHYS_AWAKE)
+		{
+			if (sv.physstate[i] == PHYS_FREE)
+				continue;
+			thinktime = sv.physthink[i];
+			if ((thinktime <= 0 || thinktime > sv.time + host_frametime)
+			&& !pr_global_struct->force_retouch)
+				continue;
+		}
+
+	// anything can change while it runs, so look at it again next frame
+		sv.physdirty[i] = true;
 
 		if (pr_global_struct->force_retouch)
 		{
 			SV_LinkEdict (ent, true);	// force retouch even for stationary
 		}
 
+	// pick up the move traced ahead for it, if there is one
+		while (sv_nextpretrace < sv_numpretraces && sv_pretraces[sv_nextpretrace].passedict < ent)
+			sv_nextpretrace++;
+		if (sv_nextpretrace < sv_numpretraces && sv_pretraces[sv_nextpretrace].passedict == ent)
+			sv_pretrace = &sv_pretraces[sv_nextpretrace];
+		else
+			sv_pretrace = NULL;
+
 		if (i > 0 && i <= svs.maxclients)
 			SV_Physics_Client (ent, i);
 		else if (ent->v.movetype == MOVETYPE_PUSH)
@@ -1556,6 +1854,8 @@ void SV_Physics (void)
 		else
 			Sys_Error ("SV_Physics: bad movetype %i", (int)ent->v.movetype);			
 	}
+	sv_pretrace = NULL;
+	sv_numpretraces = 0;
 	
 	if (pr_global_struct->force_retouch)
 		pr_global_struct->force_retouch--;	
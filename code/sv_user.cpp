@@ -488,6 +488,7 @@ qboolean SV_ReadClientMessage (void)
 {
 	int		ret;
 	int		cmd;
+	int		i;
 	char		*s;
 	
 	do
@@ -589,6 +590,12 @@ nextmsg:
 			case clc_move:
 				SV_ReadClientMove (&host_client->cmd);
 				break;
+
+			case clc_ackframe:
+				i = MSG_ReadLong ();
+				if (i > host_client->ackframe && i < host_client->framecount)
+					host_client->ackframe = i;
+				break;
 			}
 		}
 	} while (ret == 1);
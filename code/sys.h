@@ -32,10 +32,34 @@ int Sys_FileOpenWrite (char *path);
 void Sys_FileClose (int handle);
 void Sys_FileSeek (int handle, int position);
 int Sys_FileRead (int handle, void *dest, int count);
-int Sys_FileWrite (int handle, void *data, int count);
+int Sys_FileWrite (int handle, const void *data, int count);
 int	Sys_FileTime (char *path);
 void Sys_mkdir (char *path);
 
+//
+// dynamic libraries
+//
+void *Sys_LoadLibrary (char *name);
+// name has no extension, returns NULL if it couldn't be loaded
+
+void *Sys_GetProcAddress (void *lib, char *name);
+void Sys_FreeLibrary (void *lib);
+
+//
+// worker threads
+//
+void Sys_InitThreads (int numthreads);
+// starts numthreads-1 workers to go with the main thread, 0 for one
+// thread per processor
+
+int Sys_NumThreads (void);
+
+void Sys_RunThreadsOn (int workcnt, void (*func) (int work));
+// calls func for every work number from 0 to workcnt-1, spread over all
+// the threads, and returns when they are all done.  func can't use
+// anything another work number writes, and can't print or error out.
+// The caller's qcvm is current on every thread while func runs
+
 //
 // memory protection
 //
@@ -0,0 +1,541 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sys_linux.c -- POSIX system interface code for the headless dedicated server
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "quakedef.h"
+
+#define DEFAULT_MEMORY		0x1000000	// 16 Mb is plenty for a server
+
+qboolean			isDedicated;
+
+static qboolean		nostdout = false;
+
+/*
+===============================================================================
+
+FILE IO
+
+===============================================================================
+*/
+
+#define	MAX_HANDLES		10
+FILE	*sys_handles[MAX_HANDLES];
+
+int		findhandle (void)
+{
+	int		i;
+
+	for (i=1 ; i<MAX_HANDLES ; i++)
+		if (!sys_handles[i])
+			return i;
+	Sys_Error ("out of handles");
+	return -1;
+}
+
+/*
+================
+filelength
+================
+*/
+int filelength (FILE *f)
+{
+	int		pos;
+	int		end;
+
+	pos = ftell (f);
+	fseek (f, 0, SEEK_END);
+	end = ftell (f);
+	fseek (f, pos, SEEK_SET);
+
+	return end;
+}
+
+int Sys_FileOpenRead (char *path, int *hndl)
+{
+	FILE	*f;
+	int		i;
+
+	i = findhandle ();
+
+	f = fopen(path, "rb");
+	if (!f)
+	{
+		*hndl = -1;
+		return -1;
+	}
+	sys_handles[i] = f;
+	*hndl = i;
+
+	return filelength(f);
+}
+
+int Sys_FileOpenWrite (char *path)
+{
+	FILE	*f;
+	int		i;
+
+	i = findhandle ();
+
+	f = fopen(path, "wb");
+	if (!f)
+		Sys_Error ("Error opening %s: %s", path,strerror(errno));
+	sys_handles[i] = f;
+
+	return i;
+}
+
+void Sys_FileClose (int handle)
+{
+	fclose (sys_handles[handle]);
+	sys_handles[handle] = NULL;
+}
+
+void Sys_FileSeek (int handle, int position)
+{
+	fseek (sys_handles[handle], position, SEEK_SET);
+}
+
+int Sys_FileRead (int handle, void *dest, int count)
+{
+	return fread (dest, 1, count, sys_handles[handle]);
+}
+
+int Sys_FileWrite (int handle, const void *data, int count)
+{
+	return fwrite (data, 1, count, sys_handles[handle]);
+}
+
+int	Sys_FileTime (char *path)
+{
+	struct	stat	buf;
+
+	if (stat (path,&buf) == -1)
+		return -1;
+
+	return buf.st_mtime;
+}
+
+void Sys_mkdir (char *path)
+{
+	mkdir (path, 0777);
+}
+
+
+/*
+===============================================================================
+
+SYSTEM IO
+
+===============================================================================
+*/
+
+/*
+================
+Sys_MakeCodeWriteable
+================
+*/
+void Sys_MakeCodeWriteable (unsigned long startaddr, unsigned long length)
+{
+	int		r;
+	unsigned long addr;
+	int		psize = getpagesize();
+
+	addr = (startaddr & ~(psize-1)) - psize;
+	r = mprotect ((char *)addr, length + startaddr - addr + psize, 7);
+
+	if (r < 0)
+   		Sys_Error("Protection change failed\n");
+}
+
+/*
+===============================================================================
+
+DYNAMIC LIBRARIES
+
+===============================================================================
+*/
+
+void *Sys_LoadLibrary (char *name)
+{
+	char	path[MAX_OSPATH];
+
+	sprintf (path, "%s.so", name);
+	return dlopen (path, RTLD_NOW | RTLD_LOCAL);
+}
+
+void *Sys_GetProcAddress (void *lib, char *name)
+{
+	return dlsym (lib, name);
+}
+
+void Sys_FreeLibrary (void *lib)
+{
+	dlclose (lib);
+}
+
+/*
+===============================================================================
+
+WORKER THREADS
+
+===============================================================================
+*/
+
+#define	MAX_THREADS		32
+
+int				sys_numthreads = 1;
+pthread_mutex_t	sys_threadlock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t	sys_workcond = PTHREAD_COND_INITIALIZER;	// new work was handed out
+pthread_cond_t	sys_donecond = PTHREAD_COND_INITIALIZER;	// sys_busythreads reached 0
+
+unsigned		sys_workgeneration;		// bumped for every Sys_RunThreadsOn
+void			(*sys_workfunc) (int work);
+int				sys_workcnt;
+qcvm_t			*sys_workvm;			// the caller's, current on the workers too
+int				sys_nextwork;			// taken with an atomic add
+int				sys_busythreads;		// workers still in the current generation
+
+/*
+=============
+Sys_ThreadWork
+
+Runs work numbers until there are none left
+=============
+*/
+void Sys_ThreadWork (void (*func) (int work), int workcnt)
+{
+	int		work;
+
+	while ((work = __sync_fetch_and_add (&sys_nextwork, 1)) < workcnt)
+		func (work);
+}
+
+void *Sys_ThreadMain (void *arg)
+{
+	unsigned	generation;
+	void		(*func) (int work);
+	int			workcnt;
+
+// wait for the first generation after the one it was started in
+	generation = (unsigned)(intptr_t)arg;
+
+	pthread_mutex_lock (&sys_threadlock);
+	while (1)
+	{
+		while (generation == sys_workgeneration)
+			pthread_cond_wait (&sys_workcond, &sys_threadlock);
+		generation = sys_workgeneration;
+		func = sys_workfunc;
+		workcnt = sys_workcnt;
+		qcvm = sys_workvm;
+		pthread_mutex_unlock (&sys_threadlock);
+
+		if (qcvm && pr_nativefunctions)
+			PR_BindNative ();
+		Sys_ThreadWork (func, workcnt);
+
+		pthread_mutex_lock (&sys_threadlock);
+		if (--sys_busythreads == 0)
+			pthread_cond_signal (&sys_donecond);
+	}
+
+	return NULL;
+}
+
+void Sys_InitThreads (int numthreads)
+{
+	int			i;
+	pthread_t	thread;
+
+	if (numthreads <= 0)
+		numthreads = sysconf (_SC_NPROCESSORS_ONLN);
+	if (numthreads < 1)
+		numthreads = 1;
+	if (numthreads > MAX_THREADS)
+		numthreads = MAX_THREADS;
+
+	for (i=sys_numthreads ; i<numthreads ; i++)
+	{
+		if (pthread_create (&thread, NULL, Sys_ThreadMain, (void *)(intptr_t)sys_workgeneration))
+			break;
+		pthread_detach (thread);
+		sys_numthreads++;
+	}
+}
+
+int Sys_NumThreads (void)
+{
+	return sys_numthreads;
+}
+
+void Sys_RunThreadsOn (int workcnt, void (*func) (int work))
+{
+	int		i;
+
+	if (sys_numthreads == 1 || workcnt < 2)
+	{
+		for (i=0 ; i<workcnt ; i++)
+			func (i);
+		return;
+	}
+
+	pthread_mutex_lock (&sys_threadlock);
+	sys_workfunc = func;
+	sys_workcnt = workcnt;
+	sys_workvm = qcvm;
+	sys_nextwork = 0;
+	sys_busythreads = sys_numthreads - 1;
+	sys_workgeneration++;
+	pthread_cond_broadcast (&sys_workcond);
+	pthread_mutex_unlock (&sys_threadlock);
+
+	Sys_ThreadWork (func, workcnt);
+
+// every worker has to be out of this generation before the next
+// one can reset sys_nextwork
+	pthread_mutex_lock (&sys_threadlock);
+	while (sys_busythreads)
+		pthread_cond_wait (&sys_donecond, &sys_threadlock);
+	pthread_mutex_unlock (&sys_threadlock);
+}
+
+void Sys_SetFPCW (void)
+{
+}
+
+void Sys_DebugLog (char *file, char *fmt, ...)
+{
+	va_list		argptr;
+	static char	data[1024];
+	int			fd;
+
+	va_start (argptr, fmt);
+	vsprintf (data, fmt, argptr);
+	va_end (argptr);
+	fd = open (file, O_WRONLY | O_CREAT | O_APPEND, 0666);
+	write (fd, data, strlen(data));
+	close (fd);
+}
+
+void Sys_Error (char *error, ...)
+{
+	va_list		argptr;
+	char		text[1024];
+	static int	in_sys_error = 0;
+
+// change stdin to blocking again so the shell isn't left in a bad state
+	fcntl (0, F_SETFL, fcntl (0, F_GETFL, 0) & ~O_NONBLOCK);
+
+	va_start (argptr, error);
+	vsprintf (text, error, argptr);
+	va_end (argptr);
+	fprintf (stderr, "Error: %s\n", text);
+
+	if (!in_sys_error)
+	{
+		in_sys_error = 1;
+		Host_Shutdown ();
+	}
+
+	exit (1);
+}
+
+void Sys_Printf (char *fmt, ...)
+{
+	va_list		argptr;
+	char		text[1024];
+	unsigned char	*p;
+
+	if (nostdout)
+		return;
+
+	va_start (argptr,fmt);
+	vsprintf (text, fmt, argptr);
+	va_end (argptr);
+
+// strip the high bit used for colored console text
+	for (p = (unsigned char *)text ; *p ; p++)
+	{
+		*p &= 0x7f;
+		if ((*p > 128 || *p < 32) && *p != 10 && *p != 13 && *p != 9)
+			printf ("[%02x]", *p);
+		else
+			putc (*p, stdout);
+	}
+	fflush (stdout);
+}
+
+void Sys_Quit (void)
+{
+	Host_Shutdown ();
+	fcntl (0, F_SETFL, fcntl (0, F_GETFL, 0) & ~O_NONBLOCK);
+	fflush (stdout);
+	exit (0);
+}
+
+
+/*
+================
+Sys_FloatTime
+================
+*/
+double Sys_FloatTime (void)
+{
+	struct timespec	ts;
+	static time_t	secbase;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	if (!secbase)
+	{
+		secbase = ts.tv_sec;
+		return ts.tv_nsec / 1000000000.0;
+	}
+
+	return (ts.tv_sec - secbase) + ts.tv_nsec / 1000000000.0;
+}
+
+
+char *Sys_ConsoleInput (void)
+{
+	static char	text[256];
+	int		len;
+	fd_set	fdset;
+	struct timeval timeout;
+
+	if (!isDedicated)
+		return NULL;
+
+	FD_ZERO (&fdset);
+	FD_SET (0, &fdset);		// stdin
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 0;
+	if (select (1, &fdset, NULL, NULL, &timeout) == -1 || !FD_ISSET(0, &fdset))
+		return NULL;
+
+	len = read (0, text, sizeof(text));
+	if (len < 1)
+		return NULL;
+	text[len-1] = 0;	// rip off the /n and terminate
+
+	return text;
+}
+
+/*
+================
+Sys_Sleep
+
+yields the CPU to other server instances on the same box
+================
+*/
+void Sys_Sleep (void)
+{
+	usleep (1000);
+}
+
+
+void Sys_SendKeyEvents (void)
+{
+}
+
+
+/*
+==================
+main
+==================
+*/
+int main (int argc, char **argv)
+{
+	quakeparms_t	parms;
+	double			time, oldtime, newtime;
+	static	char	cwd[1024];
+	int				t;
+
+	memset (&parms, 0, sizeof(parms));
+
+	COM_InitArgv (argc, argv);
+	parms.argc = com_argc;
+	parms.argv = com_argv;
+
+	if (!getcwd (cwd, sizeof(cwd)))
+		Sys_Error ("Couldn't determine current directory");
+	if (cwd[Q_strlen(cwd)-1] == '/')
+		cwd[Q_strlen(cwd)-1] = 0;
+
+	parms.basedir = cwd;
+	parms.cachedir = NULL;
+
+	parms.memsize = DEFAULT_MEMORY;
+
+	t = COM_CheckParm ("-heapsize");
+	if (t && t + 1 < com_argc)
+		parms.memsize = Q_atoi (com_argv[t+1]) * 1024;
+
+	t = COM_CheckParm ("-mem");
+	if (t && t + 1 < com_argc)
+		parms.memsize = (int) (Q_atof (com_argv[t+1]) * 1024 * 1024);
+
+	parms.membase = malloc (parms.memsize);
+	if (!parms.membase)
+		Sys_Error ("Not enough memory free; check disk space\n");
+
+// this binary has no renderer, so it can only ever run as a server
+	isDedicated = true;
+
+	if (COM_CheckParm ("-nostdout"))
+		nostdout = true;
+
+	fcntl (0, F_SETFL, fcntl (0, F_GETFL, 0) | O_NONBLOCK);
+
+	Sys_Printf ("Host_Init\n");
+	Host_Init (&parms);
+
+	oldtime = Sys_FloatTime ();
+
+	while (1)
+	{
+		newtime = Sys_FloatTime ();
+		time = newtime - oldtime;
+
+		while (time < sys_ticrate.value)
+		{
+			Sys_Sleep ();
+			newtime = Sys_FloatTime ();
+			time = newtime - oldtime;
+		}
+
+		Host_Frame (time);
+		oldtime = newtime;
+	}
+
+	return 0;
+}
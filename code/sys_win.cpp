@@ -210,7 +210,7 @@ int Sys_FileRead (int handle, void *dest, int count)
 	return x;
 }
 
-int Sys_FileWrite (int handle, void *data, int count)
+int Sys_FileWrite (int handle, const void *data, int count)
 {
 	int		t, x;
 
@@ -270,6 +270,168 @@ void Sys_MakeCodeWriteable (unsigned long startaddr, unsigned long length)
    		Sys_Error("Protection change failed\n");
 }
 
+/*
+===============================================================================
+
+DYNAMIC LIBRARIES
+
+===============================================================================
+*/
+
+void *Sys_LoadLibrary (char *name)
+{
+	char	path[MAX_OSPATH];
+
+	sprintf (path, "%s.dll", name);
+	return (void *)LoadLibrary (path);
+}
+
+void *Sys_GetProcAddress (void *lib, char *name)
+{
+	return (void *)GetProcAddress ((HMODULE)lib, name);
+}
+
+void Sys_FreeLibrary (void *lib)
+{
+	FreeLibrary ((HMODULE)lib);
+}
+
+/*
+===============================================================================
+
+WORKER THREADS
+
+===============================================================================
+*/
+
+#define	MAX_THREADS		32
+
+int					sys_numthreads = 1;
+CRITICAL_SECTION	sys_threadlock;
+CONDITION_VARIABLE	sys_workcond;		// new work was handed out
+CONDITION_VARIABLE	sys_donecond;		// sys_busythreads reached 0
+
+unsigned			sys_workgeneration;	// bumped for every Sys_RunThreadsOn
+void				(*sys_workfunc) (int work);
+int					sys_workcnt;
+qcvm_t				*sys_workvm;		// the caller's, current on the workers too
+volatile LONG		sys_nextwork;		// taken with an interlocked add
+int					sys_busythreads;	// workers still in the current generation
+
+/*
+=============
+Sys_ThreadWork
+
+Runs work numbers until there are none left
+=============
+*/
+void Sys_ThreadWork (void (*func) (int work), int workcnt)
+{
+	int		work;
+
+	while ((work = InterlockedExchangeAdd (&sys_nextwork, 1)) < workcnt)
+		func (work);
+}
+
+DWORD WINAPI Sys_ThreadMain (LPVOID arg)
+{
+	unsigned	generation;
+	void		(*func) (int work);
+	int			workcnt;
+
+// wait for the first generation after the one it was started in
+	generation = (unsigned)(intptr_t)arg;
+
+	EnterCriticalSection (&sys_threadlock);
+	while (1)
+	{
+		while (generation == sys_workgeneration)
+			SleepConditionVariableCS (&sys_workcond, &sys_threadlock, INFINITE);
+		generation = sys_workgeneration;
+		func = sys_workfunc;
+		workcnt = sys_workcnt;
+		qcvm = sys_workvm;
+		LeaveCriticalSection (&sys_threadlock);
+
+		if (qcvm && pr_nativefunctions)
+			PR_BindNative ();
+		Sys_ThreadWork (func, workcnt);
+
+		EnterCriticalSection (&sys_threadlock);
+		if (--sys_busythreads == 0)
+			WakeConditionVariable (&sys_donecond);
+	}
+
+	return 0;
+}
+
+void Sys_InitThreads (int numthreads)
+{
+	int			i;
+	HANDLE		thread;
+	SYSTEM_INFO	info;
+
+	if (numthreads <= 0)
+	{
+		GetSystemInfo (&info);
+		numthreads = info.dwNumberOfProcessors;
+	}
+	if (numthreads > MAX_THREADS)
+		numthreads = MAX_THREADS;
+
+	if (sys_numthreads == 1)
+	{
+		InitializeCriticalSection (&sys_threadlock);
+		InitializeConditionVariable (&sys_workcond);
+		InitializeConditionVariable (&sys_donecond);
+	}
+
+	for (i=sys_numthreads ; i<numthreads ; i++)
+	{
+		thread = CreateThread (NULL, 0, Sys_ThreadMain, (LPVOID)(intptr_t)sys_workgeneration, 0, NULL);
+		if (!thread)
+			break;
+		CloseHandle (thread);
+		sys_numthreads++;
+	}
+}
+
+int Sys_NumThreads (void)
+{
+	return sys_numthreads;
+}
+
+void Sys_RunThreadsOn (int workcnt, void (*func) (int work))
+{
+	int		i;
+
+	if (sys_numthreads == 1 || workcnt < 2)
+	{
+		for (i=0 ; i<workcnt ; i++)
+			func (i);
+		return;
+	}
+
+	EnterCriticalSection (&sys_threadlock);
+	sys_workfunc = func;
+	sys_workcnt = workcnt;
+	sys_workvm = qcvm;
+	sys_nextwork = 0;
+	sys_busythreads = sys_numthreads - 1;
+	sys_workgeneration++;
+	WakeAllConditionVariable (&sys_workcond);
+	LeaveCriticalSection (&sys_threadlock);
+
+	Sys_ThreadWork (func, workcnt);
+
+// every worker has to be out of this generation before the next
+// one can reset sys_nextwork
+	EnterCriticalSection (&sys_threadlock);
+	while (sys_busythreads)
+		SleepConditionVariableCS (&sys_donecond, &sys_threadlock, INFINITE);
+	LeaveCriticalSection (&sys_threadlock);
+}
+
 void Sys_SetFPCW (void)
 {
 }
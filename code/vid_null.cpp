@@ -0,0 +1,71 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// vid_null.c -- null video driver for the headless dedicated server
+
+#include "quakedef.h"
+
+viddef_t	vid;				// global video state
+
+unsigned	d_8to24table[256];
+
+void	VID_SetPalette (unsigned char *palette)
+{
+}
+
+void	VID_ShiftPalette (unsigned char *palette)
+{
+}
+
+void	VID_Init (unsigned char *palette)
+{
+}
+
+void	VID_Shutdown (void)
+{
+}
+
+void	VID_Update (vrect_t *rects)
+{
+}
+
+void	VID_HandlePause (qboolean pause)
+{
+}
+
+/*
+================
+GL_LoadTexture
+
+Brush and alias models still go through the texture loader when a
+server spawns a map, there is just nowhere to upload them.
+================
+*/
+int GL_LoadTexture (char *identifier, int width, int height, byte *data, qboolean mipmap, qboolean alpha)
+{
+	return 0;
+}
+
+void GL_SubdivideSurface (msurface_t *fa)
+{
+}
+
+void GL_MakeAliasModelDisplayLists (model_t *m, aliashdr_t *hdr)
+{
+}
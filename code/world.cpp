@@ -21,6 +21,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define	HULL_SSE	1
+#else
+#define	HULL_SSE	0
+#endif
+
 /*
 
 entities never clip against themselves, or their owner
@@ -39,6 +46,7 @@ typedef struct
 	trace_t		trace;
 	int			type;
 	edict_t		*passedict;
+	hull_t		*box;			// for SV_HullForEntity
 } moveclip_t;
 
 
@@ -54,41 +62,41 @@ HULL BOXES
 
 
 static	hull_t		box_hull;
-static	dclipnode_t	box_clipnodes[6];
-static	mplane_t	box_planes[6];
+static	mclipnode_t	box_clipnodes[6];
 
 /*
 ===================
 SV_InitBoxHull
 
 Set up the planes and clipnodes so that the six floats of a bounding box
-can just be stored out and get a proper hull_t structure.
+can just be stored out and get a proper hull_t structure.  Anything tracing
+off the main thread needs a box hull of its own.
 ===================
 */
-void SV_InitBoxHull (void)
+void SV_InitBoxHull (hull_t *hull, mclipnode_t *clipnodes)
 {
 	int		i;
 	int		side;
 
-	box_hull.clipnodes = box_clipnodes;
-	box_hull.planes = box_planes;
-	box_hull.firstclipnode = 0;
-	box_hull.lastclipnode = 5;
+	memset (clipnodes, 0, 6*sizeof(mclipnode_t));
+	hull->clipnodes = clipnodes;
+	hull->firstclipnode = 0;
+	hull->lastclipnode = 5;
 
 	for (i=0 ; i<6 ; i++)
 	{
-		box_clipnodes[i].planenum = i;
+		clipnodes[i].planenum = i;
 		
 		side = i&1;
 		
-		box_clipnodes[i].children[side] = CONTENTS_EMPTY;
+		clipnodes[i].children[side] = CONTENTS_EMPTY;
 		if (i != 5)
-			box_clipnodes[i].children[side^1] = i + 1;
+			clipnodes[i].children[side^1] = i + 1;
 		else
-			box_clipnodes[i].children[side^1] = CONTENTS_SOLID;
+			clipnodes[i].children[side^1] = CONTENTS_SOLID;
 		
-		box_planes[i].type = i>>1;
-		box_planes[i].normal[i>>1] = 1;
+		clipnodes[i].type = i>>1;
+		clipnodes[i].normal[i>>1] = 1;
 	}
 	
 }
@@ -102,16 +110,19 @@ To keep everything totally uniform, bounding boxes are turned into small
 BSP trees instead of being compared directly.
 ===================
 */
-hull_t	*SV_HullForBox (const vec3_t & mins, const vec3_t & maxs)
+hull_t	*SV_HullForBox (hull_t *box, const vec3_t & mins, const vec3_t & maxs)
 {
-	box_planes[0].dist = maxs[0];
-	box_planes[1].dist = mins[0];
-	box_planes[2].dist = maxs[1];
-	box_planes[3].dist = mins[1];
-	box_planes[4].dist = maxs[2];
-	box_planes[5].dist = mins[2];
+	mclipnode_t	*clipnodes;
+
+	clipnodes = box->clipnodes;
+	clipnodes[0].dist = maxs[0];
+	clipnodes[1].dist = mins[0];
+	clipnodes[2].dist = maxs[1];
+	clipnodes[3].dist = mins[1];
+	clipnodes[4].dist = maxs[2];
+	clipnodes[5].dist = mins[2];
 
-	return &box_hull;
+	return box;
 }
 
 
@@ -124,9 +135,10 @@ Returns a hull that can be used for testing or clipping an object of mins/maxs
 size.
 Offset is filled in to contain the adjustment that must be added to the
 testing object's origin to get a point to use with the returned hull.
+Entities without a BSP model are turned into box, from SV_InitBoxHull.
 ================
 */
-hull_t *SV_HullForEntity (edict_t *ent, const vec3_t & mins, const vec3_t & maxs, vec3_t & offset)
+hull_t *SV_HullForEntity (edict_t *ent, const vec3_t & mins, const vec3_t & maxs, vec3_t & offset, hull_t *box)
 {
 	model_t		*model;
 	vec3_t		size;
@@ -161,7 +173,7 @@ hull_t *SV_HullForEntity (edict_t *ent, const vec3_t & mins, const vec3_t & maxs
 
 		VectorSubtract (ent->v.mins, maxs, hullmins);
 		VectorSubtract (ent->v.maxs, mins, hullmaxs);
-		hull = SV_HullForBox (hullmins, hullmaxs);
+		hull = SV_HullForBox (box, hullmins, hullmaxs);
 		
 		VectorCopy (ent->v.origin, offset);
 	}
@@ -175,67 +187,276 @@ hull_t *SV_HullForEntity (edict_t *ent, const vec3_t & mins, const vec3_t & maxs
 
 ENTITY AREA CHECKING
 
+The area tree is a loose octree over the world bounds.  A node's bounds are
+its cell grown by half the cell size on every side, so an edict can live in
+the cell that holds its center as long as it is no bigger than the cell.
+Leafs are split when they hold more than AREA_SPLIT edicts and subtrees are
+merged back when they drop to AREA_MERGE, so crowded parts of a map get a
+deeper tree than empty ones.  Edicts that stick out of the world stay at
+the root.
+
 ===============================================================================
 */
 
 typedef struct areanode_s
 {
-	int		axis;		// -1 = leaf node
-	float	dist;
-	struct areanode_s	*children[2];
+	struct areanode_s	*parent;
+	struct areanode_s	*children;	// block of 8, NULL on leaf nodes
+	int		splitaxes;		// bit for each axis the children halve
+	int		depth;
+	vec3_t	mid, size;		// the cell
+	vec3_t	mins, maxs;		// loose bounds
+	int		numlinked;		// edicts in the lists of this node
+	int		numedicts;		// edicts in this node and below
+	unsigned	stamp;		// tracestamp of the last change to the lists
+	unsigned	treestamp;	// ... to the lists of this node or any below it
 	link_t	trigger_edicts;
 	link_t	solid_edicts;
 } areanode_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	32
+#define	AREA_MAXDEPTH	8
+#define	AREA_MINSIZE	64		// cells are never halved below this
+#define	AREA_SPLIT		8		// split a leaf holding more edicts than this
+#define	AREA_MERGE		4		// merge a subtree holding this many or less
+
+typedef struct
+{
+	int		links;			// SV_LinkEdict calls that linked into the tree
+	int		relinks;		// ... that had to move the edict to another node
+	int		queries;		// traces, touches and box queries
+	int		nodes;			// nodes visited by the queries
+	int		candidates;		// edicts the queries checked
+} areastats_t;
+
+typedef struct
+{
+	int		frames;
+	int		lookups;
+	int		hits;
+	int		stale;			// found, but something in the box had changed
+	int		pretraced;		// SV_PreTraced calls
+	int		prehits;		// ... that could use the trace
+} tracestats_t;
+
+// the area tree and trace cache of a level, on its hunk
+typedef struct svworld_s
+{
+	areanode_t	*areanodes;			// the root
+	areanode_t	*freeareablocks;	// linked through parent
+	int			numareablocks, maxareablocks;
+	areastats_t	areastats;
+
+	struct tracecache_s	*tracecaches;	// [TRACE_CACHE_SIZE]
+	int			traceframe;
+	unsigned	tracestamp;
+	tracestats_t	tracestats;
+} svworld_t;
 
-static	areanode_t	sv_areanodes[AREA_NODES];
-static	int			sv_numareanodes;
+static void SV_AreaChanged (areanode_t *node);
 
 /*
 ===============
-SV_CreateAreaNode
+SV_InitAreaNode
 
 ===============
 */
-areanode_t *SV_CreateAreaNode (int depth, const vec3_t & mins, const vec3_t & maxs)
+void SV_InitAreaNode (areanode_t *anode, areanode_t *parent, const vec3_t & mins, const vec3_t & maxs)
 {
-	areanode_t	*anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1, mins2, maxs2;
-
-	anode = &sv_areanodes[sv_numareanodes];
-	sv_numareanodes++;
+	int		i;
 
+	memset (anode, 0, sizeof(*anode));
+	anode->parent = parent;
+	anode->depth = parent ? parent->depth + 1 : 0;
+	for (i=0 ; i<3 ; i++)
+	{
+		anode->mid[i] = 0.5 * (mins[i] + maxs[i]);
+		anode->size[i] = maxs[i] - mins[i];
+		anode->mins[i] = mins[i] - 0.5*anode->size[i];
+		anode->maxs[i] = maxs[i] + 0.5*anode->size[i];
+	}
 	ClearLink (&anode->trigger_edicts);
 	ClearLink (&anode->solid_edicts);
-	
-	if (depth == AREA_DEPTH)
+}
+
+/*
+===============
+SV_AreaChild
+
+Returns the child cell holding the center of the edict's box
+===============
+*/
+areanode_t *SV_AreaChild (areanode_t *node, edict_t *ent)
+{
+	int		i, side;
+
+	side = 0;
+	for (i=0 ; i<3 ; i++)
+		if ( (node->splitaxes & (1<<i))
+		&& ent->v.absmin[i] + ent->v.absmax[i] >= 2*node->mid[i] )
+			side |= 1<<i;
+	return &node->children[side];
+}
+
+/*
+===============
+SV_AreaFits
+
+===============
+*/
+qboolean SV_AreaFits (areanode_t *node, edict_t *ent)
+{
+	return ent->v.absmin[0] >= node->mins[0] && ent->v.absmax[0] <= node->maxs[0]
+		&& ent->v.absmin[1] >= node->mins[1] && ent->v.absmax[1] <= node->maxs[1]
+		&& ent->v.absmin[2] >= node->mins[2] && ent->v.absmax[2] <= node->maxs[2];
+}
+
+/*
+===============
+SV_FindAreaNode
+
+Returns the deepest existing node that can hold the edict
+===============
+*/
+areanode_t *SV_FindAreaNode (edict_t *ent)
+{
+	areanode_t	*node, *child;
+
+	node = sv.world->areanodes;
+	while (node->children)
 	{
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
+		child = SV_AreaChild (node, ent);
+		if (!SV_AreaFits (child, ent))
+			break;
+		node = child;
 	}
-	
-	VectorSubtract (maxs, mins, size);
-	if (size[0] > size[1])
-		anode->axis = 0;
-	else
-		anode->axis = 1;
-	
-	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy (mins, mins1);	
-	VectorCopy (mins, mins2);	
-	VectorCopy (maxs, maxs1);	
-	VectorCopy (maxs, maxs2);	
-	
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
-	
-	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
+	return node;
+}
+
+/*
+===============
+SV_MoveAreaLinks
+
+Moves the edicts of one list to another node, or only the ones that fit in
+the children of the node if to is NULL
+===============
+*/
+void SV_MoveAreaLinks (areanode_t *node, link_t *list, areanode_t *to)
+{
+	link_t		*l, *next;
+	edict_t		*ent;
+	areanode_t	*dest;
+
+	for (l = list->next ; l != list ; l = next)
+	{
+		next = l->next;
+		ent = EDICT_FROM_AREA(l);
+		dest = to;
+		if (!dest)
+		{
+			dest = SV_AreaChild (node, ent);
+			if (!SV_AreaFits (dest, ent))
+				continue;
+			dest->numedicts++;
+		}
+		RemoveLink (l);
+		InsertLinkBefore (l, ent->areatrigger ? &dest->trigger_edicts : &dest->solid_edicts);
+		SV_AreaChanged (node);
+		SV_AreaChanged (dest);
+		ent->areanode = dest;
+		node->numlinked--;
+		dest->numlinked++;
+	}
+}
+
+/*
+===============
+SV_SplitAreaNode
+
+===============
+*/
+void SV_SplitAreaNode (areanode_t *node)
+{
+	int		i, side;
+	float	largest;
+	vec3_t	mins, maxs;
+	areanode_t	*child;
+
+	if (node->depth == AREA_MAXDEPTH || !sv.world->freeareablocks)
+		return;
+
+	largest = node->size[0];
+	if (node->size[1] > largest)
+		largest = node->size[1];
+	if (node->size[2] > largest)
+		largest = node->size[2];
+
+// keep the cells roughly cubic, the world is usually much flatter than wide
+	for (i=0 ; i<3 ; i++)
+		if (node->size[i] >= 2*AREA_MINSIZE && node->size[i] >= 0.5*largest)
+			node->splitaxes |= 1<<i;
+	if (!node->splitaxes)
+		return;
+
+	node->children = sv.world->freeareablocks;
+	sv.world->freeareablocks = sv.world->freeareablocks->parent;
+	sv.world->numareablocks++;
+
+	for (side=0 ; side<8 ; side++)
+	{
+		for (i=0 ; i<3 ; i++)
+		{
+			mins[i] = node->mid[i] - 0.5*node->size[i];
+			maxs[i] = node->mid[i] + 0.5*node->size[i];
+			if (node->splitaxes & (1<<i))
+			{
+				if (side & (1<<i))
+					mins[i] = node->mid[i];
+				else
+					maxs[i] = node->mid[i];
+			}
+		}
+		SV_InitAreaNode (&node->children[side], node, mins, maxs);
+	}
+
+	SV_MoveAreaLinks (node, &node->solid_edicts, NULL);
+	SV_MoveAreaLinks (node, &node->trigger_edicts, NULL);
+
+	for (side=0 ; side<8 ; side++)
+	{
+		child = &node->children[side];
+		if (child->numlinked > AREA_SPLIT)
+			SV_SplitAreaNode (child);
+	}
+}
 
-	return anode;
+/*
+===============
+SV_MergeAreaNode
+
+Pulls everything below node up into it and frees the children
+===============
+*/
+void SV_MergeAreaNode (areanode_t *node, areanode_t *to)
+{
+	int		side;
+	areanode_t	*child;
+
+	if (!node->children)
+		return;
+
+	for (side=0 ; side<8 ; side++)
+	{
+		child = &node->children[side];
+		SV_MergeAreaNode (child, to);
+		SV_MoveAreaLinks (child, &child->solid_edicts, to);
+		SV_MoveAreaLinks (child, &child->trigger_edicts, to);
+	}
+
+	node->children->parent = sv.world->freeareablocks;
+	sv.world->freeareablocks = node->children;
+	sv.world->numareablocks--;
+	node->children = NULL;
+	node->splitaxes = 0;
 }
 
 /*
@@ -246,48 +467,301 @@ SV_ClearWorld
 */
 void SV_ClearWorld (void)
 {
-	SV_InitBoxHull ();
-	
-	memset (sv_areanodes, 0, sizeof(sv_areanodes));
-	sv_numareanodes = 0;
-	SV_CreateAreaNode (0, sv.worldmodel->mins, sv.worldmodel->maxs);
+	int		i;
+	areanode_t	*blocks;
+
+	SV_InitBoxHull (&box_hull, box_clipnodes);
+
+	sv.world = (svworld_t *)Hunk_AllocName (sizeof(svworld_t), "svworld");
+	sv.world->maxareablocks = sv.max_edicts / AREA_MERGE;
+	blocks = (areanode_t *)Hunk_AllocName ((sv.world->maxareablocks*8+1)*sizeof(areanode_t), "areanode");
+	sv.world->areanodes = blocks++;
+	SV_InitAreaNode (sv.world->areanodes, NULL, sv.worldmodel->mins, sv.worldmodel->maxs);
+	sv.world->freeareablocks = NULL;
+	for (i=0 ; i<sv.world->maxareablocks ; i++, blocks += 8)
+	{
+		blocks->parent = sv.world->freeareablocks;
+		sv.world->freeareablocks = blocks;
+	}
+	sv.world->numareablocks = 0;
+	memset (&sv.world->areastats, 0, sizeof(sv.world->areastats));
+	SV_ClearTraceCache ();
+
+	sv.leafents = (link_t *)Hunk_AllocName (sv.worldmodel->numleafs*sizeof(link_t), "leafents");
+	for (i=0 ; i<sv.worldmodel->numleafs ; i++)
+		ClearLink (&sv.leafents[i]);
+	sv.leaflinks = (link_t *)Hunk_AllocName (sv.max_edicts*MAX_ENT_LEAFS*sizeof(link_t), "leafents");
+
+	sv.areamoved = (byte *)Hunk_AllocName (sv.max_edicts, "areamove");
+	sv.movededicts = (int *)Hunk_AllocName (sv.max_edicts*sizeof(int), "areamove");
+	sv.nummoved = 0;
+	sv.arealist = (edict_t **)Hunk_AllocName (sv.max_edicts*2*sizeof(edict_t *), "areamove");
+}
+
+/*
+===============
+SV_AreaStats_f
+
+Prints the shape of the area tree and what the queries have cost since the
+last call
+===============
+*/
+void SV_AreaStats_f (void)
+{
+	int		i, depth, nodes, edicts[AREA_MAXDEPTH+1];
+	areanode_t	*stack[AREA_MAXDEPTH*8+1], *node;
+	areastats_t	*s;
+
+	if (!sv.active)
+	{
+		Con_Printf ("no server running\n");
+		return;
+	}
+
+	memset (edicts, 0, sizeof(edicts));
+	nodes = depth = 0;
+	stack[0] = sv.world->areanodes;
+	i = 1;
+	while (i)
+	{
+		node = stack[--i];
+		nodes++;
+		edicts[node->depth] += node->numlinked;
+		if (node->depth > depth)
+			depth = node->depth;
+		if (node->children)
+			for (int side=0 ; side<8 ; side++)
+				if (node->children[side].numedicts)
+					stack[i++] = &node->children[side];
+	}
+
+	s = &sv.world->areastats;
+	Con_Printf ("%i edicts, %i nodes in use, %i of %i blocks\n", sv.world->areanodes->numedicts, nodes, sv.world->numareablocks, sv.world->maxareablocks);
+	Con_Printf ("edicts by depth:");
+	for (i=0 ; i<=depth ; i++)
+		Con_Printf (" %i", edicts[i]);
+	Con_Printf ("\n");
+	Con_Printf ("%i links, %i moved\n", s->links, s->relinks);
+	if (s->queries)
+		Con_Printf ("%i queries, %.1f nodes and %.1f edicts each\n", s->queries, (float)s->nodes/s->queries, (float)s->candidates/s->queries);
+
+	memset (s, 0, sizeof(*s));
 }
 
 
 /*
 ===============
-SV_UnlinkEdict
+SV_UnlinkLeafs
 
+Takes the edict out of the per leaf lists
 ===============
 */
-void SV_UnlinkEdict (edict_t *ent)
+void SV_UnlinkLeafs (edict_t *ent)
+{
+	int		i;
+	link_t	*l;
+
+	l = &sv.leaflinks[NUM_FOR_EDICT(ent)*MAX_ENT_LEAFS];
+	for (i=0 ; i<ent->num_leafs ; i++, l++)
+	{
+		if (!l->prev)
+			continue;
+		RemoveLink (l);
+		l->prev = l->next = NULL;
+	}
+}
+
+/*
+===============
+SV_UnlinkArea
+
+Takes the edict out of the area tree
+===============
+*/
+void SV_UnlinkArea (edict_t *ent)
 {
+	areanode_t	*node, *merge;
+
 	if (!ent->area.prev)
 		return;		// not linked in anywhere
+	SV_TraceChanged (ent);
 	RemoveLink (&ent->area);
 	ent->area.prev = ent->area.next = NULL;
+
+	node = ent->areanode;
+	ent->areanode = NULL;
+	node->numlinked--;
+	merge = NULL;
+	for ( ; node ; node = node->parent)
+	{
+		node->numedicts--;
+		if (node->children && node->numedicts <= AREA_MERGE)
+			merge = node;
+	}
+	if (merge)
+		SV_MergeAreaNode (merge, merge);
+}
+
+/*
+===============
+SV_UnlinkEdict
+
+===============
+*/
+void SV_UnlinkEdict (edict_t *ent)
+{
+	SV_UnlinkLeafs (ent);
+	SV_UnlinkArea (ent);
+}
+
+
+/*
+====================
+SV_AreaEdictsR
+====================
+*/
+static void SV_AreaEdictsR (areanode_t *node, const vec3_t & mins, const vec3_t & maxs, edict_t **list, int *count, int maxcount, int areatype)
+{
+	link_t		*l, *start;
+	edict_t		*check;
+	areanode_t	*child;
+	int			side, type;
+
+	sv.world->areastats.nodes++;
+
+	for (type = AREA_SOLID ; type <= AREA_TRIGGERS ; type <<= 1)
+	{
+		if (!(areatype & type))
+			continue;
+		start = type == AREA_TRIGGERS ? &node->trigger_edicts : &node->solid_edicts;
+		for (l = start->next ; l != start ; l = l->next)
+		{
+			check = EDICT_FROM_AREA(l);
+			sv.world->areastats.candidates++;
+
+			if (mins[0] > check->v.absmax[0]
+			|| mins[1] > check->v.absmax[1]
+			|| mins[2] > check->v.absmax[2]
+			|| maxs[0] < check->v.absmin[0]
+			|| maxs[1] < check->v.absmin[1]
+			|| maxs[2] < check->v.absmin[2] )
+				continue;
+
+			if (*count == maxcount)
+			{
+				Con_DPrintf ("SV_AreaEdicts: MAXCOUNT\n");
+				return;
+			}
+			list[(*count)++] = check;
+		}
+	}
+
+	if (!node->children)
+		return;
+	for (side=0 ; side<8 ; side++)
+	{
+		child = &node->children[side];
+		if (!child->numedicts
+		|| mins[0] > child->maxs[0] || maxs[0] < child->mins[0]
+		|| mins[1] > child->maxs[1] || maxs[1] < child->mins[1]
+		|| mins[2] > child->maxs[2] || maxs[2] < child->mins[2])
+			continue;
+		SV_AreaEdictsR (child, mins, maxs, list, count, maxcount, areatype);
+	}
+}
+
+/*
+====================
+SV_AreaEdicts
+====================
+*/
+int SV_AreaEdicts (const vec3_t & mins, const vec3_t & maxs, edict_t **list, int maxcount, int areatype)
+{
+	int		count;
+
+	count = 0;
+	sv.world->areastats.queries++;
+	SV_AreaEdictsR (sv.world->areanodes, mins, maxs, list, &count, maxcount, areatype);
+	return count;
+}
+
+
+/*
+====================
+SV_AreaMoved
+
+sv.movededicts can still hold edicts that have been linked since, they are
+dropped when it fills up or is read
+====================
+*/
+static void SV_CompactMoved (void)
+{
+	int		i, j;
+
+	for (i=j=0 ; i<sv.nummoved ; i++)
+		if (sv.areamoved[sv.movededicts[i]])
+			sv.movededicts[j++] = sv.movededicts[i];
+	sv.nummoved = j;
+}
+
+void SV_AreaMoved (edict_t *ent)
+{
+	int		e;
+
+	SV_TraceChanged (ent);
+
+	e = NUM_FOR_EDICT(ent);
+	if (sv.areamoved[e])
+		return;
+	if (sv.nummoved == sv.max_edicts)
+		SV_CompactMoved ();
+	sv.areamoved[e] = true;
+	sv.movededicts[sv.nummoved++] = e;
+}
+
+/*
+====================
+SV_MovedEdicts
+====================
+*/
+int SV_MovedEdicts (edict_t **list, int maxcount)
+{
+	int		i;
+
+	SV_CompactMoved ();
+	if (maxcount > sv.nummoved)
+		maxcount = sv.nummoved;
+	for (i=0 ; i<maxcount ; i++)
+		list[i] = EDICT_NUM(sv.movededicts[i]);
+	return maxcount;
 }
 
 
 /*
 ====================
 SV_TouchLinks
+
+The touch functions can move or remove any edict, so the triggers are
+collected first and checked again before each call
 ====================
 */
-void SV_TouchLinks ( edict_t *ent, areanode_t *node )
+#define	MAX_TOUCH	512
+
+void SV_TouchLinks (edict_t *ent)
 {
-	link_t		*l, *next;
-	edict_t		*touch;
+	int			i, num;
+	edict_t		*touch, *touchlist[MAX_TOUCH];
 	int			old_self, old_other;
 
+	num = SV_AreaEdicts (ent->v.absmin, ent->v.absmax, touchlist, MAX_TOUCH, AREA_TRIGGERS);
+
 // touch linked edicts
-	for (l = node->trigger_edicts.next ; l != &node->trigger_edicts ; l = next)
+	for (i=0 ; i<num ; i++)
 	{
-		next = l->next;
-		touch = EDICT_FROM_AREA(l);
+		touch = touchlist[i];
 		if (touch == ent)
 			continue;
-		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
+		if (touch->free || !touch->v.touch || touch->v.solid != SOLID_TRIGGER)
 			continue;
 		if (ent->v.absmin[0] > touch->v.absmax[0]
 		|| ent->v.absmin[1] > touch->v.absmax[1]
@@ -302,20 +776,11 @@ void SV_TouchLinks ( edict_t *ent, areanode_t *node )
 		pr_global_struct->self = EDICT_TO_PROG(touch);
 		pr_global_struct->other = EDICT_TO_PROG(ent);
 		pr_global_struct->time = sv.time;
-		PR_ExecuteProgram (touch->v.touch);
+		PR_ExecuteProgram (sv.qcvm, touch->v.touch);
 
 		pr_global_struct->self = old_self;
 		pr_global_struct->other = old_other;
 	}
-	
-// recurse down both sides
-	if (node->axis == -1)
-		return;
-	
-	if ( ent->v.absmax[node->axis] > node->dist )
-		SV_TouchLinks ( ent, node->children[0] );
-	if ( ent->v.absmin[node->axis] < node->dist )
-		SV_TouchLinks ( ent, node->children[1] );
 }
 
 
@@ -372,15 +837,17 @@ SV_LinkEdict
 void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
 {
 	areanode_t	*node;
+	link_t		*l;
+	int			i;
+	qboolean	trigger;
 
-	if (ent->area.prev)
-		SV_UnlinkEdict (ent);	// unlink from old position
-		
-	if (ent == sv.edicts)
-		return;		// don't add the world
+	SV_UnlinkLeafs (ent);	// unlink from old position
 
-	if (ent->free)
+	if (ent == sv.edicts || ent->free)
+	{	// don't add the world
+		SV_UnlinkArea (ent);
 		return;
+	}
 
 // set the abs box
 
@@ -436,38 +903,56 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
 		ent->v.absmax[2] += 1;
 	}
 	
+// the box is good for SV_AreaEdicts again, unless it is inside out and
+// doesn't hold its own center
+	if (ent->v.mins[0] <= ent->v.maxs[0] && ent->v.mins[1] <= ent->v.maxs[1]
+	&& ent->v.mins[2] <= ent->v.maxs[2])
+		sv.areamoved[NUM_FOR_EDICT(ent)] = false;
+
 // link to PVS leafs
 	ent->num_leafs = 0;
 	if (ent->v.modelindex)
 		SV_FindTouchedLeafs (ent, sv.worldmodel->nodes);
 
+	l = &sv.leaflinks[NUM_FOR_EDICT(ent)*MAX_ENT_LEAFS];
+	for (i=0 ; i<ent->num_leafs ; i++)
+		InsertLinkBefore (&l[i], &sv.leafents[ent->leafnums[i]]);
+
 	if (ent->v.solid == SOLID_NOT)
+	{
+		SV_UnlinkArea (ent);
 		return;
+	}
 
-// find the first node that the ent's box crosses
-	node = sv_areanodes;
-	while (1)
+// find the deepest node that holds the box, most moves don't leave it
+	node = SV_FindAreaNode (ent);
+	trigger = ent->v.solid == SOLID_TRIGGER;
+	sv.world->areastats.links++;
+
+	if (node != ent->areanode || trigger != ent->areatrigger)
 	{
-		if (node->axis == -1)
-			break;
-		if (ent->v.absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if (ent->v.absmax[node->axis] < node->dist)
-			node = node->children[1];
+		sv.world->areastats.relinks++;
+		SV_UnlinkArea (ent);
+		node = SV_FindAreaNode (ent);	// the unlink may have merged nodes
+
+		if (trigger)
+			InsertLinkBefore (&ent->area, &node->trigger_edicts);
 		else
-			break;		// crosses the node
+			InsertLinkBefore (&ent->area, &node->solid_edicts);
+		ent->areanode = node;
+		ent->areatrigger = trigger;
+		node->numlinked++;
+		for ( ; node ; node = node->parent)
+			node->numedicts++;
+		node = ent->areanode;
+		if (!node->children && node->numlinked > AREA_SPLIT)
+			SV_SplitAreaNode (node);
 	}
-	
-// link it in	
+	SV_TraceChanged (ent);
 
-	if (ent->v.solid == SOLID_TRIGGER)
-		InsertLinkBefore (&ent->area, &node->trigger_edicts);
-	else
-		InsertLinkBefore (&ent->area, &node->solid_edicts);
-	
-// if touch_triggers, touch all entities at this node and decend for more
+// if touch_triggers, touch all entities in the box
 	if (touch_triggers)
-		SV_TouchLinks ( ent, sv_areanodes );
+		SV_TouchLinks (ent);
 }
 
 
@@ -475,24 +960,292 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
 /*
 ===============================================================================
 
-POINT TESTING IN HULLS
+TRACE CACHE
+
+With sv_tracecache set, SV_Move remembers its results until the end of the
+server frame.  Each area node is stamped when the edicts linked to it are
+changed, and the stamp is carried up to the root, so a remembered trace is
+still good if no node its box reaches has been stamped since it was stored.
 
 ===============================================================================
 */
 
-#if	!id386
+cvar_t	sv_tracecache = {"sv_tracecache", "0"};
+
+#define	TRACE_CACHE_SIZE	1024		// a power of two
+
+typedef struct tracecache_s
+{
+	int			frame;				// traceframe when stored
+	unsigned	stamp;				// tracestamp when stored
+	vec3_t		start, end, mins, maxs;
+	int			type;
+	edict_t		*passedict;
+	int			passowner;			// passedict fields SV_ClipToEdict reads
+	qboolean	passpoint;
+	vec3_t		boxmins, boxmaxs;	// the moveclip_t box
+	trace_t		trace;
+} tracecache_t;
+
+static	qboolean	sv_pretracing;		// SV_Physics is tracing ahead this frame
 
 /*
-==================
-SV_HullPointContents
+===============
+SV_AreaChanged
 
-==================
+===============
 */
-int SV_HullPointContents (hull_t *hull, int num, const vec3_t & p)
+static void SV_AreaChanged (areanode_t *node)
 {
-	float		d;
-	dclipnode_t	*node;
-	mplane_t	*plane;
+	if (!sv_tracecache.value && !sv_pretracing)
+		return;
+	node->stamp = ++sv.world->tracestamp;
+	for ( ; node ; node = node->parent)
+		node->treestamp = sv.world->tracestamp;
+}
+
+/*
+===============
+SV_TraceChanged
+
+===============
+*/
+void SV_TraceChanged (edict_t *ent)
+{
+	if (!sv_tracecache.value && !sv_pretracing)
+		return;
+	if (ent->areanode)
+		SV_AreaChanged (ent->areanode);
+	ent->tracestamp = ++sv.world->tracestamp;
+}
+
+/*
+===============
+SV_ClearStamps
+
+===============
+*/
+static void SV_ClearStamps (areanode_t *node)
+{
+	int		side;
+
+	node->stamp = node->treestamp = 0;
+	if (node->children)
+		for (side=0 ; side<8 ; side++)
+			SV_ClearStamps (&node->children[side]);
+}
+
+/*
+===============
+SV_ClearTraceCache
+
+Gives the new level its trace cache
+===============
+*/
+void SV_ClearTraceCache (void)
+{
+	sv.world->tracecaches = (tracecache_t *)Hunk_AllocName (TRACE_CACHE_SIZE*sizeof(tracecache_t), "tracecache");
+	memset (&sv.world->tracestats, 0, sizeof(sv.world->tracestats));
+	sv.world->traceframe = 1;
+	sv.world->tracestamp = 0;
+}
+
+/*
+===============
+SV_NewTraceFrame
+
+Forgets the traces of the last frame
+===============
+*/
+void SV_NewTraceFrame (qboolean pretraces)
+{
+	int		i;
+
+	sv_pretracing = pretraces;
+	sv.world->traceframe++;
+	sv.world->tracestats.frames++;
+
+// start the stamps over long before they can wrap
+	if (sv.world->tracestamp > 0x40000000)
+	{
+		SV_ClearStamps (sv.world->areanodes);
+		for (i=0 ; i<sv.num_edicts ; i++)
+			EDICT_NUM(i)->tracestamp = 0;
+		sv.world->tracestamp = 0;
+	}
+}
+
+/*
+===============
+SV_AreaUnchanged
+
+===============
+*/
+static qboolean SV_AreaUnchanged (areanode_t *node, const vec3_t & mins, const vec3_t & maxs, unsigned stamp)
+{
+	int			side;
+	areanode_t	*child;
+
+	if (node->treestamp <= stamp)
+		return true;
+	if (node->stamp > stamp)
+		return false;
+	if (!node->children)
+		return true;
+
+	for (side=0 ; side<8 ; side++)
+	{
+		child = &node->children[side];
+		if (mins[0] > child->maxs[0] || maxs[0] < child->mins[0]
+		|| mins[1] > child->maxs[1] || maxs[1] < child->mins[1]
+		|| mins[2] > child->maxs[2] || maxs[2] < child->mins[2])
+			continue;
+		if (!SV_AreaUnchanged (child, mins, maxs, stamp))
+			return false;
+	}
+	return true;
+}
+
+/*
+===============
+SV_TraceSlot
+
+===============
+*/
+static tracecache_t *SV_TraceSlot (const vec3_t & start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end, int type, edict_t *passedict)
+{
+	unsigned	hash;
+	int			i;
+	const int	*bits;
+
+	hash = type + (unsigned)(size_t)passedict;
+	bits = (const int *)start.Ptr();
+	for (i=0 ; i<3 ; i++)
+		hash = hash*31 + bits[i];
+	bits = (const int *)end.Ptr();
+	for (i=0 ; i<3 ; i++)
+		hash = hash*31 + bits[i];
+	bits = (const int *)mins.Ptr();
+	for (i=0 ; i<3 ; i++)
+		hash = hash*31 + bits[i];
+	bits = (const int *)maxs.Ptr();
+	for (i=0 ; i<3 ; i++)
+		hash = hash*31 + bits[i];
+	hash ^= hash >> 16;
+
+	return &sv.world->tracecaches[hash & (TRACE_CACHE_SIZE-1)];
+}
+
+/*
+===============
+SV_LookupTrace
+
+Returns the slot for the move, and sets *hit if it holds a good trace for it
+===============
+*/
+static tracecache_t *SV_LookupTrace (const vec3_t & start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end, int type, edict_t *passedict, qboolean *hit)
+{
+	tracecache_t	*c;
+
+	c = SV_TraceSlot (start, mins, maxs, end, type, passedict);
+	sv.world->tracestats.lookups++;
+	*hit = false;
+
+	if (c->frame != sv.world->traceframe || c->type != type || c->passedict != passedict
+	|| memcmp (&c->start, &start, sizeof(vec3_t)) || memcmp (&c->end, &end, sizeof(vec3_t))
+	|| memcmp (&c->mins, &mins, sizeof(vec3_t)) || memcmp (&c->maxs, &maxs, sizeof(vec3_t)))
+		return c;
+	if (passedict && (c->passowner != passedict->v.owner
+	|| c->passpoint != !passedict->v.size[0]))
+		return c;
+
+	if (!SV_AreaUnchanged (sv.world->areanodes, c->boxmins, c->boxmaxs, c->stamp))
+	{
+		sv.world->tracestats.stale++;
+		return c;
+	}
+
+	sv.world->tracestats.hits++;
+	*hit = true;
+	return c;
+}
+
+/*
+===============
+SV_StoreTrace
+
+===============
+*/
+static void SV_StoreTrace (tracecache_t *c, moveclip_t *clip, const vec3_t & start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end)
+{
+	c->frame = sv.world->traceframe;
+	c->stamp = sv.world->tracestamp;
+	c->start = start;
+	c->end = end;
+	c->mins = mins;
+	c->maxs = maxs;
+	c->type = clip->type;
+	c->passedict = clip->passedict;
+	if (clip->passedict)
+	{
+		c->passowner = clip->passedict->v.owner;
+		c->passpoint = !clip->passedict->v.size[0];
+	}
+	c->boxmins = clip->boxmins;
+	c->boxmaxs = clip->boxmaxs;
+	c->trace = clip->trace;
+}
+
+/*
+===============
+SV_TraceStats_f
+
+Prints how well sv_tracecache has done since the last call
+===============
+*/
+void SV_TraceStats_f (void)
+{
+	tracestats_t	*s;
+
+	if (!sv.active)
+	{
+		Con_Printf ("no server running\n");
+		return;
+	}
+
+	s = &sv.world->tracestats;
+	if (!sv_tracecache.value)
+		Con_Printf ("sv_tracecache is off\n");
+	Con_Printf ("%i traces in %i frames\n", s->lookups, s->frames);
+	if (s->lookups)
+		Con_Printf ("%i hits (%.1f%%), %i stale\n", s->hits, 100.0*s->hits/s->lookups, s->stale);
+	if (s->pretraced)
+		Con_Printf ("%i moves traced ahead, %i used (%.1f%%)\n", s->pretraced, s->prehits, 100.0*s->prehits/s->pretraced);
+
+	memset (s, 0, sizeof(*s));
+}
+
+
+/*
+===============================================================================
+
+POINT TESTING IN HULLS
+
+===============================================================================
+*/
+
+#if	!id386
+
+/*
+==================
+SV_HullPointContents
+
+==================
+*/
+int SV_HullPointContents (hull_t *hull, int num, const vec3_t & p)
+{
+	float		d;
+	mclipnode_t	*node;
 
 	while (num >= 0)
 	{
@@ -500,12 +1253,11 @@ int SV_HullPointContents (hull_t *hull, int num, const vec3_t & p)
 			Sys_Error ("SV_HullPointContents: bad node number");
 	
 		node = hull->clipnodes + num;
-		plane = hull->planes + node->planenum;
 		
-		if (plane->type < 3)
-			d = p[plane->type] - plane->dist;
+		if (node->type < 3)
+			d = p.Ptr()[node->type] - node->dist;
 		else
-			d = DotProduct (plane->normal, p) - plane->dist;
+			d = DotProduct (node->normal, p) - node->dist;
 		if (d < 0)
 			num = node->children[1];
 		else
@@ -572,142 +1324,498 @@ LINE TESTING IN HULLS
 // 1/32 epsilon to keep floating point happy
 #define	DIST_EPSILON	(0.03125)
 
+// crossed nodes stacked while walking a hull, deeper ones start a new walk
+// so the stack stays small enough not to need probing
+#define	MAX_HULL_STACK	32
+
+typedef struct
+{
+	int			num;			// the node the move crossed
+	int			side;			// the side of it p1 is on
+	float		p1f, p2f;
+	float		midf, frac;
+	vec3_t		p1, p2, mid;
+} hullframe_t;
+
+qboolean	sv_tracethreads;
+
 /*
 ==================
 SV_RecursiveHullCheck
 
+Walks the hull with an explicit stack of the nodes the move crosses instead
+of recursing into them, so the near side of each crossed node is finished
+before its far side is tried.  Returns false if the move hit something.
 ==================
 */
-qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, const vec3_t & p1, const vec3_t & p2, trace_t *trace)
+qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, const vec3_t & p1in, const vec3_t & p2in, trace_t *trace)
 {
-	dclipnode_t	*node;
-	mplane_t	*plane;
+	hullframe_t	stack[MAX_HULL_STACK], *f;
+	int			depth;
+	mclipnode_t	*node;
 	float		t1, t2;
 	float		frac;
 	int			i;
-	vec3_t		mid;
+	vec3_t		p1, p2, mid;
 	int			side;
 	float		midf;
 
-// check for empty
-	if (num < 0)
+	p1 = p1in;
+	p2 = p2in;
+	depth = 0;
+
+	while (1)
 	{
-		if (num != CONTENTS_SOLID)
+	// go down to the leaf p1 is in, stacking the nodes the move crosses
+		while (num >= 0)
+		{
+			if (num < hull->firstclipnode || num > hull->lastclipnode)
+				Sys_Error ("SV_RecursiveHullCheck: bad node number");
+
+		//
+		// find the point distances
+		//
+			node = hull->clipnodes + num;
+
+			if (node->type < 3)
+			{
+				t1 = p1.Ptr()[node->type] - node->dist;
+				t2 = p2.Ptr()[node->type] - node->dist;
+			}
+			else
+			{
+				t1 = DotProduct (node->normal, p1) - node->dist;
+				t2 = DotProduct (node->normal, p2) - node->dist;
+			}
+
+			if (t1 >= 0 && t2 >= 0)
+			{
+				num = node->children[0];
+				continue;
+			}
+			if (t1 < 0 && t2 < 0)
+			{
+				num = node->children[1];
+				continue;
+			}
+
+		// put the crosspoint DIST_EPSILON pixels on the near side
+			if (t1 < 0)
+				frac = (t1 + DIST_EPSILON)/(t1-t2);
+			else
+				frac = (t1 - DIST_EPSILON)/(t1-t2);
+			if (frac < 0)
+				frac = 0;
+			if (frac > 1)
+				frac = 1;
+
+			midf = p1f + (p2f - p1f)*frac;
+			for (i=0 ; i<3 ; i++)
+				mid[i] = p1[i] + frac*(p2[i] - p1[i]);
+
+			side = (t1 < 0);
+
+			if (depth == MAX_HULL_STACK)
+			{	// finish this node with a stack of its own
+				if (!SV_RecursiveHullCheck (hull, num, p1f, p2f, p1, p2, trace))
+					return false;
+				break;
+			}
+			f = &stack[depth++];
+			f->num = num;
+			f->side = side;
+			f->p1f = p1f;
+			f->p2f = p2f;
+			f->midf = midf;
+			f->frac = frac;
+			f->p1 = p1;
+			f->p2 = p2;
+			f->mid = mid;
+
+		// move up to the node
+			num = node->children[side];
+			p2f = midf;
+			p2 = mid;
+		}
+
+	// check for empty
+		if (num < 0)
 		{
-			trace->allsolid = false;
-			if (num == CONTENTS_EMPTY)
-				trace->inopen = true;
+			if (num != CONTENTS_SOLID)
+			{
+				trace->allsolid = false;
+				if (num == CONTENTS_EMPTY)
+					trace->inopen = true;
+				else
+					trace->inwater = true;
+			}
 			else
-				trace->inwater = true;
+				trace->startsolid = true;
+		}
+
+		if (!depth)
+			return true;		// empty
+
+	// the near side of the last crossed node is done, go past the node
+	// unless the other side of it is solid
+		f = &stack[--depth];
+		node = hull->clipnodes + f->num;
+		side = f->side;
+
+		if (SV_HullPointContents (hull, node->children[side^1], f->mid)
+		!= CONTENTS_SOLID)
+		{
+			num = node->children[side^1];
+			p1f = f->midf;
+			p2f = f->p2f;
+			p1 = f->mid;
+			p2 = f->p2;
+			continue;
+		}
+
+		if (trace->allsolid)
+			return false;		// never got out of the solid area
+
+	//==================
+	// the other side of the node is solid, this is the impact point
+	//==================
+		if (!side)
+		{
+			VectorCopy (node->normal, trace->plane.normal);
+			trace->plane.dist = node->dist;
 		}
 		else
-			trace->startsolid = true;
-		return true;		// empty
+		{
+			VectorSubtract (vec3_origin, node->normal, trace->plane.normal);
+			trace->plane.dist = -node->dist;
+		}
+
+		frac = f->frac;
+		midf = f->midf;
+		mid = f->mid;
+		while (SV_HullPointContents (hull, hull->firstclipnode, mid)
+		== CONTENTS_SOLID)
+		{ // shouldn't really happen, but does occasionally
+			frac -= 0.1;
+			if (frac < 0)
+			{
+				trace->fraction = midf;
+				VectorCopy (mid, trace->endpos);
+				if (!sv_tracethreads)
+					Con_DPrintf ("backup past 0\n");
+				return false;
+			}
+			midf = f->p1f + (f->p2f - f->p1f)*frac;
+			for (i=0 ; i<3 ; i++)
+				mid[i] = f->p1[i] + frac*(f->p2[i] - f->p1[i]);
+		}
+
+		trace->fraction = midf;
+		VectorCopy (mid, trace->endpos);
+
+		return false;
 	}
+}
 
-	if (num < hull->firstclipnode || num > hull->lastclipnode)
-		Sys_Error ("SV_RecursiveHullCheck: bad node number");
 
-//
-// find the point distances
-//
-	node = hull->clipnodes + num;
-	plane = hull->planes + node->planenum;
+/*
+===============================================================================
+
+BATCHED LINE TESTING
+
+Moves through the same hull are walked down the tree together while they
+stay on the same side of every node, testing a plane against four of them at
+a time.  Each move is handed to SV_RecursiveHullCheck at the first node it
+crosses, which gives exactly the same trace as walking it from the top.
+
+===============================================================================
+*/
+
+#define	HULL_BATCH		16			// moves walked together, a multiple of 4
+
+typedef struct
+{
+	float		c1[3][HULL_BATCH];	// start points, one array per axis
+	float		c2[3][HULL_BATCH];	// end points
+	int			lanes;				// count rounded up to a multiple of 4
+} hullbatch_t;
+
+/*
+==================
+SV_BatchPlaneSides
+
+Returns masks of the moves entirely on the front and on the back of the plane
+==================
+*/
+static void SV_BatchPlaneSides (hullbatch_t *b, mclipnode_t *node, unsigned *front, unsigned *back)
+{
+	int		i;
+#if HULL_SSE
+	__m128	dist, zero, nx, ny, nz, d1, d2;
 
-	if (plane->type < 3)
+	dist = _mm_set1_ps (node->dist);
+	zero = _mm_setzero_ps ();
+	*front = *back = 0;
+	if (node->type < 3)
 	{
-		t1 = p1[plane->type] - plane->dist;
-		t2 = p2[plane->type] - plane->dist;
+		for (i=0 ; i<b->lanes ; i+=4)
+		{
+			d1 = _mm_sub_ps (_mm_loadu_ps (&b->c1[node->type][i]), dist);
+			d2 = _mm_sub_ps (_mm_loadu_ps (&b->c2[node->type][i]), dist);
+			*front |= _mm_movemask_ps (_mm_and_ps (_mm_cmpge_ps (d1, zero), _mm_cmpge_ps (d2, zero))) << i;
+			*back |= _mm_movemask_ps (_mm_and_ps (_mm_cmplt_ps (d1, zero), _mm_cmplt_ps (d2, zero))) << i;
+		}
+		return;
 	}
-	else
+
+// same order of operations as DotProduct
+	nx = _mm_set1_ps (node->normal[0]);
+	ny = _mm_set1_ps (node->normal[1]);
+	nz = _mm_set1_ps (node->normal[2]);
+	for (i=0 ; i<b->lanes ; i+=4)
 	{
-		t1 = DotProduct (plane->normal, p1) - plane->dist;
-		t2 = DotProduct (plane->normal, p2) - plane->dist;
+		d1 = _mm_add_ps (_mm_add_ps (_mm_mul_ps (nx, _mm_loadu_ps (&b->c1[0][i])),
+			_mm_mul_ps (ny, _mm_loadu_ps (&b->c1[1][i]))), _mm_mul_ps (nz, _mm_loadu_ps (&b->c1[2][i])));
+		d2 = _mm_add_ps (_mm_add_ps (_mm_mul_ps (nx, _mm_loadu_ps (&b->c2[0][i])),
+			_mm_mul_ps (ny, _mm_loadu_ps (&b->c2[1][i]))), _mm_mul_ps (nz, _mm_loadu_ps (&b->c2[2][i])));
+		d1 = _mm_sub_ps (d1, dist);
+		d2 = _mm_sub_ps (d2, dist);
+		*front |= _mm_movemask_ps (_mm_and_ps (_mm_cmpge_ps (d1, zero), _mm_cmpge_ps (d2, zero))) << i;
+		*back |= _mm_movemask_ps (_mm_and_ps (_mm_cmplt_ps (d1, zero), _mm_cmplt_ps (d2, zero))) << i;
 	}
-	
-#if 1
-	if (t1 >= 0 && t2 >= 0)
-		return SV_RecursiveHullCheck (hull, node->children[0], p1f, p2f, p1, p2, trace);
-	if (t1 < 0 && t2 < 0)
-		return SV_RecursiveHullCheck (hull, node->children[1], p1f, p2f, p1, p2, trace);
 #else
-	if ( (t1 >= DIST_EPSILON && t2 >= DIST_EPSILON) || (t2 > t1 && t1 >= 0) )
-		return SV_RecursiveHullCheck (hull, node->children[0], p1f, p2f, p1, p2, trace);
-	if ( (t1 <= -DIST_EPSILON && t2 <= -DIST_EPSILON) || (t2 < t1 && t1 <= 0) )
-		return SV_RecursiveHullCheck (hull, node->children[1], p1f, p2f, p1, p2, trace);
-#endif
+	float	t1[HULL_BATCH], t2[HULL_BATCH];
 
-// put the crosspoint DIST_EPSILON pixels on the near side
-	if (t1 < 0)
-		frac = (t1 + DIST_EPSILON)/(t1-t2);
+	if (node->type < 3)
+	{
+		for (i=0 ; i<b->lanes ; i++)
+		{
+			t1[i] = b->c1[node->type][i] - node->dist;
+			t2[i] = b->c2[node->type][i] - node->dist;
+		}
+	}
 	else
-		frac = (t1 - DIST_EPSILON)/(t1-t2);
-	if (frac < 0)
-		frac = 0;
-	if (frac > 1)
-		frac = 1;
-		
-	midf = p1f + (p2f - p1f)*frac;
-	for (i=0 ; i<3 ; i++)
-		mid[i] = p1[i] + frac*(p2[i] - p1[i]);
+	{
+		for (i=0 ; i<b->lanes ; i++)
+		{
+			t1[i] = node->normal[0]*b->c1[0][i] + node->normal[1]*b->c1[1][i] + node->normal[2]*b->c1[2][i] - node->dist;
+			t2[i] = node->normal[0]*b->c2[0][i] + node->normal[1]*b->c2[1][i] + node->normal[2]*b->c2[2][i] - node->dist;
+		}
+	}
 
-	side = (t1 < 0);
+	*front = *back = 0;
+	for (i=0 ; i<b->lanes ; i++)
+	{
+		if (t1[i] >= 0 && t2[i] >= 0)
+			*front |= 1<<i;
+		else if (t1[i] < 0 && t2[i] < 0)
+			*back |= 1<<i;
+	}
+#endif
+}
 
-// move up to the node
-	if (!SV_RecursiveHullCheck (hull, node->children[side], p1f, midf, p1, mid, trace) )
-		return false;
+/*
+==================
+SV_HullCheckBatch
 
-#ifdef PARANOID
-	if (SV_HullPointContents (sv_hullmodel, mid, node->children[side])
-	== CONTENTS_SOLID)
+Traces count moves of up to HULL_BATCH from p1 to p2 through the hull, the
+same as calling SV_RecursiveHullCheck (hull, num, 0, 1, ...) for each
+==================
+*/
+static void SV_HullCheckBatch (hull_t *hull, int num, int count, const vec3_t *p1, const vec3_t *p2, trace_t *traces)
+{
+	hullbatch_t	b;
+	struct
 	{
-		Con_Printf ("mid PointInHullSolid\n");
-		return false;
+		int			num;
+		unsigned	active;
+	} stack[MAX_HULL_STACK];
+	int			depth;
+	int			i, j;
+	unsigned	active, front, back, cross;
+	mclipnode_t	*node;
+
+	if (count > HULL_BATCH)
+		Sys_Error ("SV_HullCheckBatch: %i moves", count);
+
+	b.lanes = (count + 3) & ~3;
+	for (i=0 ; i<b.lanes ; i++)
+	{
+		for (j=0 ; j<3 ; j++)
+		{
+			b.c1[j][i] = i < count ? p1[i][j] : 0;
+			b.c2[j][i] = i < count ? p2[i][j] : 0;
+		}
 	}
-#endif
-	
-	if (SV_HullPointContents (hull, node->children[side^1], mid)
-	!= CONTENTS_SOLID)
-// go past the node
-		return SV_RecursiveHullCheck (hull, node->children[side^1], midf, p2f, mid, p2, trace);
-	
-	if (trace->allsolid)
-		return false;		// never got out of the solid area
-		
-//==================
-// the other side of the node is solid, this is the impact point
-//==================
-	if (!side)
+
+	active = (1u << count) - 1;
+	depth = 0;
+
+	while (1)
 	{
-		VectorCopy (plane->normal, trace->plane.normal);
-		trace->plane.dist = plane->dist;
+		if (num >= 0 && (active & (active - 1)))
+		{
+			if (num < hull->firstclipnode || num > hull->lastclipnode)
+				Sys_Error ("SV_HullCheckBatch: bad node number");
+
+			node = hull->clipnodes + num;
+			SV_BatchPlaneSides (&b, node, &front, &back);
+			front &= active;
+			back &= active;
+
+		// moves that cross the node are finished on their own from here
+			cross = active & ~(front | back);
+			for (i=0 ; cross ; i++, cross >>= 1)
+				if (cross & 1)
+					SV_RecursiveHullCheck (hull, num, 0, 1, p1[i], p2[i], &traces[i]);
+
+			if (front && back)
+			{
+				if (depth < MAX_HULL_STACK)
+				{
+					stack[depth].num = node->children[1];
+					stack[depth].active = back;
+					depth++;
+				}
+				else
+				{	// out of stack, finish them on their own
+					for (i=0 ; back ; i++, back >>= 1)
+						if (back & 1)
+							SV_RecursiveHullCheck (hull, node->children[1], 0, 1, p1[i], p2[i], &traces[i]);
+				}
+			}
+			if (front)
+			{
+				num = node->children[0];
+				active = front;
+				continue;
+			}
+			if (back)
+			{
+				num = node->children[1];
+				active = back;
+				continue;
+			}
+		}
+		else
+		{	// leaves and lone moves
+			for (i=0 ; active ; i++, active >>= 1)
+				if (active & 1)
+					SV_RecursiveHullCheck (hull, num, 0, 1, p1[i], p2[i], &traces[i]);
+		}
+
+		if (!depth)
+			return;
+		depth--;
+		num = stack[depth].num;
+		active = stack[depth].active;
 	}
-	else
+}
+
+
+/*
+===============================================================================
+
+TRACE TIMING
+
+===============================================================================
+*/
+
+#define	TIME_TRACES		20000
+#define	TIME_RUNS		5
+
+static unsigned	sv_timeseed;
+
+static float SV_TimeRandom (float lo, float hi)
+{
+	sv_timeseed = sv_timeseed * 1103515245 + 12345;
+	return lo + (hi - lo) * ((sv_timeseed >> 8) & 0xffff) / 65535.0;
+}
+
+/*
+==================
+SV_TimeTraces_f
+
+Traces the same pseudo random moves through each clipping hull of the world
+and prints the best time per trace and per point test out of a few runs.
+The checksum covers every trace result, so it only changes if one of them
+comes out differently.
+==================
+*/
+void SV_TimeTraces_f (void)
+{
+	int			i, j, h, run, contents;
+	vec3_t		*starts, *ends;
+	hull_t		*hull;
+	trace_t		trace;
+	unsigned	sum;
+	byte		*b;
+	double		start, tracetime, pointtime, t;
+
+	if (!sv.active)
 	{
-		VectorSubtract (vec3_origin, plane->normal, trace->plane.normal);
-		trace->plane.dist = -plane->dist;
+		Con_Printf ("no server running\n");
+		return;
 	}
 
-	while (SV_HullPointContents (hull, hull->firstclipnode, mid)
-	== CONTENTS_SOLID)
-	{ // shouldn't really happen, but does occasionally
-		frac -= 0.1;
-		if (frac < 0)
+	starts = (vec3_t *)Hunk_TempAlloc (2*TIME_TRACES*sizeof(vec3_t));
+	ends = starts + TIME_TRACES;
+	sv_timeseed = 1;
+	for (i=0 ; i<TIME_TRACES ; i++)
+	{
+		for (j=0 ; j<3 ; j++)
 		{
-			trace->fraction = midf;
-			VectorCopy (mid, trace->endpos);
-			Con_DPrintf ("backup past 0\n");
-			return false;
+			starts[i][j] = SV_TimeRandom (sv.worldmodel->mins[j], sv.worldmodel->maxs[j]);
+			ends[i][j] = starts[i][j] + SV_TimeRandom (-512, 512);
 		}
-		midf = p1f + (p2f - p1f)*frac;
-		for (i=0 ; i<3 ; i++)
-			mid[i] = p1[i] + frac*(p2[i] - p1[i]);
 	}
 
-	trace->fraction = midf;
-	VectorCopy (mid, trace->endpos);
+	Con_Printf ("%s\n", sv.worldmodel->name);
+	Con_Printf ("hull  nodes  trace usec  point usec  checksum\n");
+	for (h=0 ; h<3 ; h++)
+	{
+		hull = &sv.worldmodel->hulls[h];
+
+		tracetime = pointtime = 0;
+		for (run=0 ; run<TIME_RUNS ; run++)
+		{
+			start = Sys_FloatTime ();
+			for (i=0 ; i<TIME_TRACES ; i++)
+			{
+				memset (&trace, 0, sizeof(trace));
+				trace.fraction = 1;
+				trace.allsolid = true;
+				SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, starts[i], ends[i], &trace);
+			}
+			t = Sys_FloatTime () - start;
+			if (!run || t < tracetime)
+				tracetime = t;
+
+			contents = 0;
+			start = Sys_FloatTime ();
+			for (i=0 ; i<TIME_TRACES ; i++)
+				contents += SV_HullPointContents (hull, hull->firstclipnode, starts[i]);
+			t = Sys_FloatTime () - start;
+			if (!run || t < pointtime)
+				pointtime = t;
+		}
+
+		sum = contents;
+		for (i=0 ; i<TIME_TRACES ; i++)
+		{
+			memset (&trace, 0, sizeof(trace));
+			trace.fraction = 1;
+			trace.allsolid = true;
+			VectorCopy (ends[i], trace.endpos);
+			SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, starts[i], ends[i], &trace);
+			b = (byte *)&trace;
+			for (j=0 ; j<(int)sizeof(trace) ; j++)
+				sum = sum*31 + b[j];
+		}
 
-	return false;
+		Con_Printf ("%4i  %5i  %10.3f  %10.3f  %08x\n", h, hull->lastclipnode - hull->firstclipnode + 1,
+			tracetime*1000000/TIME_TRACES, pointtime*1000000/TIME_TRACES, sum);
+	}
 }
 
 
@@ -719,7 +1827,7 @@ Handles selection or creation of a clipping hull, and offseting (and
 eventually rotation) of the end points
 ==================
 */
-trace_t SV_ClipMoveToEntity (edict_t *ent, const vec3_t & start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end)
+trace_t SV_ClipMoveToEntity (edict_t *ent, hull_t *box, const vec3_t & start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end)
 {
 	trace_t		trace;
 	vec3_t		offset;
@@ -733,7 +1841,7 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, const vec3_t & start, const vec3_t &
 	VectorCopy (end, trace.endpos);
 
 // get the clipping hull
-	hull = SV_HullForEntity (ent, mins, maxs, offset);
+	hull = SV_HullForEntity (ent, mins, maxs, offset, box);
 
 	VectorSubtract (start, offset, start_l);
 	VectorSubtract (end, offset, end_l);
@@ -804,6 +1912,72 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, const vec3_t & start, const vec3_t &
 
 //===========================================================================
 
+/*
+====================
+SV_ClipToEdict
+
+Returns false if the move has been found to be all solid, which nothing
+after it can change
+====================
+*/
+static qboolean SV_ClipToEdict (moveclip_t *clip, edict_t *touch)
+{
+	trace_t		trace;
+
+	if (touch->v.solid == SOLID_NOT)
+		return true;
+	if (touch == clip->passedict)
+		return true;
+	if (touch->v.solid == SOLID_TRIGGER)
+		Sys_Error ("Trigger in clipping list");
+
+	if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
+		return true;
+
+	if (clip->boxmins[0] > touch->v.absmax[0]
+	|| clip->boxmins[1] > touch->v.absmax[1]
+	|| clip->boxmins[2] > touch->v.absmax[2]
+	|| clip->boxmaxs[0] < touch->v.absmin[0]
+	|| clip->boxmaxs[1] < touch->v.absmin[1]
+	|| clip->boxmaxs[2] < touch->v.absmin[2] )
+		return true;
+
+	if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0])
+		return true;	// points never interact
+
+// might intersect, so do an exact clip
+	if (clip->trace.allsolid)
+		return false;
+	if (clip->passedict)
+	{
+	 	if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
+			return true;	// don't clip against own missiles
+		if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
+			return true;	// don't clip against owner
+	}
+
+	if ((int)touch->v.flags & FL_MONSTER)
+		trace = SV_ClipMoveToEntity (touch, clip->box, vec3_t(clip->start), clip->mins2, clip->maxs2, vec3_t(clip->end));
+	else
+		trace = SV_ClipMoveToEntity (touch, clip->box, vec3_t(clip->start), vec3_t(clip->mins), vec3_t(clip->maxs), vec3_t(clip->end));
+	if (trace.allsolid || trace.startsolid ||
+	trace.fraction < clip->trace.fraction)
+	{
+		trace.ent = touch;
+	 	if (clip->trace.startsolid)
+		{
+			clip->trace = trace;
+			clip->trace.startsolid = true;
+		}
+		else
+			clip->trace = trace;
+	}
+	else if (trace.startsolid)
+		clip->trace.startsolid = true;
+
+	return true;
+}
+
 /*
 ====================
 SV_ClipToLinks
@@ -815,73 +1989,35 @@ void SV_ClipToLinks ( areanode_t *node, moveclip_t *clip )
 {
 	link_t		*l, *next;
 	edict_t		*touch;
-	trace_t		trace;
+	areanode_t	*child;
+	int			side;
+
+	sv.world->areastats.nodes++;
 
 // touch linked edicts
 	for (l = node->solid_edicts.next ; l != &node->solid_edicts ; l = next)
 	{
 		next = l->next;
 		touch = EDICT_FROM_AREA(l);
-		if (touch->v.solid == SOLID_NOT)
-			continue;
-		if (touch == clip->passedict)
-			continue;
-		if (touch->v.solid == SOLID_TRIGGER)
-			Sys_Error ("Trigger in clipping list");
-
-		if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
-			continue;
-
-		if (clip->boxmins[0] > touch->v.absmax[0]
-		|| clip->boxmins[1] > touch->v.absmax[1]
-		|| clip->boxmins[2] > touch->v.absmax[2]
-		|| clip->boxmaxs[0] < touch->v.absmin[0]
-		|| clip->boxmaxs[1] < touch->v.absmin[1]
-		|| clip->boxmaxs[2] < touch->v.absmin[2] )
-			continue;
-
-		if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0])
-			continue;	// points never interact
-
-	// might intersect, so do an exact clip
-		if (clip->trace.allsolid)
+		sv.world->areastats.candidates++;
+		if (!SV_ClipToEdict (clip, touch))
 			return;
-		if (clip->passedict)
-		{
-		 	if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
-				continue;	// don't clip against own missiles
-			if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
-				continue;	// don't clip against owner
-		}
-
-		if ((int)touch->v.flags & FL_MONSTER)
-			trace = SV_ClipMoveToEntity (touch, vec3_t(clip->start), clip->mins2, clip->maxs2, vec3_t(clip->end));
-		else
-			trace = SV_ClipMoveToEntity (touch, vec3_t(clip->start), vec3_t(clip->mins), vec3_t(clip->maxs), vec3_t(clip->end));
-		if (trace.allsolid || trace.startsolid ||
-		trace.fraction < clip->trace.fraction)
-		{
-			trace.ent = touch;
-		 	if (clip->trace.startsolid)
-			{
-				clip->trace = trace;
-				clip->trace.startsolid = true;
-			}
-			else
-				clip->trace = trace;
-		}
-		else if (trace.startsolid)
-			clip->trace.startsolid = true;
 	}
 	
-// recurse down both sides
-	if (node->axis == -1)
+// recurse into the children the move can reach
+	if (!node->children)
 		return;
 
-	if ( clip->boxmaxs[node->axis] > node->dist )
-		SV_ClipToLinks ( node->children[0], clip );
-	if ( clip->boxmins[node->axis] < node->dist )
-		SV_ClipToLinks ( node->children[1], clip );
+	for (side=0 ; side<8 ; side++)
+	{
+		child = &node->children[side];
+		if (!child->numedicts
+		|| clip->boxmins[0] > child->maxs[0] || clip->boxmaxs[0] < child->mins[0]
+		|| clip->boxmins[1] > child->maxs[1] || clip->boxmaxs[1] < child->mins[1]
+		|| clip->boxmins[2] > child->maxs[2] || clip->boxmaxs[2] < child->mins[2])
+			continue;
+		SV_ClipToLinks (child, clip);
+	}
 }
 
 
@@ -917,46 +2053,338 @@ boxmaxs[0] = boxmaxs[1] = boxmaxs[2] = 9999;
 
 /*
 ==================
-SV_Move
+SV_InitMoveClip
+
+Fills in everything but clip->trace
 ==================
 */
-trace_t SV_Move (const vec3_t start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end, int type, edict_t *passedict)
+static void SV_InitMoveClip (moveclip_t *clip, const vec3_t & start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end, int type, edict_t *passedict)
 {
-	moveclip_t	clip;
 	int			i;
 
-	memset ( &clip, 0, sizeof ( moveclip_t ) );
-
-// clip to world
-	clip.trace = SV_ClipMoveToEntity ( sv.edicts, start, mins, maxs, end );
-
-	clip.start = start.Ptr();
-	clip.end = end.Ptr();
-	clip.mins = mins.Ptr();
-	clip.maxs = maxs.Ptr();
-	clip.type = type;
-	clip.passedict = passedict;
+	clip->start = start.Ptr();
+	clip->end = end.Ptr();
+	clip->mins = mins.Ptr();
+	clip->maxs = maxs.Ptr();
+	clip->type = type;
+	clip->passedict = passedict;
+	clip->box = &box_hull;
 
 	if (type == MOVE_MISSILE)
 	{
 		for (i=0 ; i<3 ; i++)
 		{
-			clip.mins2[i] = -15;
-			clip.maxs2[i] = 15;
+			clip->mins2[i] = -15;
+			clip->maxs2[i] = 15;
 		}
 	}
 	else
 	{
-		VectorCopy (mins, clip.mins2);
-		VectorCopy (maxs, clip.maxs2);
+		VectorCopy (mins, clip->mins2);
+		VectorCopy (maxs, clip->maxs2);
 	}
 	
 // create the bounding box of the entire move
-	SV_MoveBounds ( start, clip.mins2, clip.maxs2, end, clip.boxmins, clip.boxmaxs );
+	SV_MoveBounds ( start, clip->mins2, clip->maxs2, end, clip->boxmins, clip->boxmaxs );
+}
+
+/*
+==================
+SV_Move
+==================
+*/
+trace_t SV_Move (const vec3_t start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end, int type, edict_t *passedict)
+{
+	moveclip_t	clip;
+	tracecache_t	*c;
+	qboolean	hit;
+
+	c = NULL;
+	if (sv_tracecache.value)
+	{
+		c = SV_LookupTrace (start, mins, maxs, end, type, passedict, &hit);
+		if (hit)
+			return c->trace;
+	}
+
+	memset ( &clip, 0, sizeof ( moveclip_t ) );
+
+// clip to world
+	clip.trace = SV_ClipMoveToEntity ( sv.edicts, &box_hull, start, mins, maxs, end );
+
+	SV_InitMoveClip (&clip, start, mins, maxs, end, type, passedict);
 
 // clip to entities
-	SV_ClipToLinks ( sv_areanodes, &clip );
+	sv.world->areastats.queries++;
+	SV_ClipToLinks ( sv.world->areanodes, &clip );
+
+	if (c)
+		SV_StoreTrace (c, &clip, start, mins, maxs, end);
 
 	return clip.trace;
 }
 
+/*
+==================
+SV_MoveBatchUncached
+
+The moves are usually close together, so the linked entities are gathered
+once for all of them.  SV_AreaEdicts walks the area tree in the same order as
+SV_ClipToLinks, so each move is clipped against its entities in the same
+order as SV_Move would.
+==================
+*/
+#define	MAX_BATCH_EDICTS	256
+
+static void SV_MoveBatchUncached (int count, const vec3_t *start, const vec3_t & mins, const vec3_t & maxs, const vec3_t *end, int type, edict_t *passedict, trace_t *traces)
+{
+	moveclip_t	clip;
+	vec3_t		offset;
+	vec3_t		start_l[HULL_BATCH], end_l[HULL_BATCH];
+	vec3_t		boxmins, boxmaxs;
+	edict_t		*touch[MAX_BATCH_EDICTS];
+	hull_t		*hull;
+	trace_t		*trace;
+	tracecache_t	*c;
+	int			i, j, n, numtouch;
+
+	if (count <= 0)
+		return;
+
+// clip to world, the same as SV_ClipMoveToEntity but walking the moves
+// through the hull together
+	hull = SV_HullForEntity (sv.edicts, mins, maxs, offset, &box_hull);
+
+	for (i=0 ; i<count ; i+=n)
+	{
+		n = count - i;
+		if (n > HULL_BATCH)
+			n = HULL_BATCH;
+
+		for (j=0 ; j<n ; j++)
+		{
+			trace = &traces[i+j];
+			memset (trace, 0, sizeof(trace_t));
+			trace->fraction = 1;
+			trace->allsolid = true;
+			trace->endpos = end[i+j];
+
+			VectorSubtract (start[i+j], offset, start_l[j]);
+			VectorSubtract (end[i+j], offset, end_l[j]);
+		}
+
+		SV_HullCheckBatch (hull, hull->firstclipnode, n, start_l, end_l, traces + i);
+	}
+
+// gather the entities any of the moves can touch
+	for (i=0 ; i<count ; i++)
+	{
+		memset ( &clip, 0, sizeof ( moveclip_t ) );
+		SV_InitMoveClip (&clip, start[i], mins, maxs, end[i], type, passedict);
+		for (j=0 ; j<3 ; j++)
+		{
+			if (!i || clip.boxmins[j] < boxmins[j])
+				boxmins[j] = clip.boxmins[j];
+			if (!i || clip.boxmaxs[j] > boxmaxs[j])
+				boxmaxs[j] = clip.boxmaxs[j];
+		}
+	}
+	numtouch = SV_AreaEdicts (boxmins, boxmaxs, touch, MAX_BATCH_EDICTS, AREA_SOLID);
+
+	for (i=0 ; i<count ; i++)
+	{
+		trace = &traces[i];
+		if (trace->fraction != 1)
+			VectorAdd (trace->endpos, offset, trace->endpos);
+		if (trace->fraction < 1 || trace->startsolid)
+			trace->ent = sv.edicts;
+
+		memset ( &clip, 0, sizeof ( moveclip_t ) );
+		clip.trace = *trace;
+		SV_InitMoveClip (&clip, start[i], mins, maxs, end[i], type, passedict);
+
+	// clip to entities
+		if (numtouch == MAX_BATCH_EDICTS)
+		{	// the list may have been cut short
+			sv.world->areastats.queries++;
+			SV_ClipToLinks ( sv.world->areanodes, &clip );
+		}
+		else
+		{
+			for (j=0 ; j<numtouch ; j++)
+				if (!SV_ClipToEdict (&clip, touch[j]))
+					break;
+		}
+		*trace = clip.trace;
+
+		if (sv_tracecache.value)
+		{
+			c = SV_TraceSlot (start[i], mins, maxs, end[i], type, passedict);
+			SV_StoreTrace (c, &clip, start[i], mins, maxs, end[i]);
+		}
+	}
+}
+
+/*
+==================
+SV_MoveBatch
+
+Only the moves sv_tracecache doesn't have are traced
+==================
+*/
+void SV_MoveBatch (int count, const vec3_t *start, const vec3_t & mins, const vec3_t & maxs, const vec3_t *end, int type, edict_t *passedict, trace_t *traces)
+{
+	vec3_t		missstart[HULL_BATCH], missend[HULL_BATCH];
+	trace_t		misstraces[HULL_BATCH];
+	int			missed[HULL_BATCH];
+	tracecache_t	*c;
+	qboolean	hit;
+	int			i, j, n, nummissed;
+
+	if (!sv_tracecache.value)
+	{
+		SV_MoveBatchUncached (count, start, mins, maxs, end, type, passedict, traces);
+		return;
+	}
+
+// only trace the moves that aren't cached
+	for (i=0 ; i<count ; i+=n)
+	{
+		n = count - i;
+		if (n > HULL_BATCH)
+			n = HULL_BATCH;
+
+		nummissed = 0;
+		for (j=i ; j<i+n ; j++)
+		{
+			c = SV_LookupTrace (start[j], mins, maxs, end[j], type, passedict, &hit);
+			if (hit)
+			{
+				traces[j] = c->trace;
+				continue;
+			}
+			missstart[nummissed] = start[j];
+			missend[nummissed] = end[j];
+			missed[nummissed++] = j;
+		}
+		if (!nummissed)
+			continue;
+
+		SV_MoveBatchUncached (nummissed, missstart, mins, maxs, missend, type, passedict, misstraces);
+		for (j=0 ; j<nummissed ; j++)
+			traces[missed[j]] = misstraces[j];
+	}
+}
+
+
+/*
+===============================================================================
+
+PRETRACES
+
+SV_Physics can trace the moves of edicts that are off on their own on the
+worker threads before it runs them.  The edicts a move could hit are
+gathered from the area tree up front, so the threads only read edicts and
+the world.  The trace is only used if the physics makes the same move and
+the edicts in its box are the same ones, with stamps no newer than when
+they were gathered.
+
+===============================================================================
+*/
+
+/*
+==================
+SV_InitPreTrace
+
+Fills in everything but the trace and returns how many edicts the move could
+hit, MAX_PRETOUCH if there were too many to gather
+==================
+*/
+int SV_InitPreTrace (pretrace_t *p, const vec3_t & start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end, int type, edict_t *passedict)
+{
+	moveclip_t	clip;
+
+	SV_InitMoveClip (&clip, start, mins, maxs, end, type, passedict);
+
+	p->start = start;
+	p->mins = mins;
+	p->maxs = maxs;
+	p->end = end;
+	p->type = type;
+	p->passedict = passedict;
+	p->passowner = passedict->v.owner;
+	p->passpoint = !passedict->v.size[0];
+	p->boxmins = clip.boxmins;
+	p->boxmaxs = clip.boxmaxs;
+	p->stamp = sv.world->tracestamp;
+	p->numtouch = SV_AreaEdicts (clip.boxmins, clip.boxmaxs, p->touch, MAX_PRETOUCH, AREA_SOLID);
+
+	return p->numtouch;
+}
+
+/*
+==================
+SV_PreTrace
+
+The same as SV_Move, but only clipping against the gathered edicts, in the
+order SV_ClipToLinks would get to them.  Can be run on any thread.
+==================
+*/
+void SV_PreTrace (pretrace_t *p)
+{
+	moveclip_t	clip;
+	hull_t		box;
+	mclipnode_t	boxnodes[6];
+	int			i;
+
+	SV_InitBoxHull (&box, boxnodes);
+
+	memset ( &clip, 0, sizeof ( moveclip_t ) );
+	clip.trace = SV_ClipMoveToEntity ( sv.edicts, &box, p->start, p->mins, p->maxs, p->end );
+	SV_InitMoveClip (&clip, p->start, p->mins, p->maxs, p->end, p->type, p->passedict);
+	clip.box = &box;
+
+	for (i=0 ; i<p->numtouch ; i++)
+		if (!SV_ClipToEdict (&clip, p->touch[i]))
+			break;
+
+	p->trace = clip.trace;
+}
+
+/*
+==================
+SV_PreTraced
+
+Returns true if p->trace is what SV_Move would return for the move now: the
+same edicts have to be in its box, in the same order, and none of them can
+have changed since they were gathered
+==================
+*/
+qboolean SV_PreTraced (pretrace_t *p, const vec3_t & start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end, int type, edict_t *passedict)
+{
+	edict_t	*touch[MAX_PRETOUCH];
+	int		i, numtouch;
+
+	sv.world->tracestats.pretraced++;
+
+	if (p->type != type || p->passedict != passedict
+	|| memcmp (&p->start, &start, sizeof(vec3_t)) || memcmp (&p->end, &end, sizeof(vec3_t))
+	|| memcmp (&p->mins, &mins, sizeof(vec3_t)) || memcmp (&p->maxs, &maxs, sizeof(vec3_t)))
+		return false;
+	if (p->passowner != passedict->v.owner || p->passpoint != !passedict->v.size[0])
+		return false;
+
+	numtouch = SV_AreaEdicts (p->boxmins, p->boxmaxs, touch, MAX_PRETOUCH, AREA_SOLID);
+	if (numtouch != p->numtouch)
+		return false;
+	for (i=0 ; i<numtouch ; i++)
+	{
+		if (touch[i] != p->touch[i])
+			return false;
+		if (touch[i] != passedict && touch[i]->tracestamp > p->stamp)
+			return false;
+	}
+
+	sv.world->tracestats.prehits++;
+	return true;
+}
@@ -56,6 +56,35 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers);
 // sets ent->v.absmin and ent->v.absmax
 // if touchtriggers, calls prog functions for the intersected triggers
 
+#define	AREA_SOLID		1
+#define	AREA_TRIGGERS	2
+
+int SV_AreaEdicts (const vec3_t & mins, const vec3_t & maxs, edict_t **list, int maxcount, int areatype);
+// fills in the linked edicts of the AREA_* types whose absmin / absmax touch
+// the box and returns how many were found
+
+void SV_AreaMoved (edict_t *ent);
+// the origin, size or solid of the edict changed without relinking it, so
+// its absmin / absmax can't be trusted until the next SV_LinkEdict
+
+int SV_MovedEdicts (edict_t **list, int maxcount);
+// fills in the edicts flagged by SV_AreaMoved since they were last linked
+
+void SV_AreaStats_f (void);
+
+extern	cvar_t	sv_tracecache;
+
+void SV_TraceChanged (edict_t *ent);
+// something SV_Move reads from the edict changed without relinking it
+
+void SV_ClearTraceCache (void);
+void SV_NewTraceFrame (qboolean pretraces);
+// sv_tracecache only keeps traces for the frame they were made in.
+// pretraces keeps the area stamps SV_PreTraced needs up to date
+
+void SV_TraceStats_f (void);
+void SV_TimeTraces_f (void);
+
 int SV_PointContents (const vec3_t & p);
 int SV_TruePointContents (const vec3_t & p);
 // returns the CONTENTS_* value from the world at the given point.
@@ -76,3 +105,38 @@ trace_t SV_Move (vec3_t start, const vec3_t & mins, const vec3_t & maxs, const v
 // shouldn't be considered solid objects
 
 // passedict is explicitly excluded from clipping checks (normally NULL)
+
+void SV_MoveBatch (int count, const vec3_t *start, const vec3_t & mins, const vec3_t & maxs, const vec3_t *end, int type, edict_t *passedict, trace_t *traces);
+// fills in traces[i] = SV_Move (start[i], mins, maxs, end[i], type, passedict)
+// for each of count moves, tracing the world part of them together
+
+#define	MAX_PRETOUCH	16
+
+typedef struct
+{
+	vec3_t		start, mins, maxs, end;
+	int			type;
+	edict_t		*passedict;
+	int			passowner;			// passedict fields the trace depends on
+	qboolean	passpoint;
+	vec3_t		boxmins, boxmaxs;	// everything the move can reach
+	unsigned	stamp;				// area stamp when the edicts were gathered
+	edict_t		*touch[MAX_PRETOUCH];	// the solid edicts in the box
+	int			numtouch;
+	trace_t		trace;
+} pretrace_t;
+
+int SV_InitPreTrace (pretrace_t *p, const vec3_t & start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end, int type, edict_t *passedict);
+// gathers the solid edicts the move could hit, and returns how many there
+// are (MAX_PRETOUCH if they didn't all fit)
+
+void SV_PreTrace (pretrace_t *p);
+// traces the move against the world and the gathered edicts.  Any number of
+// these can run on worker threads at once, as long as nothing is linked,
+// unlinked or changed until they are all done
+
+extern	qboolean	sv_tracethreads;
+// set while SV_PreTrace runs on the worker threads, which mustn't print
+
+qboolean SV_PreTraced (pretrace_t *p, const vec3_t & start, const vec3_t & mins, const vec3_t & maxs, const vec3_t & end, int type, edict_t *passedict);
+// true if p->trace is still what SV_Move would return for the move
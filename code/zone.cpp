@@ -281,6 +281,8 @@ int		hunk_high_used;
 qboolean	hunk_tempactive;
 int		hunk_tempmark;
 
+hunkarena_t	*hunk_arena;		// low allocations go here when set
+
 void R_FreeTextures (void);
 
 /*
@@ -406,16 +408,40 @@ void *Hunk_AllocName (int size, char *name)
 
 	if (size < 0)
 		Sys_Error ("Hunk_Alloc: bad size: %i", size);
+
+	if (hunk_arena && !hunk_arena->base)
+	{	// on top of the hunk
+		h = (hunk_t *)Hunk_HighAllocName (size, name);
+		if (!h)
+			Sys_Error ("Hunk_Alloc: failed on %i bytes on top of the hunk", size);
+		hunk_arena->used = hunk_high_used - hunk_arena->highmark;
+		if (hunk_arena->peak < hunk_arena->used)
+			hunk_arena->peak = hunk_arena->used;
+		return h;
+	}
 		
 	size = sizeof(hunk_t) + ((size+15)&~15);
 	
-	if (hunk_size - hunk_low_used - hunk_high_used < size)
-		Sys_Error ("Hunk_Alloc: failed on %i bytes",size);
+	if (hunk_arena)
+	{
+		if (hunk_arena->size - hunk_arena->used < size)
+			Sys_Error ("Hunk_Alloc: failed on %i bytes in a %i byte arena", size, hunk_arena->size);
+
+		h = (hunk_t *)(hunk_arena->base + hunk_arena->used);
+		hunk_arena->used += size;
+		if (hunk_arena->peak < hunk_arena->used)
+			hunk_arena->peak = hunk_arena->used;
+	}
+	else
+	{
+		if (hunk_size - hunk_low_used - hunk_high_used < size)
+			Sys_Error ("Hunk_Alloc: failed on %i bytes",size);
 	
-	h = (hunk_t *)(hunk_base + hunk_low_used);
-	hunk_low_used += size;
+		h = (hunk_t *)(hunk_base + hunk_low_used);
+		hunk_low_used += size;
 
-	Cache_FreeLow (hunk_low_used);
+		Cache_FreeLow (hunk_low_used);
+	}
 
 	memset (h, 0, size);
 	
@@ -438,17 +464,81 @@ void *Hunk_Alloc (int size)
 
 int	Hunk_LowMark (void)
 {
+	if (hunk_arena)
+		return hunk_arena->used;
 	return hunk_low_used;
 }
 
 void Hunk_FreeToLowMark (int mark)
 {
+	if (hunk_arena)
+	{
+		if (mark < 0 || mark > hunk_arena->used)
+			Sys_Error ("Hunk_FreeToLowMark: bad arena mark %i", mark);
+		if (!hunk_arena->base)
+		{
+			Hunk_FreeToHighMark (hunk_arena->highmark + mark);
+			hunk_arena->used = mark;
+			return;
+		}
+		memset (hunk_arena->base + mark, 0, hunk_arena->used - mark);
+		hunk_arena->used = mark;
+		return;
+	}
+
 	if (mark < 0 || mark > hunk_low_used)
 		Sys_Error ("Hunk_FreeToLowMark: bad mark %i", mark);
 	memset (hunk_base + mark, 0, hunk_low_used - mark);
 	hunk_low_used = mark;
 }
 
+/*
+===================
+Hunk_InitArena
+
+buf has to be 16 byte aligned
+===================
+*/
+void Hunk_InitArena (hunkarena_t *arena, void *buf, int size)
+{
+	arena->base = (byte *)buf;
+	arena->size = size & ~15;
+	arena->used = 0;
+	arena->peak = 0;
+	memset (arena->base, 0, arena->size);
+}
+
+/*
+===================
+Hunk_InitHighArena
+
+The arena takes from the top of the hunk, above what is there now, until
+Hunk_FreeToHighMark (arena->highmark) gives it all back
+===================
+*/
+void Hunk_InitHighArena (hunkarena_t *arena)
+{
+	arena->base = NULL;
+	arena->highmark = Hunk_HighMark ();
+	arena->size = hunk_size - hunk_low_used - hunk_high_used;
+	arena->used = 0;
+	arena->peak = 0;
+}
+
+/*
+===================
+Hunk_SetArena
+===================
+*/
+hunkarena_t *Hunk_SetArena (hunkarena_t *arena)
+{
+	hunkarena_t	*old;
+
+	old = hunk_arena;
+	hunk_arena = arena;
+	return old;
+}
+
 int	Hunk_HighMark (void)
 {
 	if (hunk_tempactive)
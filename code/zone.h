@@ -108,6 +108,23 @@ void *Hunk_TempAlloc (int size);
 
 void Hunk_Check (void);
 
+// a separate block the low hunk allocations can be pointed at, so a server
+// instance can throw its level away without touching anything else
+typedef struct
+{
+	byte	*base;			// NULL for the top of the hunk
+	int		size;
+	int		used;
+	int		peak;			// highest used since Hunk_InitArena
+	int		highmark;		// Hunk_HighMark it starts at on top of the hunk
+} hunkarena_t;
+
+void Hunk_InitArena (hunkarena_t *arena, void *buf, int size);
+void Hunk_InitHighArena (hunkarena_t *arena);
+hunkarena_t *Hunk_SetArena (hunkarena_t *arena);
+// Hunk_AllocName, Hunk_LowMark and Hunk_FreeToLowMark work in arena until
+// it is set back, NULL for the hunk itself.  Returns the previous arena.
+
 typedef struct cache_user_s
 {
 	void	*data;